@@ -0,0 +1,264 @@
+#include "allocator.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+using detail::MAX_POOLED_SIZE;
+using detail::POOL_ALIGNMENT;
+
+// Память пулов нарезается из выровненных по своему размеру чанков, поэтому чанк
+// (а вместе с ним пул-владелец и размерный класс) находится по адресу блока
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+constexpr size_t CHUNK_HEADER_SIZE = 64;
+constexpr size_t SIZE_CLASS_COUNT = MAX_POOLED_SIZE / POOL_ALIGNMENT;
+
+class Pool;
+
+struct Block {
+    Block* next;
+};
+
+struct ChunkHeader {
+    Pool* owner;
+    size_t size_class;
+};
+
+size_t SizeClassOf(size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / POOL_ALIGNMENT;
+}
+
+size_t BlockSizeOf(size_t size_class) {
+    return (size_class + 1) * POOL_ALIGNMENT;
+}
+
+ChunkHeader* ChunkOf(void* p) {
+    return reinterpret_cast<ChunkHeader*>(reinterpret_cast<uintptr_t>(p) & ~(CHUNK_SIZE - 1));
+}
+
+// Счётчик, который изменяет только поток-владелец, а читают все
+void Increase(atomic<size_t>& counter, size_t value) {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+class Pool {
+public:
+    void* Allocate(size_t bytes) {
+        const size_t size_class = SizeClassOf(bytes);
+        Increase(allocations_, 1);
+        Increase(allocated_bytes_, BlockSizeOf(size_class));
+
+        Block*& head = free_[size_class];
+        if (!head) {
+            DrainRemoteFrees();
+        }
+        if (head) {
+            Increase(pool_hits_, 1);
+            Block* block = head;
+            head = block->next;
+            return block;
+        }
+        if (bump_[size_class] == end_[size_class]) {
+            AddChunk(size_class);
+        }
+        void* result = bump_[size_class];
+        bump_[size_class] += BlockSizeOf(size_class);
+        return result;
+    }
+
+    // Освобождение блока потоком-владельцем пула
+    void LocalFree(void* p, size_t size_class) {
+        Increase(local_frees_, 1);
+        Increase(local_freed_bytes_, BlockSizeOf(size_class));
+        Push(p, size_class);
+    }
+
+    // Освобождение блока любым другим потоком
+    void RemoteFree(void* p, size_t size_class) {
+        remote_frees_.fetch_add(1, memory_order_relaxed);
+        remote_freed_bytes_.fetch_add(BlockSizeOf(size_class), memory_order_relaxed);
+
+        Block* block = static_cast<Block*>(p);
+        block->next = remote_free_.load(memory_order_relaxed);
+        while (!remote_free_.compare_exchange_weak(block->next, block, memory_order_release,
+                                                   memory_order_relaxed)) {
+        }
+    }
+
+    void AddStats(AllocatorStats& stats) const {
+        const size_t allocations = allocations_.load(memory_order_relaxed);
+        const size_t frees = local_frees_.load(memory_order_relaxed)
+                           + remote_frees_.load(memory_order_relaxed);
+        const size_t allocated = allocated_bytes_.load(memory_order_relaxed);
+        const size_t freed = local_freed_bytes_.load(memory_order_relaxed)
+                           + remote_freed_bytes_.load(memory_order_relaxed);
+        stats.allocations += allocations;
+        stats.pool_hits += pool_hits_.load(memory_order_relaxed);
+        stats.live_objects += allocations - frees;
+        stats.live_bytes += allocated - freed;
+    }
+
+private:
+    void Push(void* p, size_t size_class) {
+        Block* block = static_cast<Block*>(p);
+        block->next = free_[size_class];
+        free_[size_class] = block;
+    }
+
+    void DrainRemoteFrees() {
+        Block* block = remote_free_.exchange(nullptr, memory_order_acquire);
+        while (block) {
+            Block* next = block->next;
+            Push(block, ChunkOf(block)->size_class);
+            block = next;
+        }
+    }
+
+    void AddChunk(size_t size_class) {
+        void* memory = aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+        if (!memory) {
+            throw bad_alloc();
+        }
+        auto* header = static_cast<ChunkHeader*>(memory);
+        header->owner = this;
+        header->size_class = size_class;
+
+        const size_t block_size = BlockSizeOf(size_class);
+        char* begin = static_cast<char*>(memory) + CHUNK_HEADER_SIZE;
+        bump_[size_class] = begin;
+        end_[size_class] = begin + (CHUNK_SIZE - CHUNK_HEADER_SIZE) / block_size * block_size;
+    }
+
+    array<Block*, SIZE_CLASS_COUNT> free_{};
+    array<char*, SIZE_CLASS_COUNT> bump_{};
+    array<char*, SIZE_CLASS_COUNT> end_{};
+    atomic<Block*> remote_free_{nullptr};
+
+    atomic<size_t> allocations_{0};
+    atomic<size_t> pool_hits_{0};
+    atomic<size_t> allocated_bytes_{0};
+    atomic<size_t> local_frees_{0};
+    atomic<size_t> local_freed_bytes_{0};
+    atomic<size_t> remote_frees_{0};
+    atomic<size_t> remote_freed_bytes_{0};
+};
+
+// Пулы никогда не уничтожаются: при завершении потока его пул вместе с чанками
+// передаётся следующему потоку, поэтому блоки можно освобождать в любой момент
+struct PoolRegistry {
+    mutex m;
+    vector<Pool*> all;
+    vector<Pool*> idle;
+};
+
+PoolRegistry& Registry() {
+    static auto* registry = new PoolRegistry;
+    return *registry;
+}
+
+Pool* AcquirePool() {
+    auto& registry = Registry();
+    lock_guard guard(registry.m);
+    if (!registry.idle.empty()) {
+        Pool* pool = registry.idle.back();
+        registry.idle.pop_back();
+        return pool;
+    }
+    registry.all.push_back(new Pool);
+    return registry.all.back();
+}
+
+void ReleasePool(Pool* pool) {
+    auto& registry = Registry();
+    lock_guard guard(registry.m);
+    registry.idle.push_back(pool);
+}
+
+thread_local Pool* tls_pool = nullptr;
+thread_local bool tls_exiting = false;
+
+struct PoolLease {
+    ~PoolLease() {
+        if (tls_pool) {
+            ReleasePool(tls_pool);
+            tls_pool = nullptr;
+        }
+        tls_exiting = true;
+    }
+};
+
+thread_local PoolLease tls_lease;
+
+Pool& CurrentPool() {
+    if (!tls_pool) {
+        tls_pool = AcquirePool();
+        if (!tls_exiting) {
+            // Первое обращение регистрирует деструктор, возвращающий пул при выходе из потока
+            static_cast<void>(tls_lease);
+        }
+    }
+    return *tls_pool;
+}
+
+atomic<size_t> large_allocations{0};
+atomic<size_t> large_frees{0};
+atomic<size_t> large_bytes{0};
+atomic<size_t> large_freed_bytes{0};
+
+}  // namespace
+
+namespace detail {
+
+void* PoolAllocate(size_t bytes) {
+    if (bytes > MAX_POOLED_SIZE) {
+        large_allocations.fetch_add(1, memory_order_relaxed);
+        large_bytes.fetch_add(bytes, memory_order_relaxed);
+        return ::operator new(bytes);
+    }
+    return CurrentPool().Allocate(bytes);
+}
+
+void PoolDeallocate(void* p, size_t bytes) noexcept {
+    if (bytes > MAX_POOLED_SIZE) {
+        large_frees.fetch_add(1, memory_order_relaxed);
+        large_freed_bytes.fetch_add(bytes, memory_order_relaxed);
+        ::operator delete(p);
+        return;
+    }
+    ChunkHeader* chunk = ChunkOf(p);
+    if (chunk->owner == tls_pool) {
+        chunk->owner->LocalFree(p, chunk->size_class);
+    } else {
+        chunk->owner->RemoteFree(p, chunk->size_class);
+    }
+}
+
+}  // namespace detail
+
+AllocatorStats GetAllocatorStats() {
+    AllocatorStats stats;
+    {
+        auto& registry = Registry();
+        lock_guard guard(registry.m);
+        for (const Pool* pool : registry.all) {
+            pool->AddStats(stats);
+        }
+    }
+    const size_t allocations = large_allocations.load(memory_order_relaxed);
+    stats.allocations += allocations;
+    stats.live_objects += allocations - large_frees.load(memory_order_relaxed);
+    stats.live_bytes += large_bytes.load(memory_order_relaxed)
+                      - large_freed_bytes.load(memory_order_relaxed);
+    return stats;
+}
+
+}  // namespace runtime
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace runtime {
+
+// Статистика пулового аллокатора объектов Mython
+struct AllocatorStats {
+    // Количество живых объектов и занимаемые ими байты
+    size_t live_objects = 0;
+    size_t live_bytes = 0;
+    // Общее количество выделений памяти
+    size_t allocations = 0;
+    // Количество выделений, обслуженных из списков свободных блоков
+    size_t pool_hits = 0;
+
+    // Доля выделений, обслуженных из списков свободных блоков
+    [[nodiscard]] double HitRate() const {
+        return allocations == 0 ? 0.0 : static_cast<double>(pool_hits) / allocations;
+    }
+};
+
+// Возвращает суммарную статистику всех пулов процесса
+AllocatorStats GetAllocatorStats();
+
+namespace detail {
+// Блоки размером больше этого значения выделяются через глобальный operator new
+inline constexpr size_t MAX_POOLED_SIZE = 256;
+inline constexpr size_t POOL_ALIGNMENT = 16;
+
+void* PoolAllocate(size_t bytes);
+void PoolDeallocate(void* p, size_t bytes) noexcept;
+}  // namespace detail
+
+/*
+ * Аллокатор, раздающий память из пулов блоков фиксированных размеров.
+ * Пул закрепляется за потоком: выделение и освобождение в «своём» потоке не требуют
+ * синхронизации, а блоки, освобождённые другими потоками, возвращаются владельцу
+ * через lock-free список и переиспользуются им.
+ */
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& /*other*/) noexcept {  // NOLINT(google-explicit-constructor)
+    }
+
+    T* allocate(size_t n) {
+        if constexpr (alignof(T) > detail::POOL_ALIGNMENT) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        } else {
+            return static_cast<T*>(detail::PoolAllocate(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if constexpr (alignof(T) > detail::POOL_ALIGNMENT) {
+            ::operator delete(p, std::align_val_t{alignof(T)});
+        } else {
+            detail::PoolDeallocate(p, n * sizeof(T));
+        }
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& /*lhs*/, const PoolAllocator<U>& /*rhs*/) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& /*lhs*/, const PoolAllocator<U>& /*rhs*/) {
+    return false;
+}
+
+}  // namespace runtime
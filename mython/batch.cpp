@@ -0,0 +1,170 @@
+#include "batch.h"
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <sstream>
+
+using namespace std;
+
+namespace batch {
+
+struct BatchRunner::CachedProgram {
+    ~CachedProgram() {
+        delete program.load();
+    }
+
+    once_flag parsed;
+    // Текущая версия программы. Заменённые версии освобождаются через program_epochs_
+    atomic<const mython::CompiledProgram*> program = nullptr;
+    // Ошибка первого разбора запоминается, чтобы не разбирать файл повторно для каждого задания
+    string error;
+    // Перезагрузки одного файла выполняются по очереди
+    mutex reload_mutex;
+};
+
+string ResolvePath(const string& path, const string& base_dir) {
+    if (path.empty() || path.front() == '/' || base_dir.empty()) {
+        return path;
+    }
+    return base_dir + "/"s + path;
+}
+
+vector<Job> ReadManifest(istream& input, const string& base_dir) {
+    vector<Job> jobs;
+    for (string line; getline(input, line);) {
+        istringstream fields(line);
+        Job job;
+        if (!(fields >> job.script) || job.script.front() == '#') {
+            continue;
+        }
+        fields >> job.input;
+        job.script = ResolvePath(job.script, base_dir);
+        job.input = ResolvePath(job.input, base_dir);
+        jobs.push_back(move(job));
+    }
+    return jobs;
+}
+
+BatchRunner::BatchRunner(ParseOptions options)
+: interpreter_(move(options)) {
+}
+
+BatchRunner::~BatchRunner() = default;
+
+vector<JobResult> BatchRunner::Run(const vector<Job>& jobs, size_t thread_count, BatchStats* stats,
+                                   runtime::OutputMerger* output) {
+    vector<JobResult> results(jobs.size());
+    const auto start = chrono::steady_clock::now();
+    size_t steals = 0;
+    {
+        runtime::WorkStealingPool pool(thread_count);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            // Каждое задание пишет только в свой элемент results
+            pool.Submit([this, &job = jobs[i], &result = results[i], output, i] {
+                if (output) {
+                    runtime::BufferedContext context(*output, i);
+                    result = RunJob(job, context);
+                    return;
+                }
+                ostringstream buffer;
+                runtime::SimpleContext context{buffer};
+                result = RunJob(job, context);
+                result.output = buffer.str();
+            });
+        }
+        pool.Wait();
+        steals = pool.GetStealCount();
+        thread_count = pool.GetThreadCount();
+    }
+    if (stats) {
+        stats->jobs = jobs.size();
+        stats->threads = thread_count;
+        stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        stats->steals = steals;
+    }
+    return results;
+}
+
+size_t BatchRunner::GetParsedCount() const {
+    lock_guard lock(mutex_);
+    return programs_.size();
+}
+
+JobResult BatchRunner::RunJob(const Job& job, runtime::Context& context) {
+    JobResult result;
+    optional<mython::CompiledProgram> program;
+    try {
+        if (!job.input.empty()) {
+            program = LoadProgram(job.input).Then(LoadProgram(job.script));
+        } else {
+            program = LoadProgram(job.script);
+        }
+    } catch (const ParseError& e) {
+        result.error = e.what();
+        return result;
+    }
+    mython::ExecutionResult execution = program->Run(context, {}, {job.limits, job.memory_quota});
+    result.error = move(execution.error);
+    result.memory = execution.memory;
+    return result;
+}
+
+void BatchRunner::Reload(const string& path) {
+    CachedProgram& cached = GetEntry(path);
+    lock_guard lock(cached.reload_mutex);
+    auto program = make_unique<mython::CompiledProgram>(interpreter_.CompileFile(path));
+    // Если файл ещё не разбирался, новая программа становится первой версией
+    bool first = false;
+    call_once(cached.parsed, [&cached, &program, &first] {
+        cached.program = program.release();
+        first = true;
+    });
+    if (first) {
+        return;
+    }
+    const mython::CompiledProgram* previous = cached.program.exchange(program.release());
+    if (previous) {
+        program_epochs_.Retire([previous] {
+            delete previous;
+        });
+    }
+}
+
+size_t BatchRunner::GetRetiredCount() const {
+    return program_epochs_.GetRetiredCount();
+}
+
+BatchRunner::CachedProgram& BatchRunner::GetEntry(const string& path) {
+    lock_guard lock(mutex_);
+    auto& entry = programs_[path];
+    if (!entry) {
+        entry = make_unique<CachedProgram>();
+    }
+    return *entry;
+}
+
+mython::CompiledProgram BatchRunner::LoadProgram(const string& path) {
+    CachedProgram& cached = GetEntry(path);
+    // Задания, которым нужен один и тот же файл, ждут, пока его разберёт первое из них
+    call_once(cached.parsed, [this, &path, &cached] {
+        try {
+            cached.program = new mython::CompiledProgram(interpreter_.CompileFile(path));
+        } catch (const exception& e) {
+            cached.error = e.what();
+        }
+    });
+    // Копия разделяет программу с версией в кеше и переживает её замену, поэтому ячейка эпохи
+    // занята только на время копирования, а не всё время выполнения задания
+    runtime::EpochDomain::Guard guard(program_epochs_);
+    const mython::CompiledProgram* program = cached.program.load();
+    if (!program) {
+        throw ParseError(cached.error);
+    }
+    return *program;
+}
+
+}  // namespace batch
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "epoch.h"
+#include "execution_limits.h"
+#include "interpreter.h"
+#include "output.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace batch {
+
+// Задание пакета: сценарий и необязательный файл входных данных.
+// Входные данные - программа Mython, выполняемая перед сценарием в тех же глобальных переменных
+struct Job {
+    std::string script;
+    std::string input;
+    // Квота памяти объектов задания в байтах. Ноль - без ограничения
+    size_t memory_quota = 0;
+    // Ограничения топлива и времени выполнения задания вместе с входными данными
+    runtime::ExecutionLimits limits{};
+};
+
+struct JobResult {
+    std::string output;
+    // Сообщение об ошибке либо пустая строка, если сценарий выполнен успешно
+    std::string error;
+    // Память объектов задания. current - по завершении сценария, пока живы глобальные переменные
+    runtime::MemoryUsage memory;
+};
+
+struct BatchStats {
+    size_t jobs = 0;
+    size_t threads = 0;
+    double seconds = 0;
+    // Количество заданий, перехваченных потоками пула друг у друга
+    size_t steals = 0;
+
+    [[nodiscard]] double Throughput() const {
+        return seconds > 0 ? static_cast<double>(jobs) / seconds : 0.0;
+    }
+};
+
+// Возвращает путь path, отсчитанный от каталога base_dir, если path относительный
+std::string ResolvePath(const std::string& path, const std::string& base_dir);
+
+// Читает манифест: по одному заданию в строке, путь к сценарию и, через пробел, путь к входным
+// данным. Пустые строки и строки, начинающиеся с #, пропускаются. Относительные пути
+// отсчитываются от каталога base_dir
+std::vector<Job> ReadManifest(std::istream& input, const std::string& base_dir);
+
+/*
+ * Выполняет задания пакета на пуле потоков с перехватом работы. Каждое задание
+ * выполняется в отдельном интерпретаторе со своими глобальными переменными, SimpleContext
+ * и буфером вывода. Каждый файл разбирается один раз за время жизни BatchRunner,
+ * и разобранная программа выполняется всеми заданиями, которые её используют
+ */
+class BatchRunner {
+public:
+    explicit BatchRunner(ParseOptions options = {});
+    ~BatchRunner();
+
+    /*
+     * Выполняет задания jobs на thread_count потоках. Результаты возвращаются
+     * в порядке заданий независимо от порядка их выполнения.
+     * Если задан output, вывод задания i передаётся в его поток вывода с номером i
+     * по мере выполнения, а не сохраняется в JobResult::output
+     */
+    std::vector<JobResult> Run(const std::vector<Job>& jobs, size_t thread_count,
+                               BatchStats* stats = nullptr, runtime::OutputMerger* output = nullptr);
+
+    // Выполняет одно задание с новыми глобальными переменными, выводя в context.
+    // Может вызываться из нескольких потоков одновременно. Поле output результата не заполняется
+    JobResult RunJob(const Job& job, runtime::Context& context);
+
+    /*
+     * Заново разбирает файл path и публикует новую программу: задания, начатые после
+     * вызова, выполняют её, а уже выполняемые задания завершаются со старой программой.
+     * Старая программа освобождается, когда завершится последнее задание, которое её выполняет.
+     * Не ждёт выполняемых заданий. Если файл не удалось прочитать или разобрать,
+     * выбрасывает ParseError и оставляет прежнюю программу
+     */
+    void Reload(const std::string& path);
+
+    // Возвращает количество разобранных файлов
+    [[nodiscard]] size_t GetParsedCount() const;
+    // Возвращает количество заменённых версий программ в кеше, ещё не освобождённых
+    [[nodiscard]] size_t GetRetiredCount() const;
+
+private:
+    struct CachedProgram;
+
+    CachedProgram& GetEntry(const std::string& path);
+    // Возвращает текущую версию разобранной программы из файла path. Выбрасывает ParseError,
+    // если файл не удалось прочитать или разобрать
+    mython::CompiledProgram LoadProgram(const std::string& path);
+
+    mython::Interpreter interpreter_;
+    // Защищает версии программ в кеше от освобождения при перезагрузке, пока задание их копирует
+    runtime::EpochDomain program_epochs_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<CachedProgram>> programs_;
+};
+
+}  // namespace batch
@@ -0,0 +1,271 @@
+#include "collector.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Сборщики не уничтожаются: объекты завершившегося потока продолжают числиться
+// в его сборщике, который переходит к следующему потоку
+struct CollectorRegistry {
+    mutex m;
+    vector<CycleCollector*> idle;
+};
+
+CollectorRegistry& Registry() {
+    static auto* registry = new CollectorRegistry;
+    return *registry;
+}
+
+thread_local CycleCollector* tls_collector = nullptr;
+thread_local bool tls_exiting = false;
+
+struct CollectorLease {
+    ~CollectorLease() {
+        if (tls_collector) {
+            auto& registry = Registry();
+            lock_guard guard(registry.m);
+            registry.idle.push_back(tls_collector);
+            tls_collector = nullptr;
+        }
+        tls_exiting = true;
+    }
+};
+
+thread_local CollectorLease tls_lease;
+
+}  // namespace
+
+Collectable::Collectable() {
+    collector_ = &CycleCollector::Current();
+    collector_->Track(this);
+}
+
+Collectable::Collectable(const Collectable& /*other*/)
+: Collectable() {
+}
+
+Collectable::Collectable(Collectable&& /*other*/) noexcept
+: Collectable() {
+}
+
+Collectable::~Collectable() {
+    StopTracking();
+}
+
+void Collectable::StopTracking() noexcept {
+    if (collector_) {
+        collector_->Untrack(this);
+        collector_ = nullptr;
+    }
+}
+
+CycleCollector& CycleCollector::Current() {
+    if (!tls_collector) {
+        auto& registry = Registry();
+        {
+            lock_guard guard(registry.m);
+            if (!registry.idle.empty()) {
+                tls_collector = registry.idle.back();
+                registry.idle.pop_back();
+            }
+        }
+        if (!tls_collector) {
+            tls_collector = new CycleCollector;
+        }
+        if (!tls_exiting) {
+            static_cast<void>(tls_lease);
+        }
+    }
+    return *tls_collector;
+}
+
+void CycleCollector::SetThreshold(size_t threshold) {
+    threshold_ = threshold;
+}
+
+size_t CycleCollector::GetThreshold() const {
+    return threshold_;
+}
+
+void CycleCollector::SetFullCollectionInterval(size_t interval) {
+    full_interval_ = interval;
+}
+
+void CycleCollector::MaybeCollect() {
+    if (threshold_ == 0 || ++allocations_ < threshold_) {
+        return;
+    }
+    allocations_ = 0;
+    ++automatic_collections_;
+    Collect(full_interval_ != 0 && automatic_collections_ % full_interval_ == 0);
+}
+
+size_t CycleCollector::Collect(bool full) {
+    const auto start = chrono::steady_clock::now();
+
+    vector<shared_ptr<Object>> garbage;
+    vector<Collectable*> garbage_objects;
+    size_t reclaimed_bytes = 0;
+    {
+        lock_guard guard(mutex_);
+
+        vector<Collectable*> nodes;
+        for (Collectable* object = young_; object; object = object->next_) {
+            nodes.push_back(object);
+        }
+        if (full) {
+            for (Collectable* object = old_; object; object = object->next_) {
+                nodes.push_back(object);
+            }
+        }
+
+        unordered_map<const Object*, size_t> index;
+        index.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            index[nodes[i]] = i;
+        }
+
+        // Число владельцев объекта за вычетом ссылок из просматриваемых объектов.
+        // Объекты без владельцев (на стеке или в процессе разрушения) считаются живыми
+        vector<long> external(nodes.size());
+        vector<bool> reachable(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            external[i] = nodes[i]->weak_from_this().use_count();
+            reachable[i] = external[i] == 0;
+        }
+        for (const Collectable* object : nodes) {
+            object->ForEachReference([&](const ObjectHolder& ref) {
+                if (auto it = index.find(ref.Get()); it != index.end() && external[it->second] > 0) {
+                    --external[it->second];
+                }
+            });
+        }
+
+        vector<const Collectable*> stack;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (external[i] > 0) {
+                reachable[i] = true;
+            }
+            if (reachable[i]) {
+                stack.push_back(nodes[i]);
+            }
+        }
+        while (!stack.empty()) {
+            const Collectable* object = stack.back();
+            stack.pop_back();
+            object->ForEachReference([&](const ObjectHolder& ref) {
+                if (auto it = index.find(ref.Get()); it != index.end() && !reachable[it->second]) {
+                    reachable[it->second] = true;
+                    stack.push_back(nodes[it->second]);
+                }
+            });
+        }
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            Collectable* object = nodes[i];
+            if (!reachable[i]) {
+                if (auto strong = object->weak_from_this().lock()) {
+                    garbage.push_back(move(strong));
+                    garbage_objects.push_back(object);
+                    reclaimed_bytes += object->GetMemoryUsage();
+                    continue;
+                }
+            }
+            if (!object->old_) {
+                Unlink(young_, object);
+                Link(old_, object);
+                object->old_ = true;
+            }
+        }
+    }
+
+    // Ссылки очищаются без блокировки: разрушаемые объекты снимаются с учёта сами
+    for (Collectable* object : garbage_objects) {
+        object->ClearReferences();
+    }
+    garbage.clear();
+
+    const auto pause = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+    lock_guard guard(mutex_);
+    ++(full ? stats_.full_collections : stats_.young_collections);
+    stats_.reclaimed_objects += garbage_objects.size();
+    stats_.reclaimed_bytes += reclaimed_bytes;
+    stats_.last_pause = pause;
+    stats_.max_pause = max(stats_.max_pause, pause);
+    stats_.total_pause += pause;
+    return garbage_objects.size();
+}
+
+CollectorStats CycleCollector::GetStats() const {
+    lock_guard guard(mutex_);
+    CollectorStats stats = stats_;
+    stats.tracked_objects = tracked_;
+    return stats;
+}
+
+void CycleCollector::Track(Collectable* object) {
+    lock_guard guard(mutex_);
+    Link(young_, object);
+    ++tracked_;
+}
+
+void CycleCollector::Untrack(Collectable* object) noexcept {
+    lock_guard guard(mutex_);
+    Unlink(object->old_ ? old_ : young_, object);
+    --tracked_;
+}
+
+void CycleCollector::Adopt(const ObjectHolder& root) {
+    // Граф просматривается целиком: объекты чужих сборщиков могут быть достижимы
+    // и через объекты, уже числящиеся в этом сборщике
+    unordered_set<const Collectable*> visited;
+    vector<Collectable*> stack;
+    auto visit = [this, &visited, &stack](const ObjectHolder& ref) {
+        auto* object = dynamic_cast<Collectable*>(ref.Get());
+        if (!object || !visited.insert(object).second) {
+            return;
+        }
+        if (object->collector_ && object->collector_ != this) {
+            object->collector_->Untrack(object);
+            object->old_ = false;
+            object->collector_ = this;
+            Track(object);
+        }
+        stack.push_back(object);
+    };
+    visit(root);
+    while (!stack.empty()) {
+        Collectable* object = stack.back();
+        stack.pop_back();
+        object->ForEachReference(visit);
+    }
+}
+
+void CycleCollector::Link(Collectable*& head, Collectable* object) {
+    object->prev_ = nullptr;
+    object->next_ = head;
+    if (head) {
+        head->prev_ = object;
+    }
+    head = object;
+}
+
+void CycleCollector::Unlink(Collectable*& head, Collectable* object) {
+    if (object->prev_) {
+        object->prev_->next_ = object->next_;
+    } else {
+        head = object->next_;
+    }
+    if (object->next_) {
+        object->next_->prev_ = object->prev_;
+    }
+    object->prev_ = object->next_ = nullptr;
+}
+
+}  // namespace runtime
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace runtime {
+
+// Статистика сборщика циклических ссылок
+struct CollectorStats {
+    // Количество выполненных сборок: только молодого поколения и полных
+    size_t young_collections = 0;
+    size_t full_collections = 0;
+    // Количество отслеживаемых объектов
+    size_t tracked_objects = 0;
+    // Количество и суммарный объём освобождённых объектов
+    size_t reclaimed_objects = 0;
+    size_t reclaimed_bytes = 0;
+    // Длительность последней, самой долгой и всех пауз на сборку
+    std::chrono::nanoseconds last_pause{0};
+    std::chrono::nanoseconds max_pause{0};
+    std::chrono::nanoseconds total_pause{0};
+};
+
+/*
+ * Сборщик циклических ссылок между объектами Collectable (экземплярами классов и т.п.).
+ * Использует пробное удаление: из числа владельцев каждого объекта вычитаются ссылки
+ * из других отслеживаемых объектов. Объекты, на которые остались внешние ссылки, и всё,
+ * что из них достижимо, живы. Остальные объекты удерживаются только циклами, поэтому
+ * сборщик очищает их ссылки, разрывая циклы.
+ *
+ * Сборка выполняется инкрементально по поколениям: каждая сборка просматривает только
+ * объекты, созданные после предыдущей сборки, а выжившие объекты переходят в старшее
+ * поколение, которое просматривается при полной сборке. Поэтому пауза на сборку
+ * пропорциональна числу недавно созданных объектов, а не размеру всей кучи.
+ *
+ * У каждого потока свой сборщик, он отслеживает объекты, созданные в этом потоке
+ * либо переданные ему методом Adopt.
+ */
+class CycleCollector {
+public:
+    // Возвращает сборщик текущего потока
+    static CycleCollector& Current();
+
+    // Задаёт количество созданных объектов, после которого MaybeCollect запускает сборку.
+    // Нулевой порог отключает автоматическую сборку
+    void SetThreshold(size_t threshold);
+    [[nodiscard]] size_t GetThreshold() const;
+
+    // Задаёт, какая по счёту автоматическая сборка просматривает все поколения
+    void SetFullCollectionInterval(size_t interval);
+
+    // Учитывает создание объекта и при достижении порога выполняет сборку.
+    // Вызывается интерпретатором в точках, где нет ссылок на объекты в обход ObjectHolder
+    void MaybeCollect();
+
+    // Выполняет сборку молодого поколения либо всех объектов.
+    // Возвращает количество освобождённых объектов
+    size_t Collect(bool full = true);
+
+    [[nodiscard]] CollectorStats GetStats() const;
+
+    // Переводит на учёт этого сборщика все объекты Collectable, достижимые из root.
+    // Вызывается потоком, который получил исключительное владение графом объектов,
+    // созданным в другом потоке: после этого сборщик чужого потока его не просматривает
+    void Adopt(const ObjectHolder& root);
+
+private:
+    friend class Collectable;
+
+    void Track(Collectable* object);
+    void Untrack(Collectable* object) noexcept;
+
+    static void Link(Collectable*& head, Collectable* object);
+    static void Unlink(Collectable*& head, Collectable* object);
+
+    mutable std::mutex mutex_;
+    Collectable* young_ = nullptr;
+    Collectable* old_ = nullptr;
+    size_t tracked_ = 0;
+
+    size_t threshold_ = 10'000;
+    size_t full_interval_ = 10;
+    size_t allocations_ = 0;
+    size_t automatic_collections_ = 0;
+
+    CollectorStats stats_;
+};
+
+}  // namespace runtime
@@ -0,0 +1,104 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+EpochDomain::EpochDomain()
+: slots_(make_unique<Slot[]>(SLOT_COUNT)) {
+}
+
+EpochDomain::~EpochDomain() {
+    for (Retired& retired : retired_) {
+        retired.deleter();
+    }
+}
+
+EpochDomain::Guard::Guard(EpochDomain& domain)
+: domain_(domain)
+, slot_(domain.Pin()) {
+}
+
+EpochDomain::Guard::~Guard() {
+    domain_.Unpin(slot_);
+}
+
+size_t EpochDomain::Pin() {
+    // Потоки начинают поиск свободной ячейки с разных мест, чтобы не занимать одни и те же
+    static thread_local const size_t start = hash<thread::id>{}(this_thread::get_id());
+    for (;;) {
+        for (size_t i = 0; i < SLOT_COUNT; ++i) {
+            const size_t index = (start + i) % SLOT_COUNT;
+            Slot& slot = slots_[index];
+            if (slot.epoch.load(memory_order_relaxed) != FREE) {
+                continue;
+            }
+            // Эпоха могла смениться после чтения: тогда ячейка лишь дольше удерживает
+            // старые данные. Данные, освобождённые до занятия ячейки, читатель уже не увидит:
+            // они заменены раньше, чем писатель проверил ячейки
+            uint64_t expected = FREE;
+            if (slot.epoch.compare_exchange_strong(expected, epoch_.load())) {
+                return index;
+            }
+        }
+        // Все ячейки заняты: читателей больше, чем ячеек
+        this_thread::yield();
+    }
+}
+
+void EpochDomain::Unpin(size_t slot) {
+    slots_[slot].epoch.store(FREE);
+    if (retired_count_.load(memory_order_relaxed) > 0) {
+        TryReclaim();
+    }
+}
+
+void EpochDomain::Retire(function<void()> deleter) {
+    {
+        lock_guard lock(mutex_);
+        // Читатели, занявшие ячейку в новой эпохе, видят уже новую версию данных
+        const uint64_t epoch = epoch_.fetch_add(1) + 1;
+        retired_.push_back({epoch, move(deleter)});
+        retired_count_.fetch_add(1);
+    }
+    TryReclaim();
+}
+
+size_t EpochDomain::TryReclaim() {
+    vector<Retired> reclaimable;
+    {
+        unique_lock lock(mutex_, try_to_lock);
+        // Освобождением уже занят другой поток
+        if (!lock.owns_lock()) {
+            return 0;
+        }
+        uint64_t oldest = UINT64_MAX;
+        for (size_t i = 0; i < SLOT_COUNT; ++i) {
+            const uint64_t epoch = slots_[i].epoch.load();
+            if (epoch != FREE) {
+                oldest = min(oldest, epoch);
+            }
+        }
+        auto still_visible = partition(retired_.begin(), retired_.end(), [oldest](const Retired& retired) {
+            return retired.epoch > oldest;
+        });
+        reclaimable.assign(make_move_iterator(still_visible), make_move_iterator(retired_.end()));
+        retired_.erase(still_visible, retired_.end());
+        retired_count_.fetch_sub(reclaimable.size());
+    }
+    // Разрушение данных может быть долгим, поэтому выполняется без блокировки
+    for (Retired& retired : reclaimable) {
+        retired.deleter();
+    }
+    return reclaimable.size();
+}
+
+size_t EpochDomain::GetRetiredCount() const {
+    return retired_count_.load();
+}
+
+}  // namespace runtime
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace runtime {
+
+/*
+ * Освобождение по эпохам для данных, которые читаются многими потоками без блокировок
+ * и изредка заменяются целиком (RCU). Читатель на время обращения к данным занимает
+ * ячейку, записывая в неё текущую эпоху. Писатель публикует новую версию данных,
+ * а старую передаёт в Retire: она освобождается, когда все читатели, которые могли
+ * её видеть, освободят свои ячейки. Ни читатели, ни писатель при этом не ждут друг друга.
+ *
+ * Ячейки не привязаны к потокам, поэтому читателями могут быть любые потоки,
+ * в том числе короткоживущие, а вложенные обращения занимают отдельные ячейки
+ */
+class EpochDomain {
+public:
+    static constexpr size_t SLOT_COUNT = 128;
+
+    EpochDomain();
+    // Освобождает все отложенные объекты. К этому моменту читателей быть не должно
+    ~EpochDomain();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // Защищает от освобождения данные, прочитанные за время жизни объекта
+    class Guard {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        EpochDomain& domain_;
+        size_t slot_;
+    };
+
+    // Откладывает вызов deleter, пока к данным, заменённым до вызова Retire,
+    // могут обращаться читатели. Не ждёт читателей
+    void Retire(std::function<void()> deleter);
+
+    // Выполняет deleter всех данных, которые больше не видит ни один читатель.
+    // Возвращает количество освобождённых объектов. Не ждёт читателей
+    size_t TryReclaim();
+
+    // Возвращает количество объектов, ожидающих освобождения
+    [[nodiscard]] size_t GetRetiredCount() const;
+
+private:
+    struct alignas(64) Slot {
+        // Эпоха, в которой читатель занял ячейку, либо FREE
+        std::atomic<uint64_t> epoch{FREE};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    static constexpr uint64_t FREE = 0;
+
+    size_t Pin();
+    void Unpin(size_t slot);
+
+    std::atomic<uint64_t> epoch_{1};
+    std::unique_ptr<Slot[]> slots_;
+
+    mutable std::mutex mutex_;
+    std::vector<Retired> retired_;
+    std::atomic<size_t> retired_count_{0};
+};
+
+}  // namespace runtime
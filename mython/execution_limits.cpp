@@ -0,0 +1,262 @@
+#include "execution_limits.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+using detail::LimitState;
+
+// Количество единиц топлива между проверками срока
+constexpr long CHECK_INTERVAL = 4096;
+
+thread_local LimitState state;
+
+int64_t SteadyNow() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Грубые часы для проверки сроков. Фоновый поток обновляет время, только пока есть ограничения по времени
+class CoarseClock {
+public:
+    static CoarseClock& Instance() {
+        static CoarseClock clock;
+        return clock;
+    }
+
+    void AddUser() {
+        {
+            lock_guard lock(mutex_);
+            ++users_;
+            now_.store(SteadyNow(), memory_order_relaxed);
+        }
+        changed_.notify_one();
+    }
+
+    void RemoveUser() {
+        lock_guard lock(mutex_);
+        --users_;
+    }
+
+    [[nodiscard]] int64_t Now() const {
+        return now_.load(memory_order_relaxed);
+    }
+
+private:
+    CoarseClock()
+        : thread_([this] {
+            Run();
+        }) {
+    }
+
+    ~CoarseClock() {
+        {
+            lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_one();
+        thread_.join();
+    }
+
+    void Run() {
+        unique_lock lock(mutex_);
+        while (!stopping_) {
+            if (users_ == 0) {
+                changed_.wait(lock);
+                continue;
+            }
+            now_.store(SteadyNow(), memory_order_relaxed);
+            changed_.wait_for(lock, 1ms);
+        }
+    }
+
+    atomic<int64_t> now_{0};
+    mutex mutex_;
+    condition_variable changed_;
+    size_t users_ = 0;
+    bool stopping_ = false;
+    // Поток объявлен последним: он запускается, когда остальные поля уже созданы
+    thread thread_;
+};
+
+// Учитывает топливо, израсходованное из текущей порции
+void Sync(LimitState& s) {
+    s.used += static_cast<uint64_t>(s.batch - detail::fuel_countdown);
+    s.batch = detail::fuel_countdown;
+}
+}  // namespace
+
+namespace detail {
+
+class FuelPool {
+public:
+    explicit FuelPool(uint64_t fuel)
+        : left_(fuel) {
+    }
+
+    // Забирает из запаса не больше amount единиц и возвращает их количество
+    uint64_t Take(uint64_t amount) {
+        uint64_t left = left_.load(memory_order_relaxed);
+        uint64_t taken = 0;
+        do {
+            taken = min(left, amount);
+        } while (taken > 0 && !left_.compare_exchange_weak(left, left - taken, memory_order_relaxed));
+        return taken;
+    }
+
+    void Return(uint64_t amount) {
+        left_.fetch_add(amount, memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t Left() const {
+        return left_.load(memory_order_relaxed);
+    }
+
+private:
+    atomic<uint64_t> left_;
+};
+
+}  // namespace detail
+
+namespace {
+// Доля остатка запаса, которую поток берёт одной порцией
+constexpr uint64_t BATCH_SHARE = 16;
+
+// Начинает новую порцию топлива. Порция ограниченного топлива берётся из общего запаса
+// и может оказаться пустой. Чем меньше остаток, тем меньше порции: топливо, взятое
+// другими потоками и ещё не израсходованное, почти не уменьшает доступное потоку
+void Recharge(LimitState& s) {
+    if (s.fuel) {
+        const uint64_t batch = clamp<uint64_t>(s.fuel->Left() / BATCH_SHARE, 1, CHECK_INTERVAL);
+        s.batch = static_cast<long>(s.fuel->Take(batch));
+    } else if (s.deadline == INT64_MAX) {
+        s.batch = LONG_MAX;
+    } else {
+        s.batch = CHECK_INTERVAL;
+    }
+    detail::fuel_countdown = s.batch;
+}
+
+// Возвращает в общий запас неизрасходованную часть порции, чтобы её могли взять другие потоки
+void Release(LimitState& s) {
+    Sync(s);
+    if (s.fuel) {
+        s.fuel->Return(static_cast<uint64_t>(s.batch));
+        s.batch = 0;
+        detail::fuel_countdown = 0;
+    }
+}
+}  // namespace
+
+namespace detail {
+
+thread_local long fuel_countdown = LONG_MAX;
+
+void CheckLimits() {
+    LimitState& s = state;
+    // Порция израсходована целиком, и требуется ещё одна единица
+    s.used += static_cast<uint64_t>(s.batch);
+    s.batch = 0;
+    fuel_countdown = 0;
+    // Пока ограничение действует, каждая следующая единица снова приводит сюда
+    if (s.deadline != INT64_MAX && CoarseClock::Instance().Now() >= s.deadline) {
+        throw DeadlineExceededError("Execution deadline exceeded"s);
+    }
+    Recharge(s);
+    if (s.batch == 0) {
+        throw FuelExhaustedError("Execution fuel exhausted"s);
+    }
+    --fuel_countdown;
+}
+
+LimitState ExchangeLimitState(const LimitState& new_state) {
+    Release(state);
+    LimitState previous = state;
+    state = new_state;
+    fuel_countdown = state.batch;
+    return previous;
+}
+
+void ReleaseFuel() {
+    Release(state);
+}
+
+LimitState ShareLimitState() {
+    LimitState shared;
+    shared.fuel = state.fuel;
+    // Порция будет взята из запаса при первой проверке
+    shared.batch = shared.fuel ? 0 : LONG_MAX;
+    return shared;
+}
+
+}  // namespace detail
+
+LimitScope::LimitScope(const ExecutionLimits& limits)
+: owns_fuel_(limits.fuel > 0)
+, uses_clock_(limits.timeout.count() > 0) {
+    Release(state);
+    previous_ = state;
+    initial_used_ = state.used;
+    if (owns_fuel_) {
+        // Собственный запас резервируется во внешнем, а остаток возвращается в деструкторе
+        const uint64_t fuel = state.fuel ? state.fuel->Take(limits.fuel) : limits.fuel;
+        state.fuel = make_shared<detail::FuelPool>(fuel);
+    }
+    if (uses_clock_) {
+        CoarseClock::Instance().AddUser();
+        state.deadline = min(state.deadline, SteadyNow() + limits.timeout.count());
+    }
+    Recharge(state);
+}
+
+LimitScope::~LimitScope() {
+    Release(state);
+    if (owns_fuel_) {
+        // Остаток возвращается во внешний запас. Задачи, ещё расходующие этот запас,
+        // больше не получат из него топливо
+        const uint64_t left = state.fuel->Take(UINT64_MAX);
+        if (previous_.fuel) {
+            previous_.fuel->Return(left);
+        }
+    }
+    const uint64_t used = state.used - initial_used_;
+    state = previous_;
+    state.used += used;
+    Recharge(state);
+    if (uses_clock_) {
+        CoarseClock::Instance().RemoveUser();
+    }
+}
+
+uint64_t LimitScope::GetFuelUsed() const {
+    Sync(state);
+    return state.used - initial_used_;
+}
+
+ExecutionLimits GetRemainingLimits() {
+    Sync(state);
+    ExecutionLimits limits;
+    if (state.fuel) {
+        limits.fuel = state.fuel->Left() + static_cast<uint64_t>(state.batch);
+        if (limits.fuel == 0) {
+            throw FuelExhaustedError("Execution fuel exhausted"s);
+        }
+    }
+    if (state.deadline != INT64_MAX) {
+        const int64_t left = state.deadline - SteadyNow();
+        if (left <= 0) {
+            throw DeadlineExceededError("Execution deadline exceeded"s);
+        }
+        limits.timeout = chrono::nanoseconds(left);
+    }
+    return limits;
+}
+
+}  // namespace runtime
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace runtime {
+
+// Ошибка, прерывающая выполнение при исчерпании ограничения
+class ExecutionLimitError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Израсходовано всё топливо
+class FuelExhaustedError : public ExecutionLimitError {
+public:
+    using ExecutionLimitError::ExecutionLimitError;
+};
+
+// Истекло время выполнения
+class DeadlineExceededError : public ExecutionLimitError {
+public:
+    using ExecutionLimitError::ExecutionLimitError;
+};
+
+struct ExecutionLimits {
+    // Количество единиц топлива. Единица расходуется при каждом вызове метода или функции,
+    // итерации цикла и ветвлении if. Ноль - без ограничения
+    uint64_t fuel = 0;
+    // Время выполнения. Ноль - без ограничения
+    std::chrono::nanoseconds timeout{0};
+};
+
+namespace detail {
+
+// Общий запас топлива выполнения и запущенных им задач. Потоки берут из него порции
+class FuelPool;
+
+// Состояние ограничений потока
+struct LimitState {
+    // Запас, из которого берутся порции, либо nullptr, если топливо не ограничено
+    std::shared_ptr<FuelPool> fuel;
+    // Топливо, израсходованное без учёта текущей порции
+    uint64_t used = 0;
+    // Размер текущей порции: количество единиц до следующей проверки ограничений
+    long batch = LONG_MAX;
+    // Срок в наносекундах steady_clock либо INT64_MAX
+    int64_t deadline = INT64_MAX;
+};
+
+// Количество единиц до следующей проверки ограничений. Вне ограничений проверок не бывает
+extern thread_local long fuel_countdown;
+void CheckLimits();
+
+// Устанавливает ограничения потока и возвращает прежние с учётом израсходованного топлива.
+// Нужна, чтобы ограничения сессии планировщика не действовали на другие сессии того же потока
+LimitState ExchangeLimitState(const LimitState& state);
+
+// Возвращает в общий запас неизрасходованную часть порции потока. Вызывается перед ожиданием,
+// чтобы топливо могли расходовать задачи, которых ждёт поток
+void ReleaseFuel();
+
+// Возвращает состояние ограничений для задачи, запущенной из текущего потока: задача берёт
+// топливо из того же запаса, что и запустивший её поток. Срок в состояние не входит
+LimitState ShareLimitState();
+
+}  // namespace detail
+
+// Расходует единицу топлива. Раз в несколько тысяч вызовов проверяет ограничения
+// и выбрасывает FuelExhaustedError или DeadlineExceededError. Вне ограничений почти ничего не стоит
+inline void ConsumeFuel() {
+    if (--detail::fuel_countdown < 0) {
+        detail::CheckLimits();
+    }
+}
+
+/*
+ * Ограничивает выполнение в текущем потоке на время жизни объекта. Вложенные ограничения
+ * не ослабляют внешние: действует меньший запас топлива и более ранний срок,
+ * а топливо, израсходованное внутри, вычитается из внешнего запаса.
+ * Ограничение с нулевым fuel расходует внешний запас. Задачи spawn расходуют запас
+ * вместе с запустившим их потоком (см. detail::ShareLimitState).
+ *
+ * Срок проверяется по грубым часам, которые фоновый поток обновляет раз в миллисекунду,
+ * пока действует хотя бы одно ограничение по времени. Поэтому проверка - одно чтение
+ * атомарной переменной, а выполнение прерывается с опозданием не больше чем на миллисекунду
+ * и время выполнения нескольких тысяч единиц топлива
+ */
+class LimitScope {
+public:
+    explicit LimitScope(const ExecutionLimits& limits);
+    ~LimitScope();
+
+    LimitScope(const LimitScope&) = delete;
+    LimitScope& operator=(const LimitScope&) = delete;
+
+    // Возвращает количество топлива, израсходованного с создания объекта.
+    // Вызывается из потока, создавшего объект
+    [[nodiscard]] uint64_t GetFuelUsed() const;
+
+private:
+    detail::LimitState previous_;
+    uint64_t initial_used_;
+    bool owns_fuel_;
+    bool uses_clock_;
+};
+
+// Возвращает ограничения, оставшиеся у текущего потока. Топливо - остаток общего запаса,
+// который могут одновременно расходовать и задачи spawn.
+// Выбрасывает FuelExhaustedError или DeadlineExceededError, если ограничение уже исчерпано
+[[nodiscard]] ExecutionLimits GetRemainingLimits();
+
+}  // namespace runtime
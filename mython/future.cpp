@@ -0,0 +1,175 @@
+#include "future.h"
+
+#include "collector.h"
+#include "execution_limits.h"
+#include "region.h"
+#include "stack.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace runtime {
+
+struct Future::State {
+    mutex m;
+    condition_variable done_cv;
+    bool done = false;
+    bool joined = false;
+    ObjectHolder result;
+    exception_ptr error;
+    string output;
+};
+
+namespace {
+// Общий пул задач spawn. Задачи, запущенные из задачи, попадают в очередь её потока
+WorkStealingPool& SpawnPool() {
+    static WorkStealingPool pool(max(thread::hardware_concurrency(), 1U));
+    return pool;
+}
+}  // namespace
+
+ObjectHolder Future::Start(Task task) {
+    auto state = make_shared<State>();
+    // Задача не может выйти за ограничения запустившей её программы: она получает оставшийся срок
+    // и расходует топливо из общего запаса программы
+    ExecutionLimits limits = GetRemainingLimits();
+    limits.fuel = 0;
+    const detail::LimitState shared_limits = detail::ShareLimitState();
+    // Память задачи учитывается вложенным учётом программы: задачи расходуют её общую квоту,
+    // а их память видна в учёте программы
+    const MemoryAccount::Handle account(MemoryAccount::Current());
+    SpawnPool().Submit([state, task = move(task), limits, shared_limits, account] {
+        ostringstream output;
+        ObjectHolder result;
+        exception_ptr error;
+        // Задачу может выполнять поток, ожидающий другую задачу: его ограничения к ней не относятся
+        const detail::LimitState previous_limits = detail::ExchangeLimitState(shared_limits);
+        try {
+            LimitScope limit_scope(limits);
+            MemoryAccount::Scope detached_account(nullptr);
+            optional<MemoryAccount::Scope> task_account;
+            if (account.Get()) {
+                task_account.emplace(account);
+            }
+            SimpleContext context{output};
+            result = task(context);
+        } catch (...) {
+            error = current_exception();
+        }
+        detail::ExchangeLimitState(previous_limits);
+        {
+            lock_guard lock(state->m);
+            state->result = move(result);
+            state->error = error;
+            state->output = output.str();
+            state->done = true;
+        }
+        state->done_cv.notify_all();
+    });
+    // Future не размещается в регионе: его деструктор должен дождаться задачи,
+    // как только пропадёт последняя ссылка, а не при уничтожении региона
+    Region::Scope no_region(nullptr);
+    return ObjectHolder::Own(Future(move(state)));
+}
+
+Future::Future(shared_ptr<State> state)
+: state_(move(state)) {
+}
+
+Future::~Future() {
+    if (state_) {
+        Wait();
+    }
+}
+
+ObjectHolder Future::Join(Context& context) {
+    Wait();
+    // После завершения задачи её поток больше не обращается к состоянию
+    if (!state_->joined) {
+        state_->joined = true;
+        context.GetOutputStream() << state_->output;
+        state_->output.clear();
+        CycleCollector::Current().Adopt(state_->result);
+    }
+    if (state_->error) {
+        rethrow_exception(state_->error);
+    }
+    return state_->result;
+}
+
+void Future::Print(ostream& os, Context& /*context*/) {
+    os << "<future>"sv;
+}
+
+void Future::Wait() {
+    detail::ReleaseFuel();
+    auto is_done = [this] {
+        lock_guard lock(state_->m);
+        return state_->done;
+    };
+    while (!is_done()) {
+        if (!SpawnPool().RunPendingTask()) {
+            // Очереди пусты, значит задача уже выполняется в другом потоке
+            unique_lock lock(state_->m);
+            state_->done_cv.wait(lock, [this] {
+                return state_->done;
+            });
+        }
+    }
+}
+
+ObjectHolder CopyForTask(const ObjectHolder& value, unordered_map<const Object*, ObjectHolder>& copies,
+                         Context& context) {
+    if (!value || value.TryAs<Number>() || value.TryAs<String>() || value.TryAs<Bool>()
+        || value.TryAs<Class>() || value.TryAs<Function>()) {
+        return value;
+    }
+    if (auto it = copies.find(value.Get()); it != copies.end()) {
+        return it->second;
+    }
+    CheckStack();
+    if (auto instance = value.TryAs<ClassInstance>()) {
+        ObjectHolder copy = ObjectHolder::Own(ClassInstance(instance->GetClass()));
+        copies.emplace(value.Get(), copy);
+        Closure& fields = copy.TryAs<ClassInstance>()->Fields();
+        for (const auto& [name, field] : instance->Fields()) {
+            fields.emplace(name, CopyForTask(field, copies, context));
+        }
+        copy.TryAs<ClassInstance>()->UpdateMemoryUsage();
+        return copy;
+    }
+    if (auto list = value.TryAs<List>()) {
+        ObjectHolder copy = ObjectHolder::Own(List());
+        copies.emplace(value.Get(), copy);
+        auto& items = copy.TryAs<List>()->Items();
+        items.reserve(list->Items().size());
+        for (const ObjectHolder& item : list->Items()) {
+            items.push_back(CopyForTask(item, copies, context));
+        }
+        copy.TryAs<List>()->UpdateMemoryUsage();
+        return copy;
+    }
+    if (auto dict = value.TryAs<Dict>()) {
+        ObjectHolder copy = ObjectHolder::Own(Dict());
+        copies.emplace(value.Get(), copy);
+        auto* items = copy.TryAs<Dict>();
+        dict->ForEachItem([&](const ObjectHolder& key, const ObjectHolder& item) {
+            items->Set(CopyForTask(key, copies, context), CopyForTask(item, copies, context), context);
+        });
+        return copy;
+    }
+    throw runtime_error(
+        "Error in CopyForTask: only numbers, strings, bools, lists, dicts, class instances, "
+        "classes and functions can be passed to a spawned call"s);
+}
+
+}  // namespace runtime
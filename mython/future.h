@@ -0,0 +1,57 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace runtime {
+
+/*
+ * Результат вызова, запущенного командой spawn в общем пуле потоков с перехватом работы.
+ * Задача выполняется в своих кадрах стека рабочего потока и пишет вывод в собственный буфер.
+ * Join дожидается завершения задачи, выводит накопленный вывод в контекст вызывающего
+ * и возвращает результат либо пробрасывает исключение задачи.
+ * Если результат так и не был получен, деструктор дожидается завершения задачи
+ */
+class Future : public Object {
+public:
+    // Задача получает контекст со своим буфером вывода и возвращает результат вызова
+    using Task = std::function<ObjectHolder(Context&)>;
+
+    // Ставит задачу в очередь общего пула и возвращает Future, связанный с ней
+    static ObjectHolder Start(Task task);
+
+    Future(Future&& other) noexcept = default;
+    ~Future() override;
+
+    /*
+     * Дожидается завершения задачи. Пока задача не завершена, поток выполняет другие
+     * задачи пула, поэтому задача может ждать результатов запущенных ею задач.
+     * Объекты результата переходят на учёт сборщика текущего потока
+     */
+    ObjectHolder Join(Context& context);
+
+    // Выводит в os строку "<future>"
+    void Print(std::ostream& os, Context& context) override;
+
+private:
+    struct State;
+
+    explicit Future(std::shared_ptr<State> state);
+    void Wait();
+
+    std::shared_ptr<State> state_;
+};
+
+/*
+ * Копирует граф объектов value для передачи задаче spawn. Экземпляры классов, списки
+ * и словари копируются с сохранением общих ссылок и циклов (copies хранит уже сделанные копии),
+ * а неизменяемые числа, строки, логические значения, классы и функции разделяются.
+ * Для остальных объектов выбрасывает runtime_error
+ */
+ObjectHolder CopyForTask(const ObjectHolder& value,
+                         std::unordered_map<const Object*, ObjectHolder>& copies, Context& context);
+
+}  // namespace runtime
@@ -0,0 +1,52 @@
+#include "hash_table.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace runtime {
+
+void HashIndex::Insert(size_t hash, uint32_t entry) {
+    assert(!IsFull());
+    size_t group_index = FirstGroup(hash);
+    for (size_t step = 1;; ++step) {
+        Group& group = groups_[group_index];
+        if (const uint32_t mask = MatchFree(group); mask != 0) {
+            const size_t position = __builtin_ctz(mask);
+            if (group.ctrl[position] == EMPTY) {
+                ++used_;
+            }
+            group.ctrl[position] = H2(hash);
+            slots_[group_index * GROUP_SIZE + position] = entry;
+            return;
+        }
+        group_index = (group_index + step) & group_mask_;
+    }
+}
+
+void HashIndex::Erase(size_t slot) {
+    groups_[slot / GROUP_SIZE].ctrl[slot % GROUP_SIZE] = DELETED;
+}
+
+void HashIndex::Reset(size_t count) {
+    // Заполнение не превышает 7/8, число групп - степень двойки,
+    // поэтому квадратичное пробирование обходит все группы
+    size_t group_count = 1;
+    while (group_count * GROUP_SIZE * 7 / 8 < count) {
+        group_count *= 2;
+    }
+    Group empty;
+    fill(begin(empty.ctrl), end(empty.ctrl), EMPTY);
+    groups_.assign(group_count, empty);
+    slots_.assign(group_count * GROUP_SIZE, 0);
+    group_mask_ = group_count - 1;
+    used_ = 0;
+    growth_limit_ = group_count * GROUP_SIZE * 7 / 8;
+}
+
+size_t HashIndex::GetMemoryUsage() const {
+    return groups_.capacity() * sizeof(Group) + slots_.capacity() * sizeof(uint32_t);
+}
+
+}  // namespace runtime
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace runtime {
+
+/*
+ * Хеш-индекс с открытой адресацией в стиле Swiss table. Хранит номера записей,
+ * сами записи лежат в отдельном массиве у владельца индекса.
+ *
+ * Ячейки разбиты на группы по 16. Для каждой ячейки хранится управляющий байт:
+ * младшие 7 бит хеша занятой ячейки либо признак пустой или удалённой ячейки.
+ * Поиск сравнивает все 16 управляющих байтов группы с искомым за одну SIMD-операцию
+ * и обращается к записям только при совпадении 7 бит хеша. Группы перебираются
+ * квадратичным пробированием, поиск завершается на группе с пустой ячейкой.
+ */
+class HashIndex {
+public:
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+    static constexpr size_t GROUP_SIZE = 16;
+
+    HashIndex() = default;
+
+    // Возвращает номер ячейки, содержащей запись entry с хешем hash, для которой
+    // eq(entry) возвращает true, либо NPOS. После того как eq вернула true, индекс не читается,
+    // поэтому eq, изменившая индекс, должна вернуть true и повторить поиск
+    template <typename Eq>
+    size_t Find(size_t hash, Eq&& eq) const;
+
+    // Возвращает номер записи, хранящейся в ячейке slot
+    [[nodiscard]] uint32_t GetEntry(size_t slot) const {
+        return slots_[slot];
+    }
+
+    // Добавляет запись entry с хешем hash. Индекс не должен быть заполнен
+    void Insert(size_t hash, uint32_t entry);
+    // Помечает ячейку slot как удалённую
+    void Erase(size_t slot);
+
+    // Возвращает true, если перед вставкой индекс нужно перестроить
+    [[nodiscard]] bool IsFull() const {
+        return used_ >= growth_limit_;
+    }
+
+    // Очищает индекс и выделяет ячейки для хранения не менее count записей
+    void Reset(size_t count);
+
+    [[nodiscard]] size_t GetMemoryUsage() const;
+
+private:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+
+    struct alignas(GROUP_SIZE) Group {
+        int8_t ctrl[GROUP_SIZE];
+    };
+
+    // Битовые маски ячеек группы: с управляющим байтом h2 и свободных (пустых либо удалённых)
+    static uint32_t Match(const Group& group, int8_t h2);
+    static uint32_t MatchFree(const Group& group);
+    static uint32_t MatchEmpty(const Group& group);
+
+    static int8_t H2(size_t hash) {
+        return static_cast<int8_t>(hash & 0x7F);
+    }
+    [[nodiscard]] size_t FirstGroup(size_t hash) const {
+        return (hash >> 7) & group_mask_;
+    }
+
+    std::vector<Group> groups_;
+    std::vector<uint32_t> slots_;
+    size_t group_mask_ = 0;
+    // Количество занятых и удалённых ячеек
+    size_t used_ = 0;
+    size_t growth_limit_ = 0;
+};
+
+inline uint32_t HashIndex::Match(const Group& group, int8_t h2) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group.ctrl));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= static_cast<uint32_t>(group.ctrl[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+inline uint32_t HashIndex::MatchFree(const Group& group) {
+    // У пустых и удалённых ячеек установлен старший бит управляющего байта
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group.ctrl));
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= static_cast<uint32_t>(group.ctrl[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+inline uint32_t HashIndex::MatchEmpty(const Group& group) {
+    return Match(group, EMPTY);
+}
+
+template <typename Eq>
+size_t HashIndex::Find(size_t hash, Eq&& eq) const {
+    if (groups_.empty()) {
+        return NPOS;
+    }
+    const int8_t h2 = H2(hash);
+    size_t group_index = FirstGroup(hash);
+    for (size_t step = 1;; ++step) {
+        const Group& group = groups_[group_index];
+        for (uint32_t mask = Match(group, h2); mask != 0; mask &= mask - 1) {
+            const size_t slot = group_index * GROUP_SIZE + __builtin_ctz(mask);
+            if (eq(slots_[slot])) {
+                return slot;
+            }
+        }
+        if (MatchEmpty(group) != 0 || step > group_mask_) {
+            return NPOS;
+        }
+        group_index = (group_index + step) & group_mask_;
+    }
+}
+
+}  // namespace runtime
@@ -0,0 +1,158 @@
+#include "interpreter.h"
+
+#include "lexer.h"
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+using namespace std;
+
+namespace mython {
+
+namespace {
+
+// Запоминает в результате исключение error, прервавшее выполнение, вместе со статусом и сообщением
+void SetError(ExecutionResult& result, exception_ptr error) {
+    result.exception = error;
+    try {
+        rethrow_exception(move(error));
+    } catch (const runtime::FuelExhaustedError& e) {
+        result.status = ExecutionStatus::FUEL_EXHAUSTED;
+        result.error = e.what();
+    } catch (const runtime::DeadlineExceededError& e) {
+        result.status = ExecutionStatus::DEADLINE_EXCEEDED;
+        result.error = e.what();
+    } catch (const runtime::MemoryQuotaExceededError& e) {
+        result.status = ExecutionStatus::MEMORY_QUOTA_EXCEEDED;
+        result.error = e.what();
+    } catch (const ParseError& e) {
+        result.status = ExecutionStatus::PARSE_ERROR;
+        result.error = e.what();
+    } catch (const parse::LexerError& e) {
+        result.status = ExecutionStatus::PARSE_ERROR;
+        result.error = e.what();
+    } catch (const exception& e) {
+        result.status = ExecutionStatus::RUNTIME_ERROR;
+        result.error = e.what();
+    }
+}
+
+// Выполняет body(globals) с ограничениями и учётом памяти options. Исключение,
+// прервавшее выполнение, возвращается в результате
+template <typename Body>
+ExecutionResult Execute(const ExecutionOptions& options, runtime::Closure globals, Body&& body) {
+    ExecutionResult result;
+    runtime::MemoryAccount::Scope account(options.memory_quota);
+    {
+        runtime::LimitScope limits(options.limits);
+        try {
+            body(globals);
+        } catch (...) {
+            SetError(result, current_exception());
+        }
+        result.fuel_used = limits.GetFuelUsed();
+    }
+    result.memory = account.GetUsage();
+    result.globals = move(globals);
+    return result;
+}
+
+// Две программы, выполняемые одна за другой
+class Sequence : public runtime::Executable {
+public:
+    Sequence(shared_ptr<const runtime::Executable> first, shared_ptr<const runtime::Executable> second)
+        : first_(move(first))
+        , second_(move(second)) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override {
+        first_->Execute(closure, context);
+        return second_->Execute(closure, context);
+    }
+
+private:
+    shared_ptr<const runtime::Executable> first_;
+    shared_ptr<const runtime::Executable> second_;
+};
+
+// Программа, выполняемая по мере разбора. Поток владеет объявленными классами и функциями
+struct StreamingProgram {
+    StreamingProgram(istream& input, const ParseOptions& options)
+        : lexer(input)
+        , stream(lexer, options) {
+    }
+
+    parse::Lexer lexer;
+    ProgramStream stream;
+};
+
+}  // namespace
+
+CompiledProgram::CompiledProgram(shared_ptr<const runtime::Executable> program)
+: program_(move(program)) {
+}
+
+ExecutionResult CompiledProgram::Run(runtime::Context& context, runtime::Closure globals,
+                                     const ExecutionOptions& options) const {
+    ExecutionResult result = Execute(options, move(globals), [this, &context](runtime::Closure& closure) {
+        program_->Execute(closure, context);
+    });
+    result.program = program_;
+    return result;
+}
+
+CompiledProgram CompiledProgram::Then(const CompiledProgram& next) const {
+    return CompiledProgram(make_shared<Sequence>(program_, next.program_));
+}
+
+Interpreter::Interpreter(ParseOptions options)
+: options_(move(options)) {
+}
+
+CompiledProgram Interpreter::Compile(string_view source) const {
+    istringstream input{string(source)};
+    return Compile(input);
+}
+
+CompiledProgram Interpreter::Compile(istream& input) const {
+    // Программа переживает выполнение, при котором её разбирают, поэтому её константы
+    // не относятся на его учёт памяти
+    runtime::MemoryAccount::Scope detached_account(nullptr);
+    try {
+        parse::Lexer lexer(input);
+        return CompiledProgram(ParseProgram(lexer, options_));
+    } catch (const ParseError&) {
+        throw;
+    } catch (const exception& e) {
+        // Ошибки лексического анализа тоже считаются ошибками разбора
+        throw ParseError(e.what());
+    }
+}
+
+CompiledProgram Interpreter::CompileFile(const string& path) const {
+    ifstream input(path);
+    if (!input) {
+        throw ParseError("Cannot read "s + path);
+    }
+    return Compile(input);
+}
+
+ExecutionResult Interpreter::RunStreaming(istream& input, runtime::Context& context, runtime::Closure globals,
+                                          const ExecutionOptions& options) const {
+    shared_ptr<StreamingProgram> program;
+    ExecutionResult result = Execute(options, move(globals), [&](runtime::Closure& closure) {
+        program = make_shared<StreamingProgram>(input, options_);
+        while (auto statement = program->stream.Next()) {
+            statement->Execute(closure, context);
+        }
+    });
+    result.program = move(program);
+    return result;
+}
+
+const ParseOptions& Interpreter::GetOptions() const {
+    return options_;
+}
+
+}  // namespace mython
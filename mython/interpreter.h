@@ -0,0 +1,118 @@
+#pragma once
+
+#include "execution_limits.h"
+#include "memory_account.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <cstdint>
+#include <exception>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mython {
+
+enum class ExecutionStatus {
+    OK,
+    // Программа выбросила исключение
+    RUNTIME_ERROR,
+    // Ошибка в теле метода, разобранном при первом вызове (ParseOptions::lazy_method_bodies),
+    // либо в инструкции, разобранной при потоковом выполнении
+    PARSE_ERROR,
+    FUEL_EXHAUSTED,
+    DEADLINE_EXCEEDED,
+    MEMORY_QUOTA_EXCEEDED,
+};
+
+// Ограничения одного выполнения программы
+struct ExecutionOptions {
+    runtime::ExecutionLimits limits;
+    // Квота памяти объектов выполнения в байтах. Ноль - без ограничения.
+    // Память учитывается при любой квоте
+    size_t memory_quota = 0;
+};
+
+struct ExecutionResult {
+    // Глобальные переменные могут ссылаться на константы, классы и функции программы,
+    // поэтому результат продлевает её жизнь. Объявлена до globals, чтобы пережить их
+    std::shared_ptr<const void> program;
+    ExecutionStatus status = ExecutionStatus::OK;
+    // Сообщение об ошибке либо пустая строка, если программа выполнена успешно
+    std::string error;
+    // Исключение, прервавшее выполнение, для вызывающих, которые передают ошибку дальше
+    std::exception_ptr exception;
+    // Глобальные переменные по завершении выполнения, в том числе прерванного
+    runtime::Closure globals;
+    // Израсходованное топливо: количество вызовов, итераций и ветвлений
+    uint64_t fuel_used = 0;
+    // Память объектов выполнения. current - по завершении, пока живы globals
+    runtime::MemoryUsage memory;
+
+    [[nodiscard]] bool Succeeded() const {
+        return status == ExecutionStatus::OK;
+    }
+};
+
+/*
+ * Разобранная программа. Выполняется сколько угодно раз, каждый раз с новыми глобальными
+ * переменными, в том числе одновременно из нескольких потоков. Копирование дёшево:
+ * копии разделяют одну разобранную программу
+ */
+class CompiledProgram {
+public:
+    /*
+     * Выполняет программу с глобальными переменными globals, выводя в context.
+     * Ошибки выполнения и превышение ограничений не выбрасываются, а возвращаются
+     * в результате вместе с глобальными переменными. Объекты, переданные в globals,
+     * программа изменяет на месте: они общие с вызывающим
+     */
+    ExecutionResult Run(runtime::Context& context, runtime::Closure globals = {},
+                        const ExecutionOptions& options = {}) const;
+
+    // Возвращает программу, которая выполняет эту программу, а затем next в тех же
+    // глобальных переменных. Ограничения выполнения действуют на обе вместе
+    [[nodiscard]] CompiledProgram Then(const CompiledProgram& next) const;
+
+private:
+    friend class Interpreter;
+
+    explicit CompiledProgram(std::shared_ptr<const runtime::Executable> program);
+
+    std::shared_ptr<const runtime::Executable> program_;
+};
+
+/*
+ * Точка входа для приложений, встраивающих Mython. Разбирает программы с общими
+ * параметрами: нативными функциями, кешем модулей и режимом разбора тел методов.
+ * Реестр и кеш модулей из параметров должны существовать, пока существуют
+ * скомпилированные программы
+ */
+class Interpreter {
+public:
+    explicit Interpreter(ParseOptions options = {});
+
+    // Разбирает программу source. Выбрасывает ParseError при ошибке лексического
+    // или синтаксического анализа
+    [[nodiscard]] CompiledProgram Compile(std::string_view source) const;
+    [[nodiscard]] CompiledProgram Compile(std::istream& input) const;
+    // Разбирает программу из файла path. Выбрасывает ParseError, если файл не удалось
+    // прочитать или разобрать
+    [[nodiscard]] CompiledProgram CompileFile(const std::string& path) const;
+
+    /*
+     * Выполняет программу из input, разбирая её по одной инструкции верхнего уровня
+     * (см. ProgramStream): вывод начинается до окончания разбора, а выполненные инструкции
+     * освобождаются. Ошибки разбора возвращаются в результате, как и ошибки выполнения
+     */
+    ExecutionResult RunStreaming(std::istream& input, runtime::Context& context, runtime::Closure globals = {},
+                                 const ExecutionOptions& options = {}) const;
+
+    [[nodiscard]] const ParseOptions& GetOptions() const;
+
+private:
+    ParseOptions options_;
+};
+
+}  // namespace mython
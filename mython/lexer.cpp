@@ -69,6 +69,12 @@ std::ostream& operator<<(std::ostream& os, const Token& rhs) {
     UNVALUED_OUTPUT(None);
     UNVALUED_OUTPUT(True);
     UNVALUED_OUTPUT(False);
+    UNVALUED_OUTPUT(While);
+    UNVALUED_OUTPUT(For);
+    UNVALUED_OUTPUT(In);
+    UNVALUED_OUTPUT(Del);
+    UNVALUED_OUTPUT(Import);
+    UNVALUED_OUTPUT(Spawn);
     UNVALUED_OUTPUT(Eof);
 
 #undef UNVALUED_OUTPUT
@@ -146,7 +152,8 @@ Token Lexer::NextToken() {
         }
         char c = input_.get();
         if (token_.Is<token_type::Newline>()) {
-            size_t i = 0;
+            size_t i = pending_spaces_ / 2;
+            pending_spaces_ = 0;
             for (; c == ' '; c = input_.get()) {
                 assert(input_.get() == ' ');
                 ++i;
@@ -217,6 +224,18 @@ Token Lexer::NextToken() {
                 return token_type::True{};
             } else if (str == "False"sv) {
                 return token_type::False{};
+            } else if (str == "while"sv) {
+                return token_type::While{};
+            } else if (str == "for"sv) {
+                return token_type::For{};
+            } else if (str == "in"sv) {
+                return token_type::In{};
+            } else if (str == "del"sv) {
+                return token_type::Del{};
+            } else if (str == "import"sv) {
+                return token_type::Import{};
+            } else if (str == "spawn"sv) {
+                return token_type::Spawn{};
             } else {
                 return token_type::Id{move(str)};
             }
@@ -238,7 +257,8 @@ Token Lexer::NextToken() {
         } else if (c == '>' && input_.peek() == '=') {
             assert(input_.get() == '=');
             return token_type::GreaterOrEq{};
-        } else if (c == '=' || c == '.' || c == ',' || c == '(' || c == '+' || c == '<' || c == '>' || c == '-' || c == ')' || c == '*' || c == '/' || c == ':') {
+        } else if (c == '=' || c == '.' || c == ',' || c == '(' || c == '+' || c == '<' || c == '>' || c == '-' || c == ')' || c == '*' || c == '/' || c == ':'
+                   || c == '[' || c == ']' || c == '{' || c == '}') {
             return token_type::Char{c};
         } else {
             assert(false);
@@ -248,4 +268,40 @@ Token Lexer::NextToken() {
     return token_;
 }
 
-}  // namespace parse
\ No newline at end of file
+string Lexer::SkipBlock() {
+    assert(token_.Is<token_type::Newline>());
+    // Отступ заголовка блока, в пробелах
+    const size_t base = indent_ * 2;
+    string result;
+    for (;;) {
+        size_t spaces = 0;
+        char c = input_.get();
+        for (; c == ' '; c = input_.get()) {
+            ++spaces;
+        }
+        if (c == char_traits<char>::eof()) {
+            break;
+        }
+        if (c == '\n' || c == '#') {
+            if (c == '#') {
+                string comment;
+                getline(input_, comment);
+            }
+            continue;
+        }
+        if (spaces <= base) {
+            input_.unget();
+            pending_spaces_ = spaces;
+            break;
+        }
+        string line;
+        getline(input_, line);
+        result.append(spaces - base, ' ');
+        result += c;
+        result += line;
+        result += '\n';
+    }
+    return result;
+}
+
+}  // namespace parse
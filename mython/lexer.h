@@ -46,6 +46,12 @@ struct GreaterOrEq {};  // Лексема «>=»
 struct None {};         // Лексема «None»
 struct True {};         // Лексема «True»
 struct False {};        // Лексема «False»
+struct While {};        // Лексема «while»
+struct For {};          // Лексема «for»
+struct In {};           // Лексема «in»
+struct Del {};          // Лексема «del»
+struct Import {};       // Лексема «import»
+struct Spawn {};        // Лексема «spawn»
 }  // namespace token_type
 
 using TokenBase
@@ -54,7 +60,9 @@ using TokenBase
                    token_type::Def, token_type::Newline, token_type::Print, token_type::Indent,
                    token_type::Dedent, token_type::And, token_type::Or, token_type::Not,
                    token_type::Eq, token_type::NotEq, token_type::LessOrEq, token_type::GreaterOrEq,
-                   token_type::None, token_type::True, token_type::False, token_type::Eof>;
+                   token_type::None, token_type::True, token_type::False, token_type::While,
+                   token_type::For, token_type::In, token_type::Del, token_type::Import,
+                   token_type::Spawn, token_type::Eof>;
 
 struct Token : TokenBase {
     using TokenBase::TokenBase;
@@ -132,11 +140,19 @@ public:
         Expect<T>(value);
     }
 
+    // Пропускает блок строк с отступом больше, чем у текущей строки, не разбирая его на токены.
+    // Текущим токеном должен быть Newline, завершающий заголовок блока. Возвращает текст
+    // блока без пустых строк и комментариев, с отступом, уменьшенным до одного уровня.
+    // Следующий вызов NextToken вернёт первый токен после блока
+    std::string SkipBlock();
+
 private:
     std::istream& input_;
     Token token_ = token_type::Newline{};
     size_t indent_ = 0;
     size_t dedent_ = 0;
+    // Пробелы в начале строки, уже прочитанные SkipBlock
+    size_t pending_spaces_ = 0;
 };
 
 }  // namespace parse
\ No newline at end of file
@@ -40,6 +40,39 @@ void TestKeywords() {
     ASSERT_EQUAL(lexer.NextToken(), Token(token_type::False{}));
 }
 
+void TestLoopKeywords() {
+    istringstream input("while x:\nfor i in range(3):"s);
+    Lexer lexer(input);
+
+    ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::While{}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"x"s}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{':'}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::For{}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"i"s}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::In{}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"range"s}));
+}
+
+void TestContainerTokens() {
+    istringstream input("del d[k] = {1: [2]}"s);
+    Lexer lexer(input);
+
+    ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Del{}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"d"s}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{'['}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"k"s}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{']'}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{'='}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{'{'}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Number{1}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{':'}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{'['}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Number{2}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{']'}));
+    ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Char{'}'}));
+}
+
 void TestNumbers() {
     istringstream input("42 15 -53"s);
     Lexer lexer(input);
@@ -356,6 +389,8 @@ abc#
 void RunOpenLexerTests(TestRunner& tr) {
     RUN_TEST(tr, parse::TestSimpleAssignment);
     RUN_TEST(tr, parse::TestKeywords);
+    RUN_TEST(tr, parse::TestLoopKeywords);
+    RUN_TEST(tr, parse::TestContainerTokens);
     RUN_TEST(tr, parse::TestNumbers);
     RUN_TEST(tr, parse::TestIds);
     RUN_TEST(tr, parse::TestStrings);
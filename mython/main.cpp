@@ -1,10 +1,36 @@
+#include "batch.h"
+#include "collector.h"
+#include "execution_limits.h"
+#include "interpreter.h"
 #include "lexer.h"
+#include "module.h"
+#include "native.h"
+#include "output.h"
 #include "parse.h"
 #include "runtime.h"
+#include "scheduler.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stack.h"
 #include "statement.h"
 #include "test_runner.h"
+#include "thread_pool.h"
 
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -21,16 +47,52 @@ void RunObjectsTests(TestRunner& tr);
 }  // namespace runtime
 
 void TestParseProgram(TestRunner& tr);
+void TestParseProgramSlow(TestRunner& tr);
 
 namespace {
 
-void RunMythonProgram(istream& input, ostream& output) {
-    parse::Lexer lexer(input);
-    auto program = ParseProgram(lexer);
+// Выбрасывает исключение, прервавшее выполнение программы
+void RethrowError(const mython::ExecutionResult& result) {
+    if (result.exception) {
+        rethrow_exception(result.exception);
+    }
+}
+
+// Выполняет программу с ограничениями execution. Если задан snapshot, программа начинает
+// с его глобальными переменными
+void RunMythonProgram(istream& input, ostream& output, const ParseOptions& options = {},
+                      const snapshot::Snapshot* snapshot = nullptr, const mython::ExecutionOptions& execution = {}) {
+    const mython::CompiledProgram program = mython::Interpreter(options).Compile(input);
 
     runtime::SimpleContext context{output};
     runtime::Closure closure;
-    program->Execute(closure, context);
+    if (snapshot) {
+        snapshot->Restore(closure, context);
+    }
+    RethrowError(program.Run(context, move(closure), execution));
+}
+
+// Выполняет каждую инструкцию верхнего уровня сразу после её разбора и освобождает её
+// после выполнения. Память не растёт с длиной программы, а вывод начинается до окончания разбора
+void RunMythonProgramStreaming(istream& input, ostream& output, const ParseOptions& options = {},
+                               const snapshot::Snapshot* snapshot = nullptr,
+                               const mython::ExecutionOptions& execution = {}) {
+    runtime::SimpleContext context{output};
+    runtime::Closure closure;
+    if (snapshot) {
+        snapshot->Restore(closure, context);
+    }
+    RethrowError(mython::Interpreter(options).RunStreaming(input, context, move(closure), execution));
+}
+
+// Выполняет программу, размещая все её объекты в одном регионе памяти.
+// По завершении граф объектов освобождается целиком, без каскада деструкторов
+void RunMythonProgramInRegion(istream& input, ostream& output, const ParseOptions& options = {},
+                              const snapshot::Snapshot* snapshot = nullptr,
+                              const mython::ExecutionOptions& execution = {}) {
+    runtime::Region region;
+    runtime::Region::Scope scope(region);
+    RunMythonProgram(input, output, options, snapshot, execution);
 }
 
 void TestSimplePrints() {
@@ -111,6 +173,1011 @@ print y.value
     ASSERT_EQUAL(output.str(), "2\n3\n");
 }
 
+void TestSelfOutlivesTemporary() {
+    istringstream input(R"(
+class Counter:
+  def __init__(value):
+    self.value = value
+
+  def me():
+    return self
+
+class Maker:
+  def make(value):
+    counter = Counter(value)
+    return counter.me()
+
+maker = Maker()
+x = maker.make(5)
+y = maker.make(7)
+print x.value, y.value
+)");
+
+    ostringstream output;
+    RunMythonProgram(input, output);
+
+    ASSERT_EQUAL(output.str(), "5 7\n");
+}
+
+void TestRunInRegion() {
+    istringstream input(R"(
+class Node:
+  def __init__(value, next):
+    self.value = value
+    self.next = next
+
+n = Node(1, Node(2, Node(3, None)))
+print n.value, n.next.value, n.next.next.value
+)");
+
+    ostringstream output;
+    RunMythonProgramInRegion(input, output);
+
+    ASSERT_EQUAL(output.str(), "1 2 3\n");
+}
+
+void TestSnapshot() {
+    const string init = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+  def __str__():
+    return str(self.x) + ':' + str(self.y)
+
+def scale(p, k):
+  return Point(p.x * k, p.y * k)
+
+names = {}
+points = []
+i = 0
+while i < 3:
+  p = Point(i, i * 2)
+  points.append(p)
+  names[str(i)] = p
+  i = i + 1
+first = points[0]
+second = points[1]
+first.next = second
+second.next = first
+label = 'points'
+ready = True
+empty = None
+)";
+    char path_template[] = "/tmp/mython_snapshot_XXXXXX";
+    close(mkstemp(path_template));
+    const string path = path_template;
+    ostringstream init_output;
+    runtime::SimpleContext init_context{init_output};
+    snapshot::Save(init, path, init_context);
+
+    const snapshot::Snapshot loaded(path);
+    ASSERT(loaded.GetObjectCount() > 10U);
+    const string script = R"(
+print label, ready, empty, len(points)
+print names['2'], scale(first, 10)
+print first.next.next.y, first.next.y
+points.append(first)
+print len(points)
+)";
+    for (int run = 0; run < 2; ++run) {
+        // Каждое восстановление создаёт собственные объекты
+        istringstream input(script);
+        ostringstream output;
+        ParseOptions options;
+        options.prelude = loaded.GetProgram();
+        RunMythonProgram(input, output, options, &loaded);
+        ASSERT_EQUAL(output.str(), "points True None 3\n2:4 0:0\n0 2\n4\n"s);
+    }
+
+    runtime::SimpleContext context{init_output};
+    ASSERT_THROWS(snapshot::Save("f = spawn scale(Point(1, 2), 2)\n"s, path, context), runtime_error);
+    {
+        ofstream(path) << "not a snapshot"s;
+    }
+    ASSERT_THROWS(snapshot::Snapshot{path}, runtime_error);
+    remove(path.c_str());
+}
+
+void TestRunStreaming() {
+    istringstream input(R"(
+class Greeter:
+  def greet(name):
+    return 'hello, ' + name + punctuation()
+
+def punctuation():
+  return '!'
+
+g = Greeter()
+print g.greet('world')
+print late()
+def late():
+  return 1
+)");
+
+    ostringstream output;
+    // Вызов late выполняется раньше её объявления
+    ASSERT_THROWS(RunMythonProgramStreaming(input, output), runtime_error);
+    ASSERT_EQUAL(output.str(), "hello, world!\n");
+
+    // Инструкции до синтаксической ошибки успевают выполниться
+    istringstream broken("print 1\nprint 2\nx = [\n"s);
+    ostringstream broken_output;
+    ASSERT_THROWS(RunMythonProgramStreaming(broken, broken_output), runtime_error);
+    ASSERT_EQUAL(broken_output.str(), "1\n2\n");
+
+    // Глобальные переменные ссылаются на константы уже освобождённых инструкций
+    istringstream constants("x = 5\ns = 'text'\nb = True\nprint x, s, b\n"s);
+    ostringstream constants_output;
+    RunMythonProgramStreaming(constants, constants_output);
+    ASSERT_EQUAL(constants_output.str(), "5 text True\n");
+}
+
+// Выполняет пакет сценариев из манифеста и выводит их результаты в порядке манифеста.
+// Производительность выводится в report. При scaling пакет повторно выполняется на 1, 2, 4, ...
+// потоках, вплоть до thread_count, и выводится ускорение относительно одного потока.
+// Возвращает true, если все сценарии выполнены без ошибок
+bool RunBatch(const string& manifest_path, size_t thread_count, bool scaling,
+              const ParseOptions& options, const runtime::ExecutionLimits& limits, size_t memory_quota,
+              ostream& output, ostream& report) {
+    ifstream manifest(manifest_path);
+    if (!manifest) {
+        throw runtime_error("Cannot read manifest "s + manifest_path);
+    }
+    const size_t slash = manifest_path.rfind('/');
+    auto jobs = batch::ReadManifest(
+        manifest, slash == string::npos ? "."s : manifest_path.substr(0, slash));
+    for (batch::Job& job : jobs) {
+        job.limits = limits;
+        job.memory_quota = memory_quota;
+    }
+
+    batch::BatchRunner runner(options);
+    batch::BatchStats stats;
+    vector<batch::JobResult> results;
+    {
+        // Вывод сценариев выводится по мере выполнения в порядке манифеста
+        runtime::OutputMerger merger(output);
+        results = runner.Run(jobs, thread_count, &stats, &merger);
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].error.empty()) {
+            report << jobs[i].script << ": "sv << results[i].error << '\n';
+            success = false;
+        }
+    }
+    report << stats.jobs << " scripts ("sv << runner.GetParsedCount() << " files parsed) in "sv
+           << fixed << setprecision(3) << stats.seconds << " s on "sv << stats.threads
+           << " threads: "sv << setprecision(1) << stats.Throughput() << " scripts/s, "sv
+           << stats.steals << " steals\n"sv;
+
+    if (scaling) {
+        // Файлы уже разобраны, поэтому кривая отражает только выполнение
+        report << "threads  scripts/s  speedup  efficiency\n"sv;
+        double base = 0;
+        for (size_t threads = 1;; threads = min(threads * 2, thread_count)) {
+            runner.Run(jobs, threads, &stats);
+            if (threads == 1) {
+                base = stats.Throughput();
+            }
+            const double speedup = base > 0 ? stats.Throughput() / base : 0.0;
+            report << setw(7) << threads << setw(11) << setprecision(1) << stats.Throughput()
+                   << setw(9) << setprecision(2) << speedup << setw(12)
+                   << speedup / static_cast<double>(threads) << '\n';
+            if (threads >= thread_count) {
+                break;
+            }
+        }
+    }
+    return success;
+}
+
+void TestWorkStealingPool() {
+    atomic<int> sum = 0;
+    {
+        runtime::WorkStealingPool pool(4);
+        // Задачи ставят вложенные задачи в очередь своего потока
+        for (int i = 0; i < 100; ++i) {
+            pool.Submit([&pool, &sum, i] {
+                for (int j = 0; j < 10; ++j) {
+                    pool.Submit([&sum, i] {
+                        sum += i;
+                    });
+                }
+            });
+        }
+        pool.Wait();
+        ASSERT_EQUAL(sum.load(), 49500);
+
+        pool.Submit([] {
+            throw runtime_error("task failed"s);
+        });
+        ASSERT_THROWS(pool.Wait(), runtime_error);
+        // Ошибка пробрасывается один раз, после неё пул продолжает работать
+        pool.Submit([&sum] {
+            sum = 0;
+        });
+        pool.Wait();
+    }
+    ASSERT_EQUAL(sum.load(), 0);
+}
+
+void TestRunBatch() {
+    char dir_template[] = "/tmp/mython_batch_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    const auto write = [&dir](const string& name, const string& text) {
+        ofstream(dir + "/"s + name) << text;
+    };
+    write("greet.my"s, R"(
+class Greeter:
+  def greet(greeting, name):
+    return greeting + ', ' + name
+
+g = Greeter()
+print g.greet(greeting, who)
+)"s);
+    write("broken.my"s, "print 1\nprint unknown\n"s);
+    string manifest = "# сценарии пакета\n"s;
+    for (int i = 0; i < 20; ++i) {
+        const string input = "input"s + to_string(i) + ".my"s;
+        write(input, "greeting = 'hi'\nwho = '"s + to_string(i) + "'\n"s);
+        manifest += "greet.my "s + input + "\n"s;
+        if (i == 10) {
+            manifest += "\n"s + dir + "/broken.my\n"s;
+        }
+    }
+    write("manifest.txt"s, manifest);
+
+    ostringstream output;
+    ostringstream report;
+    const bool success = RunBatch(dir + "/manifest.txt"s, 4, false, {}, {}, 0, output, report);
+    ASSERT(!success);
+
+    string expected;
+    for (int i = 0; i < 20; ++i) {
+        expected += "hi, "s + to_string(i) + "\n"s;
+        if (i == 10) {
+            expected += "1\n"s;
+        }
+    }
+    ASSERT_EQUAL(output.str(), expected);
+    ASSERT(report.str().find("broken.my: "s) != string::npos);
+    // Сценарий разбирается один раз, входные данные - по одному разу на файл
+    ASSERT(report.str().find("21 scripts (22 files parsed)"s) != string::npos);
+
+    for (int i = 0; i < 20; ++i) {
+        remove((dir + "/input"s + to_string(i) + ".my"s).c_str());
+    }
+    for (const char* name : {"greet.my", "broken.my", "manifest.txt"}) {
+        remove((dir + "/"s + name).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+void TestReload() {
+    char dir_template[] = "/tmp/mython_reload_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    const string script = dir + "/version.my"s;
+    ofstream(script) << "print 'v1'\nprint 'done'\n"s;
+
+    // Контекст, который останавливает выполнение на первом выводе, пока его не отпустят
+    struct GateContext : runtime::Context, streambuf {
+        GateContext()
+            : output(this) {
+        }
+        ostream& GetOutputStream() override {
+            return output;
+        }
+        int_type overflow(int_type ch) override {
+            unique_lock lock(m);
+            if (!started) {
+                started = true;
+                changed.notify_all();
+                changed.wait(lock, [this] {
+                    return released;
+                });
+            }
+            text.push_back(traits_type::to_char_type(ch));
+            return ch;
+        }
+        mutex m;
+        condition_variable changed;
+        bool started = false;
+        bool released = false;
+        string text;
+        ostream output;
+    };
+    auto wait_started = [](GateContext& gate) {
+        unique_lock lock(gate.m);
+        gate.changed.wait(lock, [&gate] {
+            return gate.started;
+        });
+    };
+    auto release = [](GateContext& gate) {
+        {
+            lock_guard lock(gate.m);
+            gate.released = true;
+        }
+        gate.changed.notify_all();
+    };
+
+    batch::BatchRunner runner;
+    GateContext gate;
+    thread old_run([&runner, &gate, &script] {
+        ASSERT(runner.RunJob({script, ""s}, gate).error.empty());
+    });
+    wait_started(gate);
+
+    // Перезагрузка не ждёт выполняемого задания, а новые задания сразу выполняют новую программу
+    ofstream(script) << "print 'v2'\n"s;
+    runner.Reload(script);
+    ostringstream output;
+    runtime::SimpleContext context{output};
+    ASSERT(runner.RunJob({script, ""s}, context).error.empty());
+    ASSERT_EQUAL(output.str(), "v2\n"s);
+    // Выполняемое задание владеет своей копией программы, поэтому заменённая версия
+    // освобождается сразу
+    ASSERT_EQUAL(runner.GetRetiredCount(), 0U);
+
+    // Программа с ошибкой не публикуется
+    ofstream(script) << "print (\n"s;
+    ASSERT_THROWS(runner.Reload(script), ParseError);
+
+    release(gate);
+    old_run.join();
+    // Старое задание завершилось со своей программой
+    ASSERT_EQUAL(gate.text, "v1\ndone\n"s);
+    output.str({});
+    ASSERT(runner.RunJob({script, ""s}, context).error.empty());
+    ASSERT_EQUAL(output.str(), "v2\n"s);
+
+    // Ячейки эпох заняты только на время загрузки программы, поэтому число одновременно
+    // выполняемых заданий ими не ограничено
+    vector<unique_ptr<GateContext>> gates;
+    vector<thread> blocked;
+    for (size_t i = 0; i <= runtime::EpochDomain::SLOT_COUNT; ++i) {
+        gates.push_back(make_unique<GateContext>());
+        blocked.emplace_back([&runner, &blocked_gate = *gates.back(), &script] {
+            ASSERT(runner.RunJob({script, ""s}, blocked_gate).error.empty());
+        });
+    }
+    for (auto& blocked_gate : gates) {
+        wait_started(*blocked_gate);
+    }
+    output.str({});
+    ASSERT(runner.RunJob({script, ""s}, context).error.empty());
+    ASSERT_EQUAL(output.str(), "v2\n"s);
+    for (auto& blocked_gate : gates) {
+        release(*blocked_gate);
+    }
+    for (auto& t : blocked) {
+        t.join();
+    }
+
+    remove(script.c_str());
+    rmdir(dir.c_str());
+}
+
+void TestDaemon() {
+    char dir_template[] = "/tmp/mython_daemon_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    const auto write = [&dir](const string& name, const string& text) {
+        ofstream(dir + "/"s + name) << text;
+    };
+    write("greet.my"s, "print greeting + ', ' + who\n"s);
+    write("input.my"s, "greeting = 'hi'\nwho = 'daemon'\n"s);
+    write("count.my"s, "i = 0\nwhile i < 500:\n  print i\n  i = i + 1\n"s);
+
+    server::DaemonOptions daemon_options;
+    daemon_options.socket_path = dir + "/daemon.sock"s;
+    daemon_options.base_dir = dir;
+    // Маленький буфер: вывод длинного сценария приходит несколькими кадрами
+    daemon_options.output_buffer = 64;
+    {
+        server::Daemon daemon(daemon_options);
+        thread serving([&daemon] {
+            daemon.Serve();
+        });
+
+        {
+            server::Client client(daemon_options.socket_path);
+            ostringstream output;
+            ASSERT_EQUAL(client.Run({"greet.my"s, "input.my"s}, output), ""s);
+            ASSERT_EQUAL(output.str(), "hi, daemon\n"s);
+
+            // Глобальные переменные предыдущего запроса не видны следующему
+            output.str({});
+            ASSERT(!client.Run({"greet.my"s, ""s}, output).empty());
+            ASSERT(!client.Run({"missing.my"s, ""s}, output).empty());
+
+            string expected;
+            for (int i = 0; i < 500; ++i) {
+                expected += to_string(i) + "\n"s;
+            }
+            output.str({});
+            ASSERT_EQUAL(client.Run({"count.my"s, ""s}, output), ""s);
+            ASSERT_EQUAL(output.str(), expected);
+
+            write("count.my"s, "print 'updated'\n"s);
+            ASSERT_EQUAL(client.Reload("count.my"s), ""s);
+            output.str({});
+            ASSERT_EQUAL(client.Run({"count.my"s, ""s}, output), ""s);
+            ASSERT_EQUAL(output.str(), "updated\n"s);
+        }
+
+        vector<thread> clients;
+        atomic<int> succeeded = 0;
+        for (int i = 0; i < 4; ++i) {
+            clients.emplace_back([&daemon_options, &succeeded] {
+                server::Client client(daemon_options.socket_path);
+                for (int j = 0; j < 10; ++j) {
+                    ostringstream output;
+                    if (client.Run({"greet.my"s, "input.my"s}, output).empty() && output.str() == "hi, daemon\n"s) {
+                        ++succeeded;
+                    }
+                }
+            });
+        }
+        for (auto& t : clients) {
+            t.join();
+        }
+        ASSERT_EQUAL(succeeded.load(), 40);
+
+        daemon.Stop();
+        serving.join();
+        const auto stats = daemon.GetStats();
+        ASSERT_EQUAL(stats.connections, 5U);
+        ASSERT_EQUAL(stats.requests, 46U);
+        ASSERT_EQUAL(stats.failed, 2U);
+        ASSERT_EQUAL(stats.reloads, 1U);
+    }
+
+    // Запрос клиента, отключившегося во время выполнения, прерывается при следующем выводе,
+    // и соединение освобождается для следующего клиента
+    write("endless.my"s, "while True:\n  print 'tick'\n"s);
+    daemon_options.max_connections = 1;
+    {
+        server::Daemon daemon(daemon_options);
+        thread serving([&daemon] {
+            daemon.Serve();
+        });
+
+        {
+            // Вывод, который обрывает чтение ответа на первом фрагменте
+            struct HangupBuffer : streambuf {
+                int_type overflow(int_type) override {
+                    throw runtime_error("Hang up"s);
+                }
+            } hangup;
+            ostream hangup_output(&hangup);
+            hangup_output.exceptions(ios::badbit);
+            server::Client client(daemon_options.socket_path);
+            ASSERT_THROWS(static_cast<void>(client.Run({"endless.my"s, ""s}, hangup_output)), runtime_error);
+        }
+        // Единственное соединение принимается, только когда закрыто прежнее
+        server::Client client(daemon_options.socket_path);
+        ostringstream output;
+        ASSERT_EQUAL(client.Run({"greet.my"s, "input.my"s}, output), ""s);
+        ASSERT_EQUAL(output.str(), "hi, daemon\n"s);
+
+        daemon.Stop();
+        serving.join();
+        const auto stats = daemon.GetStats();
+        ASSERT_EQUAL(stats.connections, 2U);
+        ASSERT_EQUAL(stats.requests, 2U);
+        ASSERT_EQUAL(stats.failed, 1U);
+    }
+
+    // Файл, не являющийся сокетом, не удаляется
+    daemon_options.socket_path = dir + "/greet.my"s;
+    ASSERT_THROWS(server::Daemon{daemon_options}, runtime_error);
+    ASSERT(ifstream(daemon_options.socket_path));
+
+    for (const char* name : {"greet.my", "input.my", "count.my", "endless.my"}) {
+        remove((dir + "/"s + name).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+void TestScheduler() {
+    runtime::NativeRegistry natives;
+    runtime::RegisterSessionFunctions(natives);
+    ParseOptions options;
+    options.natives = &natives;
+    istringstream echo_text(R"(
+count = 0
+line = read_line()
+while line:
+  count = count + 1
+  print count, line
+  line = read_line()
+print 'bye'
+)"s);
+    parse::Lexer echo_lexer(echo_text);
+    const auto echo = ParseProgram(echo_lexer, options);
+    istringstream busy_text(R"(
+total = 0
+for i in range(300000):
+  total = total + 1
+print total
+)"s);
+    parse::Lexer busy_lexer(busy_text);
+    const auto busy = ParseProgram(busy_lexer, options);
+
+    runtime::SchedulerOptions scheduler_options;
+    scheduler_options.threads = 2;
+    scheduler_options.time_slice = chrono::microseconds(200);
+    runtime::Scheduler scheduler(scheduler_options);
+
+    // Вычисляющая сессия вытесняется по кванту и не мешает сессиям, ждущим ввода
+    auto busy_session = scheduler.Start([&busy](runtime::Context& context) {
+        runtime::Closure closure;
+        busy->Execute(closure, context);
+    });
+    constexpr int SESSION_COUNT = 300;
+    vector<shared_ptr<runtime::Session>> sessions;
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        sessions.push_back(scheduler.Start([&echo](runtime::Context& context) {
+            runtime::Closure closure;
+            echo->Execute(closure, context);
+        }));
+    }
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        sessions[i]->PushInput("hello "s + to_string(i));
+    }
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        sessions[i]->PushInput("again"s);
+        sessions[i]->CloseInput();
+    }
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        sessions[i]->Wait();
+        ASSERT_EQUAL(sessions[i]->TakeOutput(), "1 hello "s + to_string(i) + "\n2 again\nbye\n"s);
+        ASSERT(sessions[i]->GetError().empty());
+    }
+    busy_session->Wait();
+    ASSERT_EQUAL(busy_session->TakeOutput(), "300000\n"s);
+    ASSERT(busy_session->GetStats().preemptions > 0);
+
+    const auto stats = scheduler.GetStats();
+    ASSERT_EQUAL(stats.threads, 2U);
+    ASSERT_EQUAL(stats.sessions, static_cast<size_t>(SESSION_COUNT + 1));
+    ASSERT_EQUAL(stats.finished, stats.sessions);
+    ASSERT_EQUAL(stats.waiting, 0U);
+    ASSERT(stats.preemptions > 0);
+
+    // Ошибка сессии не затрагивает планировщик, а read_line вне сессии недоступна
+    auto failing = scheduler.Start([](runtime::Context& /*context*/) {
+        throw runtime_error("session failed"s);
+    });
+    failing->Wait();
+    ASSERT_EQUAL(failing->GetError(), "session failed"s);
+    ASSERT_THROWS(runtime::Session::ReadLine(), runtime_error);
+
+    // Сессии одного потока, приостановленные посреди вывода списков, не путают выводимые контейнеры
+    istringstream printing_text(R"(
+class Line:
+  def __str__():
+    return read_line()
+
+items = [Line()]
+print items
+print items
+)"s);
+    parse::Lexer printing_lexer(printing_text);
+    const auto printing = ParseProgram(printing_lexer, options);
+    scheduler_options.threads = 1;
+    runtime::Scheduler single(scheduler_options);
+    auto first = single.Start([&printing](runtime::Context& context) {
+        runtime::Closure closure;
+        printing->Execute(closure, context);
+    });
+    auto second = single.Start([&printing](runtime::Context& context) {
+        runtime::Closure closure;
+        printing->Execute(closure, context);
+    });
+    while (single.GetStats().waiting < 2) {
+        this_thread::sleep_for(1ms);
+    }
+    first->PushInput("a"s);
+    first->PushInput("b"s);
+    first->Wait();
+    second->PushInput("c"s);
+    second->PushInput("d"s);
+    second->Wait();
+    ASSERT_EQUAL(first->TakeOutput(), "[a]\n[b]\n"s);
+    ASSERT_EQUAL(second->TakeOutput(), "[c]\n[d]\n"s);
+}
+
+void TestExecutionLimits() {
+    auto run = [](const string& text, const runtime::ExecutionLimits& limits, uint64_t* fuel_used = nullptr) {
+        istringstream input(text);
+        ostringstream output;
+        runtime::LimitScope scope(limits);
+        try {
+            RunMythonProgram(input, output);
+        } catch (...) {
+            if (fuel_used) {
+                *fuel_used = scope.GetFuelUsed();
+            }
+            throw;
+        }
+        if (fuel_used) {
+            *fuel_used = scope.GetFuelUsed();
+        }
+        return output.str();
+    };
+    const string counting = R"(
+def inc(x):
+  return x + 1
+
+x = 0
+for i in range(10):
+  if i < 5:
+    x = inc(x)
+print x
+)"s;
+    const string endless_loop = R"(
+x = 0
+while True:
+  x = 1
+)"s;
+    const string endless_recursion = R"(
+def spin(n):
+  return spin(n + 1)
+
+spin(0)
+)"s;
+
+    // Топливо расходуют итерации, ветвления и вызовы: 10 итераций, 10 ветвлений и 5 вызовов
+    uint64_t used = 0;
+    ASSERT_EQUAL(run(counting, {}, &used), "5\n"s);
+    ASSERT_EQUAL(used, 25U);
+    ASSERT_EQUAL(run(counting, {25, {}}), "5\n"s);
+    ASSERT_THROWS(run(counting, {24, {}}), runtime::FuelExhaustedError);
+
+    ASSERT_THROWS(run(endless_loop, {100000, {}}, &used), runtime::FuelExhaustedError);
+    ASSERT_EQUAL(used, 100000U);
+    ASSERT_THROWS(run(endless_recursion, {100000, {}}), runtime::FuelExhaustedError);
+
+    const auto start = chrono::steady_clock::now();
+    ASSERT_THROWS(run(endless_loop, {0, chrono::milliseconds(20)}), runtime::DeadlineExceededError);
+    ASSERT_THROWS(run(endless_recursion, {0, chrono::milliseconds(20)}), runtime::DeadlineExceededError);
+    ASSERT(chrono::steady_clock::now() - start < chrono::seconds(2));
+
+    // Вложенное ограничение не ослабляет внешнее, а израсходованное внутри вычитается из внешнего
+    {
+        runtime::LimitScope outer({1000, {}});
+        ASSERT_THROWS(run(endless_loop, {1000000, {}}, &used), runtime::FuelExhaustedError);
+        ASSERT_EQUAL(used, 1000U);
+        ASSERT_EQUAL(outer.GetFuelUsed(), 1000U);
+        ASSERT_THROWS(run(counting, {}), runtime::FuelExhaustedError);
+        ASSERT_THROWS(static_cast<void>(runtime::GetRemainingLimits()), runtime::FuelExhaustedError);
+    }
+    // После прерывания ограничения сняты, и интерпретатор продолжает работать
+    ASSERT_EQUAL(run(counting, {}), "5\n"s);
+    ASSERT_EQUAL(runtime::GetRemainingLimits().fuel, 0U);
+
+    // Задача spawn получает оставшиеся ограничения программы
+    ASSERT_THROWS(run(R"(
+def spin():
+  while True:
+    x = 1
+
+f = spawn spin()
+r = join(f)
+)"s, {100000, {}}), runtime::FuelExhaustedError);
+
+    // Задачи расходуют общий запас топлива программы: каждая укладывается в него,
+    // а все вместе - нет
+    const string spawn_work = R"(
+def work():
+  for i in range(3000):
+    x = i
+  return 1
+
+)"s;
+    ASSERT_EQUAL(run(spawn_work + "print join(spawn work())\n"s, {5000, {}}), "1\n"s);
+    ASSERT_THROWS(run(spawn_work + R"(
+f1 = spawn work()
+f2 = spawn work()
+f3 = spawn work()
+f4 = spawn work()
+f5 = spawn work()
+print join(f1) + join(f2) + join(f3) + join(f4) + join(f5)
+)"s, {5000, {}}), runtime::FuelExhaustedError);
+
+    // Ограничения сессии не действуют на другие сессии того же рабочего потока
+    runtime::SchedulerOptions scheduler_options;
+    scheduler_options.threads = 1;
+    scheduler_options.time_slice = chrono::microseconds(100);
+    runtime::Scheduler scheduler(scheduler_options);
+    auto limited = scheduler.Start([&](runtime::Context& context) {
+        runtime::LimitScope scope({0, chrono::milliseconds(50)});
+        istringstream input(endless_loop);
+        parse::Lexer lexer(input);
+        runtime::Closure closure;
+        ParseProgram(lexer)->Execute(closure, context);
+    });
+    auto unlimited = scheduler.Start([](runtime::Context& context) {
+        istringstream input(R"(
+total = 0
+for i in range(300000):
+  total = total + 1
+print total
+)"s);
+        parse::Lexer lexer(input);
+        runtime::Closure closure;
+        ParseProgram(lexer)->Execute(closure, context);
+    });
+    limited->Wait();
+    unlimited->Wait();
+    ASSERT_EQUAL(limited->GetError(), "Execution deadline exceeded"s);
+    ASSERT(unlimited->GetError().empty());
+    ASSERT_EQUAL(unlimited->TakeOutput(), "300000\n"s);
+
+    // Ограничения действуют на задания пакета и запросы демона
+    char dir_template[] = "/tmp/mython_limits_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    ofstream(dir + "/endless.my"s) << endless_loop;
+    batch::BatchRunner runner;
+    runtime::DummyContext context;
+    batch::Job job{dir + "/endless.my"s, {}};
+    job.limits.fuel = 1000;
+    ASSERT_EQUAL(runner.RunJob(job, context).error, "Execution fuel exhausted"s);
+
+    server::DaemonOptions daemon_options;
+    daemon_options.socket_path = dir + "/daemon.sock"s;
+    daemon_options.base_dir = dir;
+    daemon_options.limits.timeout = chrono::milliseconds(50);
+    {
+        server::Daemon daemon(daemon_options);
+        thread serving([&daemon] {
+            daemon.Serve();
+        });
+        {
+            server::Client client(daemon_options.socket_path);
+            ostringstream output;
+            ASSERT_EQUAL(client.Run({"endless.my"s, ""s}, output), "Execution deadline exceeded"s);
+        }
+        daemon.Stop();
+        serving.join();
+    }
+    remove((dir + "/endless.my"s).c_str());
+    rmdir(dir.c_str());
+}
+
+void TestMemoryQuota() {
+    auto run = [](const string& text, size_t quota) {
+        istringstream input(text);
+        ostringstream output;
+        runtime::MemoryAccount::Scope account(quota);
+        RunMythonProgram(input, output);
+        return output.str();
+    };
+    const string doubling = R"(
+s = 'x'
+while True:
+  s = s + s
+)"s;
+    const string chain = R"(
+class Node:
+  def __init__(next):
+    self.next = next
+
+head = None
+while True:
+  head = Node(head)
+)"s;
+    const string growing_list = R"(
+items = []
+x = 'item'
+while True:
+  items.append(x)
+)"s;
+    constexpr size_t QUOTA = 1 << 20;
+    ASSERT_THROWS(run(doubling, QUOTA), runtime::MemoryQuotaExceededError);
+    ASSERT_THROWS(run(chain, QUOTA), runtime::MemoryQuotaExceededError);
+    ASSERT_THROWS(run(growing_list, QUOTA), runtime::MemoryQuotaExceededError);
+    // Задача spawn расходует квоту программы
+    ASSERT_THROWS(run(R"(
+def grow():
+  s = 'x'
+  while True:
+    s = s + s
+
+f = spawn grow()
+r = join(f)
+)"s, QUOTA), runtime::MemoryQuotaExceededError);
+    // После прерывания интерпретатор продолжает работать
+    ASSERT_EQUAL(run("s = 'ab' + 'cd'\nprint s\n"s, QUOTA), "abcd\n"s);
+    // Прежде чем сообщить о превышении квоты, учёт собирает циклы, которые ещё не нашёл сборщик
+    runtime::CycleCollector& collector = runtime::CycleCollector::Current();
+    const size_t threshold = collector.GetThreshold();
+    collector.SetThreshold(0);
+    ASSERT_EQUAL(run(R"(
+class Node:
+  def __init__():
+    self.other = None
+
+for i in range(20000):
+  a = Node()
+  b = Node()
+  a.other = b
+  b.other = a
+print 'done'
+)"s, QUOTA), "done\n"s);
+    collector.SetThreshold(threshold);
+
+    // Задание пакета сообщает об использованной памяти
+    char dir_template[] = "/tmp/mython_quota_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    ofstream(dir + "/doubling.my"s) << doubling;
+    ofstream(dir + "/list.my"s) << "items = []\nfor i in range(1000):\n  items.append(str(i))\n"s;
+    batch::BatchRunner runner;
+    runtime::DummyContext context;
+    const auto failed = runner.RunJob({dir + "/doubling.my"s, {}, QUOTA}, context);
+    ASSERT_EQUAL(failed.error, "Memory quota of 1048576 bytes exceeded"s);
+    ASSERT(failed.memory.peak > QUOTA / 4 && failed.memory.peak <= QUOTA);
+    const auto succeeded = runner.RunJob({dir + "/list.my"s, {}}, context);
+    ASSERT(succeeded.error.empty());
+    ASSERT(succeeded.memory.current > 1000 * sizeof(runtime::String));
+    ASSERT(succeeded.memory.peak >= succeeded.memory.current);
+
+    // Задачи spawn расходуют общую квоту задания: одна укладывается в неё, а четыре - нет.
+    // Память задач видна в учёте задания
+    const string grow = "def grow():\n  items = []\n  for i in range(4000):\n    items.append(str(i))\n  return items\n"s;
+    ofstream(dir + "/spawn_one.my"s) << grow << "f = spawn grow()\nr = join(f)\n"s;
+    ofstream(dir + "/spawn_four.my"s) << grow << R"(
+f1 = spawn grow()
+f2 = spawn grow()
+f3 = spawn grow()
+f4 = spawn grow()
+r1 = join(f1)
+r2 = join(f2)
+r3 = join(f3)
+r4 = join(f4)
+)"s;
+    const auto one_task = runner.RunJob({dir + "/spawn_one.my"s, {}, QUOTA}, context);
+    ASSERT(one_task.error.empty());
+    ASSERT(one_task.memory.current > 4000 * sizeof(runtime::String));
+    const auto four_tasks = runner.RunJob({dir + "/spawn_four.my"s, {}, QUOTA}, context);
+    ASSERT_EQUAL(four_tasks.error, "Memory quota of 1048576 bytes exceeded"s);
+    ASSERT(four_tasks.memory.peak <= QUOTA);
+
+    // Квота командной строки действует на задания манифеста и запросы демона
+    ofstream(dir + "/manifest.txt"s) << "list.my\ndoubling.my\n"s;
+    ostringstream batch_output;
+    ostringstream report;
+    ASSERT(!RunBatch(dir + "/manifest.txt"s, 2, false, {}, {}, QUOTA, batch_output, report));
+    ASSERT(report.str().find("doubling.my: Memory quota of 1048576 bytes exceeded"s) != string::npos);
+    server::DaemonOptions daemon_options;
+    daemon_options.socket_path = dir + "/daemon.sock"s;
+    daemon_options.base_dir = dir;
+    daemon_options.memory_quota = QUOTA;
+    {
+        server::Daemon daemon(daemon_options);
+        thread serving([&daemon] {
+            daemon.Serve();
+        });
+        {
+            server::Client client(daemon_options.socket_path);
+            ostringstream output;
+            ASSERT_EQUAL(client.Run({"doubling.my"s, ""s}, output), "Memory quota of 1048576 bytes exceeded"s);
+            ASSERT_EQUAL(client.Run({"list.my"s, ""s}, output), ""s);
+        }
+        daemon.Stop();
+        serving.join();
+    }
+    remove((dir + "/manifest.txt"s).c_str());
+    remove((dir + "/doubling.my"s).c_str());
+    remove((dir + "/list.my"s).c_str());
+    remove((dir + "/spawn_one.my"s).c_str());
+    remove((dir + "/spawn_four.my"s).c_str());
+    rmdir(dir.c_str());
+}
+
+void TestInterpreter() {
+    const mython::Interpreter interpreter;
+    const mython::CompiledProgram program = interpreter.Compile(R"(
+total = total + step
+print total
+)"sv);
+    // Каждое выполнение начинается с переданных глобальных переменных, а не с результатов предыдущего
+    for (int i = 1; i <= 3; ++i) {
+        ostringstream output;
+        runtime::SimpleContext context{output};
+        runtime::Closure globals;
+        globals["total"s] = runtime::ObjectHolder::Own(runtime::Number{100});
+        globals["step"s] = runtime::ObjectHolder::Own(runtime::Number{i});
+        const auto result = program.Run(context, move(globals));
+        ASSERT(result.Succeeded());
+        ASSERT(result.error.empty());
+        ASSERT_EQUAL(output.str(), to_string(100 + i) + "\n"s);
+        ASSERT_EQUAL(result.globals.at("total"s).TryAs<runtime::Number>()->GetValue(), 100 + i);
+    }
+
+    // Ошибка выполнения возвращается в результате вместе с глобальными переменными
+    runtime::DummyContext context;
+    const auto failed = program.Run(context);
+    ASSERT(failed.status == mython::ExecutionStatus::RUNTIME_ERROR);
+    ASSERT(!failed.error.empty());
+    // Временная программа живёт, пока жив результат: x ссылается на её константу
+    const auto partial = interpreter.Compile("x = 1\ny = x + 'a'\n"sv).Run(context);
+    ASSERT(partial.status == mython::ExecutionStatus::RUNTIME_ERROR);
+    ASSERT_EQUAL(partial.globals.at("x"s).TryAs<runtime::Number>()->GetValue(), 1);
+    ASSERT_EQUAL(partial.globals.count("y"s), 0U);
+    ASSERT(partial.exception);
+    ASSERT_THROWS(rethrow_exception(partial.exception), runtime_error);
+    // Память учитывается и без квоты
+    const auto growing = interpreter.Compile("s = 'x'\nfor i in range(10):\n  s = s + s\n"sv).Run(context);
+    ASSERT(growing.Succeeded());
+    ASSERT(!growing.exception);
+    ASSERT(growing.memory.current >= 1024U);
+    ASSERT(growing.memory.peak >= growing.memory.current);
+
+    // Составная программа выполняет части одну за другой в общих глобальных переменных
+    const auto sequence = interpreter.Compile("step = 5\n"sv).Then(program);
+    ostringstream sequence_output;
+    runtime::SimpleContext sequence_context{sequence_output};
+    runtime::Closure start;
+    start["total"s] = runtime::ObjectHolder::Own(runtime::Number{1});
+    ASSERT(sequence.Run(sequence_context, move(start)).Succeeded());
+    ASSERT_EQUAL(sequence_output.str(), "6\n"s);
+
+    // При потоковом выполнении вывод предшествует ошибке разбора, которая возвращается в результате
+    istringstream stream_input("print 'first'\nx = \n"s);
+    ostringstream stream_output;
+    runtime::SimpleContext stream_context{stream_output};
+    const auto streamed = interpreter.RunStreaming(stream_input, stream_context);
+    ASSERT(streamed.status == mython::ExecutionStatus::PARSE_ERROR);
+    ASSERT_EQUAL(stream_output.str(), "first\n"s);
+
+    // Превышение ограничений различается по статусу
+    const auto endless = interpreter.Compile("while True:\n  s = 'x'\n"sv);
+    mython::ExecutionOptions fuel;
+    fuel.limits.fuel = 1000;
+    const auto exhausted = endless.Run(context, {}, fuel);
+    ASSERT(exhausted.status == mython::ExecutionStatus::FUEL_EXHAUSTED);
+    ASSERT_EQUAL(exhausted.fuel_used, 1000U);
+    mython::ExecutionOptions timeout;
+    timeout.limits.timeout = 20ms;
+    ASSERT(endless.Run(context, {}, timeout).status == mython::ExecutionStatus::DEADLINE_EXCEEDED);
+    mython::ExecutionOptions quota;
+    quota.memory_quota = 1 << 20;
+    const auto doubling = interpreter.Compile("s = 'x'\nwhile True:\n  s = s + s\n"sv).Run(context, {}, quota);
+    ASSERT(doubling.status == mython::ExecutionStatus::MEMORY_QUOTA_EXCEEDED);
+    ASSERT(doubling.memory.peak > 0 && doubling.memory.peak <= quota.memory_quota);
+
+    // Ошибки разбора выбрасываются при компиляции
+    ASSERT_THROWS(static_cast<void>(interpreter.Compile("x = \n"sv)), ParseError);
+    ASSERT_THROWS(static_cast<void>(interpreter.CompileFile("/nonexistent/program.my"s)), ParseError);
+
+    // Одна программа выполняется из нескольких потоков одновременно
+    const auto counting = interpreter.Compile(R"(
+total = 0
+for i in range(1000):
+  total = total + i
+)"sv);
+    vector<thread> threads;
+    atomic<int> succeeded = 0;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&counting, &succeeded] {
+            runtime::DummyContext thread_context;
+            const auto result = counting.Run(thread_context);
+            if (result.Succeeded() && result.globals.at("total"s).TryAs<runtime::Number>()->GetValue() == 499500) {
+                ++succeeded;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    ASSERT_EQUAL(succeeded.load(), 4);
+}
+
 void TestAll() {
     TestRunner tr;
     parse::RunOpenLexerTests(tr);
@@ -123,15 +1190,153 @@ void TestAll() {
     RUN_TEST(tr, TestAssignments);
     RUN_TEST(tr, TestArithmetics);
     RUN_TEST(tr, TestVariablesArePointers);
+    RUN_TEST(tr, TestSelfOutlivesTemporary);
+    RUN_TEST(tr, TestRunInRegion);
+    RUN_TEST(tr, TestRunStreaming);
+    RUN_TEST(tr, TestWorkStealingPool);
+    RUN_TEST(tr, TestInterpreter);
+}
+
+// Тесты, слишком долгие для запуска при каждом старте либо создающие файлы, сокеты
+// и планировщики. Выполняются ключом --slow-tests
+void TestAllSlow() {
+    TestRunner tr;
+    TestParseProgramSlow(tr);
+
+    RUN_TEST(tr, TestSnapshot);
+    RUN_TEST(tr, TestRunBatch);
+    RUN_TEST(tr, TestReload);
+    RUN_TEST(tr, TestDaemon);
+    RUN_TEST(tr, TestScheduler);
+    RUN_TEST(tr, TestExecutionLimits);
+    RUN_TEST(tr, TestMemoryQuota);
 }
 
 }  // namespace
 
-int main() {
+int main(int argc, char* argv[]) {
     try {
         TestAll();
 
-        RunMythonProgram(cin, cout);
+        bool use_region = false;
+        size_t stack_size = 0;
+        runtime::NativeRegistry natives;
+        vector<string> module_path;
+        bool lazy = false;
+        bool streaming = false;
+        string batch_manifest;
+        size_t thread_count = max(thread::hardware_concurrency(), 1U);
+        bool scaling = false;
+        string daemon_socket;
+        string save_snapshot;
+        string load_snapshot;
+        runtime::ExecutionLimits limits;
+        size_t memory_quota = 0;
+        bool slow_tests = false;
+        for (int i = 1; i < argc; ++i) {
+            if (argv[i] == "--slow-tests"sv) {
+                slow_tests = true;
+            } else if (argv[i] == "--region"sv) {
+                use_region = true;
+            } else if (argv[i] == "--stack-size"sv && i + 1 < argc) {
+                // Размер стека интерпретатора в мегабайтах
+                stack_size = stoul(argv[++i]) * 1024 * 1024;
+            } else if (argv[i] == "--native"sv && i + 1 < argc) {
+                natives.LoadModule(argv[++i]);
+            } else if (argv[i] == "--stream"sv) {
+                streaming = true;
+            } else if (argv[i] == "--lazy"sv) {
+                lazy = true;
+            } else if (argv[i] == "--batch"sv && i + 1 < argc) {
+                // Выполнить пакет сценариев из манифеста вместо программы из stdin
+                batch_manifest = argv[++i];
+            } else if (argv[i] == "--threads"sv && i + 1 < argc) {
+                thread_count = stoul(argv[++i]);
+            } else if (argv[i] == "--scaling"sv) {
+                scaling = true;
+            } else if (argv[i] == "--save-snapshot"sv && i + 1 < argc) {
+                // Выполнить программу из stdin как инициализацию и сохранить снимок её глобальных переменных
+                save_snapshot = argv[++i];
+            } else if (argv[i] == "--snapshot"sv && i + 1 < argc) {
+                // Начать выполнение программы с глобальными переменными из снимка
+                load_snapshot = argv[++i];
+            } else if (argv[i] == "--daemon"sv && i + 1 < argc) {
+                // Выполнять сценарии по запросам через Unix-сокет с указанным путём
+                daemon_socket = argv[++i];
+            } else if (argv[i] == "--fuel"sv && i + 1 < argc) {
+                // Прервать программу после указанного количества вызовов, итераций и ветвлений
+                limits.fuel = stoull(argv[++i]);
+            } else if (argv[i] == "--timeout-ms"sv && i + 1 < argc) {
+                limits.timeout = chrono::milliseconds(stoul(argv[++i]));
+            } else if (argv[i] == "--memory-quota"sv && i + 1 < argc) {
+                // Прервать программу, если её объекты займут больше указанного числа мегабайт
+                const size_t megabytes = stoul(argv[++i]);
+                if (megabytes > SIZE_MAX / (1 << 20)) {
+                    throw runtime_error("Memory quota is too large"s);
+                }
+                memory_quota = megabytes << 20;
+            } else if (argv[i] == "--module-path"sv && i + 1 < argc) {
+                // Каталог, в котором ищутся импортируемые модули. Каталоги просматриваются
+                // в порядке указания
+                module_path.emplace_back(argv[++i]);
+            }
+        }
+        if (slow_tests) {
+            TestAllSlow();
+            return 0;
+        }
+        if (module_path.empty()) {
+            module_path.emplace_back("."s);
+        }
+
+        parse::ModuleCache modules(move(module_path));
+        ParseOptions options;
+        options.natives = &natives;
+        options.modules = &modules;
+        options.lazy_method_bodies = lazy;
+        if (!batch_manifest.empty()) {
+            return RunBatch(batch_manifest, thread_count, scaling, options, limits, memory_quota, cout, cerr)
+                       ? 0
+                       : 1;
+        }
+        if (!daemon_socket.empty()) {
+            server::DaemonOptions daemon_options;
+            daemon_options.socket_path = daemon_socket;
+            daemon_options.base_dir = "."s;
+            daemon_options.limits = limits;
+            daemon_options.memory_quota = memory_quota;
+            server::Daemon daemon(daemon_options, options);
+            daemon.Serve();
+            return 0;
+        }
+        if (!save_snapshot.empty()) {
+            runtime::LimitScope limit_scope(limits);
+            runtime::MemoryAccount::Scope account(memory_quota);
+            runtime::SimpleContext context{cout};
+            snapshot::Save(string(istreambuf_iterator<char>(cin), {}), save_snapshot, context, options);
+            return 0;
+        }
+        unique_ptr<snapshot::Snapshot> snapshot;
+        if (!load_snapshot.empty()) {
+            snapshot = make_unique<snapshot::Snapshot>(load_snapshot, options);
+            options.prelude = snapshot->GetProgram();
+        }
+        const mython::ExecutionOptions execution{limits, memory_quota};
+        auto run = [use_region, streaming, &options, snapshot = snapshot.get(), &execution] {
+            // Регион освобождается только целиком, поэтому при потоковом выполнении не используется
+            if (streaming) {
+                RunMythonProgramStreaming(cin, cout, options, snapshot, execution);
+            } else if (use_region) {
+                RunMythonProgramInRegion(cin, cout, options, snapshot, execution);
+            } else {
+                RunMythonProgram(cin, cout, options, snapshot, execution);
+            }
+        };
+        if (stack_size > 0) {
+            runtime::ExecutionStack(stack_size).Run(run);
+        } else {
+            run();
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
 		return 1;
@@ -0,0 +1,202 @@
+#include "memory_account.h"
+
+#include "collector.h"
+#include "reclaimer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace runtime {
+
+namespace detail {
+thread_local ThreadMemory thread_memory;
+}  // namespace detail
+
+using detail::thread_memory;
+
+namespace {
+// Поток освобождает мусор, чтобы повторить отнесение памяти на учёт
+thread_local bool reclaiming = false;
+}  // namespace
+
+MemoryAccount::Handle::Handle(MemoryAccount* account) noexcept
+: account_(account) {
+    if (account_) {
+        account_->state_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+MemoryAccount::Handle::Handle(const Handle& other) noexcept
+: Handle(other.account_) {
+}
+
+MemoryAccount::Handle::~Handle() {
+    if (account_) {
+        account_->Close();
+    }
+}
+
+MemoryAccount::Scope::Scope(size_t quota)
+: Scope(thread_memory.account, quota) {
+}
+
+MemoryAccount::Scope::Scope(const Handle& parent, size_t quota)
+: Scope(parent.Get(), quota) {
+}
+
+MemoryAccount::Scope::Scope(MemoryAccount* parent, size_t quota)
+: account_(new MemoryAccount(quota, parent))
+, previous_(thread_memory.account) {
+    if (previous_) {
+        previous_->ReturnReserve(0);
+    }
+    thread_memory.account = account_;
+}
+
+MemoryAccount::Scope::Scope(nullptr_t)
+: account_(nullptr)
+, previous_(thread_memory.account) {
+    if (previous_) {
+        previous_->ReturnReserve(0);
+    }
+    thread_memory.account = nullptr;
+}
+
+MemoryAccount::Scope::~Scope() {
+    if (account_) {
+        account_->ReturnReserve(0);
+    }
+    thread_memory.account = previous_;
+    if (account_) {
+        account_->Close();
+    }
+}
+
+MemoryUsage MemoryAccount::Scope::GetUsage() const {
+    return account_ ? account_->GetUsage() : MemoryUsage{};
+}
+
+MemoryAccount::MemoryAccount(size_t quota, MemoryAccount* parent)
+: quota_(quota)
+, parent_(parent) {
+}
+
+void MemoryAccount::ChargeSlow(size_t bytes) {
+    try {
+        ChargeUnreserved(bytes);
+    } catch (const MemoryQuotaExceededError&) {
+        if (reclaiming) {
+            throw;
+        }
+        // Квоту может занимать мусор: циклы, которые сборщик ещё не нашёл, и объекты в очереди
+        // отложенного освобождения. Он освобождается один раз, после чего попытка повторяется
+        reclaiming = true;
+        try {
+            CycleCollector::Current().Collect();
+            FlushDeferredReclamation();
+            Charge(bytes);
+        } catch (...) {
+            reclaiming = false;
+            throw;
+        }
+        reclaiming = false;
+    }
+}
+
+void MemoryAccount::ChargeUnreserved(size_t bytes) {
+    detail::ThreadMemory& thread = thread_memory;
+    if (thread.account != this) {
+        ChargeShared(bytes);
+        UpdatePeak(state_.load(memory_order_relaxed) >> HOLDER_BITS);
+        return;
+    }
+    // Запас исчерпан: берём новую порцию, но не больше, чем позволяют квоты. Если не хватает
+    // и недостающих байт, ChargeShared сообщит о квоте, которая превышена
+    const size_t needed = bytes - thread.reserved;
+    const size_t remaining = GetRemaining() - thread.reserved;
+    const size_t portion = needed > remaining ? needed : min(max(needed, RESERVE_SIZE), remaining);
+    ChargeShared(portion);
+    thread.reserved += portion - bytes;
+    UpdatePeak((state_.load(memory_order_relaxed) >> HOLDER_BITS) - thread.reserved);
+}
+
+void MemoryAccount::ChargeShared(size_t bytes) {
+    const size_t previous = state_.fetch_add(bytes << HOLDER_BITS, memory_order_relaxed);
+    const size_t current = (previous >> HOLDER_BITS) + bytes;
+    if (quota_ != 0 && current > quota_) {
+        // Учёт жив: его удерживает либо открытая область, либо учтённый объект, память
+        // которого растёт. Поэтому отмена не может обнулить его
+        state_.fetch_sub(bytes << HOLDER_BITS, memory_order_relaxed);
+        throw MemoryQuotaExceededError("Memory quota of "s + to_string(quota_) + " bytes exceeded"s);
+    }
+    if (parent_) {
+        try {
+            parent_->ChargeShared(bytes);
+        } catch (...) {
+            state_.fetch_sub(bytes << HOLDER_BITS, memory_order_relaxed);
+            throw;
+        }
+        parent_->UpdatePeak(state_.load(memory_order_relaxed) >> HOLDER_BITS);
+    }
+}
+
+void MemoryAccount::ReleaseShared(size_t bytes) noexcept {
+    // Учёт может быть удалён сразу после уменьшения счётчика
+    MemoryAccount* parent = parent_;
+    if (state_.fetch_sub(bytes << HOLDER_BITS, memory_order_acq_rel) == (bytes << HOLDER_BITS)) {
+        delete this;
+    }
+    // Объемлющий учёт жив, пока на нём числятся эти байты
+    if (parent) {
+        parent->ReleaseShared(bytes);
+    }
+}
+
+void MemoryAccount::ReturnReserve(size_t keep) noexcept {
+    detail::ThreadMemory& thread = thread_memory;
+    if (thread.reserved > keep) {
+        const size_t excess = thread.reserved - keep;
+        thread.reserved = keep;
+        // Учёт текущий, поэтому его удерживает открытая область
+        ReleaseShared(excess);
+    }
+}
+
+void MemoryAccount::UpdatePeak(size_t current) noexcept {
+    size_t peak = peak_.load(memory_order_relaxed);
+    while (current > peak && !peak_.compare_exchange_weak(peak, current, memory_order_relaxed)) {
+    }
+}
+
+MemoryUsage MemoryAccount::GetUsage() const {
+    size_t current = state_.load(memory_order_relaxed) >> HOLDER_BITS;
+    if (thread_memory.account == this) {
+        current -= thread_memory.reserved;
+    }
+    return {current, peak_.load(memory_order_relaxed)};
+}
+
+size_t MemoryAccount::GetRemaining() const {
+    size_t remaining = SIZE_MAX;
+    for (const MemoryAccount* account = this; account; account = account->parent_) {
+        if (account->quota_ != 0) {
+            const size_t current = account->state_.load(memory_order_relaxed) >> HOLDER_BITS;
+            remaining = min(remaining, account->quota_ - min(current, account->quota_));
+        }
+    }
+    // Запас потока уже отнесён на этот учёт и все объемлющие
+    if (remaining != SIZE_MAX && thread_memory.account == this) {
+        remaining += thread_memory.reserved;
+    }
+    return remaining;
+}
+
+void MemoryAccount::Close() noexcept {
+    if (state_.fetch_sub(1, memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+}  // namespace runtime
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "allocator.h"
+#include "execution_limits.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+namespace runtime {
+
+// Превышена квота памяти выполнения
+class MemoryQuotaExceededError : public ExecutionLimitError {
+public:
+    using ExecutionLimitError::ExecutionLimitError;
+};
+
+struct MemoryUsage {
+    // Байты, занятые живыми объектами
+    size_t current = 0;
+    // Наибольшее значение current за время существования учёта
+    size_t peak = 0;
+};
+
+class MemoryAccount;
+class Region;
+
+namespace detail {
+// Состояние размещения объектов в потоке. ObjectHolder::Own читает его одним обращением к TLS
+struct ThreadMemory {
+    // Учёт памяти, действующий в потоке, либо nullptr
+    MemoryAccount* account = nullptr;
+    // Байты, уже отнесённые на учёт, но ещё не занятые объектами. Из этого запаса поток
+    // относит память на учёт без атомарных операций
+    size_t reserved = 0;
+    // Регион, активный в потоке (см. Region::Scope), либо nullptr
+    Region* region = nullptr;
+};
+extern thread_local ThreadMemory thread_memory;
+
+// Возвращает объём памяти строки в куче: ноль, если строка хранится в самом объекте
+inline size_t GetHeapSize(const std::string& value) {
+    const char* data = value.data();
+    const auto* self = reinterpret_cast<const char*>(&value);
+    return data >= self && data < self + sizeof(value) ? 0 : value.capacity() + 1;
+}
+}  // namespace detail
+
+/*
+ * Учёт памяти одного выполнения программы. Пока учёт действует в потоке (см. MemoryAccount::Scope),
+ * ObjectHolder::Own относит на него память объектов вместе с содержимым строк, а списки,
+ * словари и экземпляры классов - рост своего содержимого. Память возвращается на счёт
+ * при освобождении объекта в любом потоке, поэтому учёт существует, пока жив хотя бы один
+ * учтённый объект, даже если выполнение уже завершилось.
+ *
+ * Учёт, созданный при действующем учёте, вложен в него: память относится на оба,
+ * и действует меньшая из квот. Учёт в другом потоке вкладывается явно (см. Handle).
+ *
+ * Поток, в котором учёт действует, относит на него память порциями и расходует их
+ * без атомарных операций, а память освобождённых им объектов возвращает в свою порцию.
+ * Квота текущего учёта при этом соблюдается точно, а объемлющие учёты могут
+ * превысить свою не больше чем на порцию
+ */
+class MemoryAccount {
+public:
+    // Удерживает учёт от удаления, пока существует, чтобы в другом потоке открыть вложенный
+    // в него учёт. Копия удерживает учёт ещё раз
+    class Handle {
+    public:
+        // Удерживает учёт account, если он задан
+        explicit Handle(MemoryAccount* account) noexcept;
+        Handle(const Handle& other) noexcept;
+        ~Handle();
+
+        Handle& operator=(const Handle&) = delete;
+
+        [[nodiscard]] MemoryAccount* Get() const {
+            return account_;
+        }
+
+    private:
+        MemoryAccount* account_;
+    };
+
+    // Делает новый учёт текущим для потока на время своей жизни
+    class Scope {
+    public:
+        // Квота в байтах. Ноль - без ограничения, только учёт
+        explicit Scope(size_t quota = 0);
+        // Открывает учёт, вложенный в учёт parent, а не в текущий учёт потока.
+        // parent должен удерживать учёт и существовать дольше области
+        explicit Scope(const Handle& parent, size_t quota = 0);
+        // Отключает учёт: память объектов ни на что не относится
+        explicit Scope(std::nullptr_t);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // Возвращает текущий и наибольший объём памяти объектов, учтённых этим учётом
+        [[nodiscard]] MemoryUsage GetUsage() const;
+
+    private:
+        Scope(MemoryAccount* parent, size_t quota);
+
+        MemoryAccount* account_;
+        MemoryAccount* previous_;
+    };
+
+    MemoryAccount(const MemoryAccount&) = delete;
+    MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+    // Возвращает учёт, действующий в текущем потоке, либо nullptr
+    [[nodiscard]] static MemoryAccount* Current() {
+        return detail::thread_memory.account;
+    }
+
+    // Относит bytes байт на учёт. Если это превышает квоту учёта или объемлющих учётов
+    // даже после сборки циклов и отложенного освобождения объектов, ничего не относит
+    // и выбрасывает MemoryQuotaExceededError
+    void Charge(size_t bytes) {
+        detail::ThreadMemory& thread = detail::thread_memory;
+        if (thread.account != this || thread.reserved < bytes) {
+            ChargeSlow(bytes);
+            return;
+        }
+        thread.reserved -= bytes;
+        // Пик текущего учёта обновляет только его поток
+        const size_t current = (state_.load(std::memory_order_relaxed) >> HOLDER_BITS) - thread.reserved;
+        if (current > peak_.load(std::memory_order_relaxed)) {
+            peak_.store(current, std::memory_order_relaxed);
+        }
+    }
+
+    // Возвращает bytes байт, ранее отнесённых на учёт. Может вызываться из любого потока
+    void Release(size_t bytes) noexcept {
+        detail::ThreadMemory& thread = detail::thread_memory;
+        if (thread.account != this) {
+            ReleaseShared(bytes);
+            return;
+        }
+        thread.reserved += bytes;
+        if (thread.reserved > 2 * RESERVE_SIZE) {
+            ReturnReserve(RESERVE_SIZE);
+        }
+    }
+
+    [[nodiscard]] MemoryUsage GetUsage() const;
+    // Возвращает, сколько байт ещё можно отнести на учёт с учётом объемлющих,
+    // либо SIZE_MAX, если квот нет
+    [[nodiscard]] size_t GetRemaining() const;
+
+private:
+    // Размер порции, которую поток относит на текущий учёт за одну атомарную операцию
+    static constexpr size_t RESERVE_SIZE = 16 * 1024;
+    // Разряды state_, в которых считаются владельцы учёта: открытая область и Handle.
+    // Остальные разряды хранят количество учтённых байт, до 16 ТБ
+    static constexpr unsigned HOLDER_BITS = 20;
+
+    MemoryAccount(size_t quota, MemoryAccount* parent);
+
+    // Относит bytes байт на учёт, когда запаса потока не хватает. При превышении квоты
+    // освобождает мусор потока и повторяет попытку
+    void ChargeSlow(size_t bytes);
+    void ChargeUnreserved(size_t bytes);
+    // Атомарно относит bytes байт на учёт и объемлющие учёты с проверкой квот
+    void ChargeShared(size_t bytes);
+    void ReleaseShared(size_t bytes) noexcept;
+    // Возвращает на учёт запас потока сверх keep байт
+    void ReturnReserve(size_t keep) noexcept;
+    void UpdatePeak(size_t current) noexcept;
+
+    // Отпускает учёт. Он удаляется, когда его не удерживает ни область, ни Handle
+    // и освобождены все учтённые объекты
+    void Close() noexcept;
+
+    // Количество учтённых байт вместе с запасом потока, сдвинутое на HOLDER_BITS разрядов,
+    // плюс количество владельцев. Одна атомарная операция и учитывает память,
+    // и определяет момент удаления учёта
+    std::atomic<size_t> state_{1};
+    std::atomic<size_t> peak_{0};
+    const size_t quota_;
+    MemoryAccount* const parent_;
+};
+
+/*
+ * Аллокатор объектов, учитываемых MemoryAccount. Хранится в управляющем блоке shared_ptr,
+ * поэтому память возвращается на тот учёт, на который была отнесена, в каком бы потоке
+ * ни был освобождён объект. extra_bytes - память в куче, принадлежащая объекту
+ * и не меняющаяся за время его жизни (содержимое строки)
+ */
+template <typename T>
+class AccountedAllocator {
+public:
+    using value_type = T;
+
+    AccountedAllocator(MemoryAccount& account, size_t extra_bytes) noexcept
+        : account_(&account)
+        , extra_bytes_(extra_bytes) {
+    }
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U>& other) noexcept  // NOLINT(google-explicit-constructor)
+        : account_(other.account_)
+        , extra_bytes_(other.extra_bytes_) {
+    }
+
+    T* allocate(size_t n) {
+        account_->Charge(n * sizeof(T) + extra_bytes_);
+        try {
+            return PoolAllocator<T>().allocate(n);
+        } catch (...) {
+            account_->Release(n * sizeof(T) + extra_bytes_);
+            throw;
+        }
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        PoolAllocator<T>().deallocate(p, n);
+        account_->Release(n * sizeof(T) + extra_bytes_);
+    }
+
+    template <typename U>
+    bool operator==(const AccountedAllocator<U>& other) const {
+        return account_ == other.account_;
+    }
+
+    template <typename U>
+    bool operator!=(const AccountedAllocator<U>& other) const {
+        return account_ != other.account_;
+    }
+
+private:
+    template <typename U>
+    friend class AccountedAllocator;
+
+    MemoryAccount* account_;
+    size_t extra_bytes_;
+};
+
+}  // namespace runtime
@@ -0,0 +1,103 @@
+#include "module.h"
+
+#include "lexer.h"
+#include "parse.h"
+#include "region.h"
+
+#include <sys/stat.h>
+
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+using namespace std;
+
+namespace parse {
+
+namespace {
+bool operator==(const timespec& lhs, const timespec& rhs) {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+string ReadFile(const string& path) {
+    ifstream input(path, ios::binary);
+    if (!input) {
+        throw ParseError("Cannot read module "s + path);
+    }
+    ostringstream text;
+    text << input.rdbuf();
+    return text.str();
+}
+}  // namespace
+
+ModuleCache::ModuleCache(vector<string> search_path)
+: search_path_(move(search_path)) {
+}
+
+shared_ptr<const Module> ModuleCache::Load(const string& name, const ParseOptions& options) {
+    lock_guard guard(mutex_);
+
+    const string path = FindModule(name);
+    struct stat info {};
+    if (stat(path.c_str(), &info) != 0) {
+        throw ParseError("Cannot read module "s + path);
+    }
+
+    Entry& entry = entries_[{path, options.natives}];
+    if (entry.module && entry.mtime == info.st_mtim) {
+        return entry.module;
+    }
+
+    string text = ReadFile(path);
+    const size_t hash = std::hash<string>{}(text);
+    if (entry.module && entry.hash == hash) {
+        entry.mtime = info.st_mtim;
+        return entry.module;
+    }
+
+    if (!loading_.insert(path).second) {
+        throw ParseError("Module "s + name + " imports itself"s);
+    }
+    try {
+        // Модуль переживает программу, которая его импортировала,
+        // поэтому его объекты не должны попасть в регион этой программы
+        runtime::Region::Scope no_region(nullptr);
+
+        auto module = make_shared<Module>();
+        module->name = name;
+        module->path = path;
+        istringstream input(text);
+        Lexer lexer(input);
+        ParseModule(lexer, options, *module);
+
+        // Вложенные импорты добавляют записи в entries_, но элементы std::map
+        // при вставке не перемещаются, и ссылка entry остаётся действительной
+        entry.mtime = info.st_mtim;
+        entry.hash = hash;
+        entry.module = move(module);
+        ++parse_count_;
+        loading_.erase(path);
+        return entry.module;
+    } catch (...) {
+        loading_.erase(path);
+        throw;
+    }
+}
+
+size_t ModuleCache::GetParseCount() const {
+    lock_guard guard(mutex_);
+    return parse_count_;
+}
+
+string ModuleCache::FindModule(const string& name) const {
+    for (const string& dir : search_path_) {
+        string path = dir + "/"s + name + ".my"s;
+        struct stat info {};
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            return path;
+        }
+    }
+    throw ParseError("Module "s + name + " not found"s);
+}
+
+}  // namespace parse
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ParseOptions;
+
+namespace parse {
+
+class Lexer;
+
+// Разобранный модуль Mython. После загрузки не изменяется и может разделяться
+// между несколькими программами и потоками
+struct Module {
+    std::string name;
+    std::string path;
+    // Инструкции верхнего уровня модуля, кроме импортов
+    std::unique_ptr<runtime::Executable> body;
+    // Классы и функции, объявленные в модуле, в порядке объявления
+    std::vector<std::pair<std::string, runtime::ObjectHolder>> classes;
+    std::vector<std::pair<std::string, runtime::ObjectHolder>> functions;
+    // Модули, которые импортирует этот модуль, в порядке импорта
+    std::vector<std::shared_ptr<const Module>> imports;
+};
+
+// Разбирает текст модуля, заполняя body, classes, functions и imports
+void ParseModule(Lexer& lexer, const ParseOptions& options, Module& module);
+
+/*
+ * Кеш разобранных модулей. Модуль name ищется как файл name.my в каталогах
+ * пути поиска по порядку и разбирается один раз за время жизни кеша.
+ * Запись кеша действительна, пока не изменились время модификации файла
+ * или хеш его содержимого: при смене времени модификации файл перечитывается,
+ * но разбирается заново, только если изменилось содержимое.
+ *
+ * Один кеш может разделяться несколькими интерпретаторами и потоками.
+ */
+class ModuleCache {
+public:
+    explicit ModuleCache(std::vector<std::string> search_path);
+
+    // Возвращает модуль name, разбирая его при первом обращении или после изменения файла.
+    // Модуль разбирается с параметрами options. Выбрасывает ParseError, если модуль
+    // не найден, содержит ошибку или импортирует сам себя, прямо или через другие модули
+    std::shared_ptr<const Module> Load(const std::string& name, const ParseOptions& options);
+
+    // Возвращает количество разборов модулей, выполненных кешем
+    [[nodiscard]] size_t GetParseCount() const;
+
+private:
+    struct Entry {
+        timespec mtime{};
+        size_t hash = 0;
+        std::shared_ptr<const Module> module;
+    };
+
+    std::string FindModule(const std::string& name) const;
+
+    std::vector<std::string> search_path_;
+    // Разбор модуля может импортировать другие модули того же кеша в том же потоке
+    mutable std::recursive_mutex mutex_;
+    // Модули разбираются с учётом нативных функций, поэтому реестр входит в ключ
+    std::map<std::pair<std::string, const void*>, Entry> entries_;
+    // Модули, разбираемые в данный момент
+    std::set<std::string> loading_;
+    size_t parse_count_ = 0;
+};
+
+}  // namespace parse
@@ -0,0 +1,148 @@
+#include "native.h"
+
+#include <dlfcn.h>
+
+using namespace std;
+
+namespace runtime {
+
+namespace detail {
+
+void ThrowArgumentTypeError(size_t index, string_view expected) {
+    throw runtime_error("Argument "s + to_string(index + 1) + " of native function must be "s
+                        + string(expected));
+}
+
+void ThrowSelfTypeError(string_view class_name) {
+    throw runtime_error("Native method of class "s + string(class_name) + " called on an object of another type"s);
+}
+
+}  // namespace detail
+
+NativeFunction::NativeFunction(string name, size_t arity, Invoker invoker, shared_ptr<const void> fn)
+: name_(move(name))
+, arity_(arity)
+, invoker_(invoker)
+, fn_(move(fn)) {
+}
+
+ObjectHolder NativeFunction::Call(Object* self, NativeArgs args, Context& context) const {
+    if (arity_ != VARIADIC && args.GetSize() != arity_) {
+        throw runtime_error("Native function "s + name_ + " takes "s + to_string(arity_)
+                            + " arguments, but "s + to_string(args.GetSize()) + " were given"s);
+    }
+    return invoker_(fn_.get(), self, args, context);
+}
+
+const string& NativeFunction::GetName() const {
+    return name_;
+}
+
+size_t NativeFunction::GetArity() const {
+    return arity_;
+}
+
+void NativeFunction::Print(ostream& os, [[maybe_unused]] Context& context) {
+    os << "Native function "sv << name_;
+}
+
+NativeObject::NativeObject(const NativeClass& cls)
+: cls_(cls) {
+}
+
+ObjectHolder NativeObject::Call(const string& method, NativeArgs args, Context& context) {
+    const NativeFunction* function = cls_.GetMethod(method);
+    if (!function) {
+        throw runtime_error("Error in NativeObject::Call: \""s + method + "\" method was not found"s);
+    }
+    return function->Call(this, args, context);
+}
+
+void NativeObject::Print(ostream& os, Context& context) {
+    if (const NativeFunction* str = cls_.GetMethod("__str__"s); str && str->GetArity() == 0) {
+        ObjectHolder result = str->Call(this, {nullptr, 0}, context);
+        if (result) {
+            result->Print(os, context);
+            return;
+        }
+    }
+    os << cls_.GetName() << " object"sv;
+}
+
+const NativeClass& NativeObject::GetClass() const {
+    return cls_;
+}
+
+NativeClass::NativeClass(string name)
+: name_(move(name)) {
+}
+
+ObjectHolder NativeClass::Construct(NativeArgs args, Context& context) {
+    if (!constructor_) {
+        throw runtime_error("Native class "s + name_ + " has no constructor"s);
+    }
+    return constructor_->Call(this, args, context);
+}
+
+const NativeFunction* NativeClass::GetMethod(const string& name) const {
+    auto it = methods_.find(name);
+    return it == methods_.end() ? nullptr : &it->second;
+}
+
+const string& NativeClass::GetName() const {
+    return name_;
+}
+
+void NativeClass::Print(ostream& os, [[maybe_unused]] Context& context) {
+    os << "Class "sv << name_;
+}
+
+NativeClass& NativeRegistry::AddClass(string name) {
+    string key = name;
+    ObjectHolder& cls = classes_[move(key)];
+    cls = ObjectHolder::Own(NativeClass(move(name)));
+    return *cls.TryAs<NativeClass>();
+}
+
+void NativeRegistry::LoadModule(const string& path) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        throw runtime_error("Cannot load native module "s + path + ": "s + dlerror());
+    }
+    using Entry = void (*)(NativeRegistry&);
+    auto entry = reinterpret_cast<Entry>(dlsym(handle, NATIVE_MODULE_ENTRY));
+    if (!entry) {
+        dlclose(handle);
+        throw runtime_error("Native module "s + path + " has no "s + NATIVE_MODULE_ENTRY + " function"s);
+    }
+    // Функции и классы, зарегистрированные до ошибки, ссылаются на код библиотеки,
+    // поэтому реестр возвращается к прежнему состоянию до её выгрузки
+    auto functions = functions_;
+    auto classes = classes_;
+    string error;
+    try {
+        entry(*this);
+        return;
+    } catch (const exception& e) {
+        // Исключение может быть объявлено в библиотеке: оно уничтожается до выгрузки
+        error = e.what();
+    } catch (...) {
+        error = "unknown error"s;
+    }
+    functions_ = move(functions);
+    classes_ = move(classes);
+    dlclose(handle);
+    throw runtime_error("Native module "s + path + " failed to register: "s + error);
+}
+
+ObjectHolder NativeRegistry::FindFunction(const string& name) const {
+    auto it = functions_.find(name);
+    return it == functions_.end() ? ObjectHolder::None() : it->second;
+}
+
+ObjectHolder NativeRegistry::FindClass(const string& name) const {
+    auto it = classes_.find(name);
+    return it == classes_.end() ? ObjectHolder::None() : it->second;
+}
+
+}  // namespace runtime
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace runtime {
+
+// Максимальное количество аргументов нативной функции или метода.
+// Аргументы такого вызова размещаются на стеке вызывающего без выделения памяти
+inline constexpr size_t MAX_NATIVE_ARGS = 8;
+
+// Аргументы вызова нативной функции
+class NativeArgs {
+public:
+    NativeArgs(const ObjectHolder* data, size_t size)
+        : data_(data)
+        , size_(size) {
+    }
+
+    [[nodiscard]] size_t GetSize() const {
+        return size_;
+    }
+
+    const ObjectHolder& operator[](size_t index) const {
+        return data_[index];
+    }
+
+private:
+    const ObjectHolder* data_;
+    size_t size_;
+};
+
+/*
+ * Функция, реализованная на C++. Вызов обращается к функтору через указатель
+ * на типизированную функцию-переходник, поэтому не выделяет память: аргументы
+ * приводятся к типам C++ на месте, строки передаются по ссылке без копирования.
+ * Методы нативных классов получают объект, у которого вызваны, в параметре self
+ */
+class NativeFunction : public Object {
+public:
+    // Функция с таким количеством параметров принимает любое количество аргументов
+    static constexpr size_t VARIADIC = static_cast<size_t>(-1);
+
+    using Invoker = ObjectHolder (*)(const void* fn, Object* self, NativeArgs args, Context& context);
+
+    NativeFunction(std::string name, size_t arity, Invoker invoker, std::shared_ptr<const void> fn);
+
+    // Проверяет количество аргументов и вызывает функцию
+    ObjectHolder Call(Object* self, NativeArgs args, Context& context) const;
+
+    [[nodiscard]] const std::string& GetName() const;
+    [[nodiscard]] size_t GetArity() const;
+
+    // Выводит в os строку "Native function <имя функции>"
+    void Print(std::ostream& os, Context& context) override;
+
+private:
+    std::string name_;
+    size_t arity_;
+    Invoker invoker_;
+    std::shared_ptr<const void> fn_;
+};
+
+class NativeClass;
+
+// Объект нативного класса. Методы объекта реализованы на C++
+class NativeObject : public Object {
+public:
+    explicit NativeObject(const NativeClass& cls);
+
+    /*
+     * Вызывает у объекта метод method. Если у класса нет такого метода,
+     * выбрасывает исключение runtime_error
+     */
+    ObjectHolder Call(const std::string& method, NativeArgs args, Context& context);
+
+    // Выводит в os результат метода __str__, если он есть, либо "<имя класса> object"
+    void Print(std::ostream& os, Context& context) override;
+
+    [[nodiscard]] const NativeClass& GetClass() const;
+
+private:
+    const NativeClass& cls_;
+};
+
+// Объект нативного класса, хранящий значение типа T
+template <typename T>
+class NativeValue : public NativeObject {
+public:
+    NativeValue(const NativeClass& cls, T value)
+        : NativeObject(cls)
+        , value_(std::move(value)) {
+    }
+
+    [[nodiscard]] T& GetValue() {
+        return value_;
+    }
+
+private:
+    T value_;
+};
+
+namespace detail {
+
+// Приведение значений Mython к типам параметров C++ и результатов C++ к значениям Mython
+template <typename T>
+struct NativeType;
+
+[[noreturn]] void ThrowArgumentTypeError(size_t index, std::string_view expected);
+[[noreturn]] void ThrowSelfTypeError(std::string_view class_name);
+
+template <>
+struct NativeType<int> {
+    static int FromObject(const ObjectHolder& object, size_t index) {
+        if (auto number = object.TryAs<Number>()) {
+            return number->GetValue();
+        }
+        ThrowArgumentTypeError(index, "a number");
+    }
+    static ObjectHolder ToObject(int value) {
+        return ObjectHolder::Own(Number(value));
+    }
+};
+
+template <>
+struct NativeType<bool> {
+    static bool FromObject(const ObjectHolder& object, size_t /*index*/) {
+        return IsTrue(object);
+    }
+    static ObjectHolder ToObject(bool value) {
+        return ObjectHolder::Own(Bool(value));
+    }
+};
+
+template <>
+struct NativeType<std::string> {
+    static const std::string& FromObject(const ObjectHolder& object, size_t index) {
+        if (auto str = object.TryAs<String>()) {
+            return str->GetValue();
+        }
+        ThrowArgumentTypeError(index, "a string");
+    }
+    static ObjectHolder ToObject(std::string value) {
+        return ObjectHolder::Own(String(std::move(value)));
+    }
+};
+
+template <>
+struct NativeType<std::string_view> {
+    static std::string_view FromObject(const ObjectHolder& object, size_t index) {
+        return NativeType<std::string>::FromObject(object, index);
+    }
+    static ObjectHolder ToObject(std::string_view value) {
+        return ObjectHolder::Own(String(std::string(value)));
+    }
+};
+
+template <>
+struct NativeType<ObjectHolder> {
+    static const ObjectHolder& FromObject(const ObjectHolder& object, size_t /*index*/) {
+        return object;
+    }
+    static ObjectHolder ToObject(ObjectHolder value) {
+        return value;
+    }
+};
+
+template <typename T>
+using NativeTypeOf = NativeType<std::remove_cv_t<std::remove_reference_t<T>>>;
+
+// Сигнатура функции, указателя на функцию либо функционального объекта
+template <typename Fn>
+struct Signature : Signature<decltype(&Fn::operator())> {};
+
+template <typename R, typename... Args>
+struct Signature<R (*)(Args...)> {
+    using Result = R;
+    using Arguments = std::tuple<Args...>;
+};
+
+template <typename R, typename C, typename... Args>
+struct Signature<R (C::*)(Args...) const> : Signature<R (*)(Args...)> {};
+
+template <typename R, typename C, typename... Args>
+struct Signature<R (C::*)(Args...)> : Signature<R (*)(Args...)> {};
+
+template <typename R, typename Call>
+ObjectHolder ConvertResult(Call&& call) {
+    if constexpr (std::is_void_v<R>) {
+        call();
+        return ObjectHolder::None();
+    } else {
+        return NativeTypeOf<R>::ToObject(call());
+    }
+}
+
+// Вызывает fn, приводя аргументы к типам параметров Args
+template <typename R, typename Fn, typename... Args, size_t... I>
+ObjectHolder InvokeFunction(const Fn& fn, NativeArgs args, std::tuple<Args...>* /*tag*/,
+                            std::index_sequence<I...> /*indices*/) {
+    return ConvertResult<R>([&]() -> R {
+        return fn(NativeTypeOf<Args>::FromObject(args[I], I)...);
+    });
+}
+
+// Метод нативного класса вместе с именем класса для сообщений об ошибках
+template <typename Fn>
+struct NativeMethod {
+    Fn fn;
+    std::string class_name;
+};
+
+// Вызывает метод для значения объекта self, приводя остальные аргументы к типам Args.
+// Если self не хранит значение типа T, выбрасывает исключение runtime_error
+template <typename T, typename Fn, typename R, typename Self, typename... Args, size_t... I>
+ObjectHolder InvokeMethod(const NativeMethod<Fn>& method, Object* self, NativeArgs args,
+                          std::tuple<Self, Args...>* /*tag*/, std::index_sequence<I...> /*indices*/) {
+    auto* object = dynamic_cast<NativeValue<T>*>(self);
+    if (!object) {
+        ThrowSelfTypeError(method.class_name);
+    }
+    T& value = object->GetValue();
+    return ConvertResult<R>([&]() -> R {
+        return method.fn(value, NativeTypeOf<Args>::FromObject(args[I], I)...);
+    });
+}
+
+template <typename Fn>
+inline constexpr bool IS_RAW_NATIVE = std::is_invocable_r_v<ObjectHolder, const Fn&, NativeArgs, Context&>;
+
+}  // namespace detail
+
+/*
+ * Создаёт нативную функцию name из функтора fn.
+ * Параметры и результат fn могут иметь типы int, bool, std::string (в том числе const&),
+ * std::string_view и ObjectHolder, результат также может иметь тип void (значение None).
+ * Функтор с сигнатурой ObjectHolder(NativeArgs, Context&) принимает любое количество аргументов
+ */
+template <typename Fn>
+ObjectHolder MakeNativeFunction(std::string name, Fn fn) {
+    auto stored = std::make_shared<const Fn>(std::move(fn));
+    if constexpr (detail::IS_RAW_NATIVE<Fn>) {
+        auto invoker = [](const void* fn, Object* /*self*/, NativeArgs args, Context& context) {
+            return (*static_cast<const Fn*>(fn))(args, context);
+        };
+        return ObjectHolder::Own(NativeFunction(std::move(name), NativeFunction::VARIADIC, invoker, std::move(stored)));
+    } else {
+        using Signature = detail::Signature<Fn>;
+        using Arguments = typename Signature::Arguments;
+        constexpr size_t arity = std::tuple_size_v<Arguments>;
+        static_assert(arity <= MAX_NATIVE_ARGS, "Too many native function parameters");
+        auto invoker = [](const void* fn, Object* /*self*/, NativeArgs args, Context& /*context*/) {
+            return detail::InvokeFunction<typename Signature::Result>(
+                *static_cast<const Fn*>(fn), args, static_cast<Arguments*>(nullptr),
+                std::make_index_sequence<arity>());
+        };
+        return ObjectHolder::Own(NativeFunction(std::move(name), arity, invoker, std::move(stored)));
+    }
+}
+
+/*
+ * Класс, объекты и методы которого реализованы на C++.
+ * Объекты класса хранят значение C++ типа, создаваемое конструктором класса
+ */
+class NativeClass : public Object {
+public:
+    explicit NativeClass(std::string name);
+
+    /*
+     * Задаёт конструктор класса: функтор, принимающий аргументы вызова <имя класса>(...)
+     * и возвращающий значение типа T, которое будет храниться в объекте
+     */
+    template <typename T, typename Fn>
+    NativeClass& SetConstructor(Fn fn) {
+        using Signature = detail::Signature<Fn>;
+        using Arguments = typename Signature::Arguments;
+        constexpr size_t arity = std::tuple_size_v<Arguments>;
+        static_assert(arity <= MAX_NATIVE_ARGS, "Too many native constructor parameters");
+        static_assert(std::is_same_v<std::decay_t<typename Signature::Result>, T>,
+                      "Native constructor must return the stored value");
+        auto invoker = [](const void* fn, Object* self, NativeArgs args, Context& /*context*/) {
+            const auto& cls = static_cast<const NativeClass&>(*self);
+            const Fn& constructor = *static_cast<const Fn*>(fn);
+            auto construct = [&cls, &constructor](const auto&... values) {
+                return ObjectHolder::Own(NativeValue<T>(cls, constructor(values...)));
+            };
+            return detail::InvokeFunction<ObjectHolder>(construct, args, static_cast<Arguments*>(nullptr),
+                                                        std::make_index_sequence<arity>());
+        };
+        constructor_.emplace(name_, arity, invoker, std::make_shared<const Fn>(std::move(fn)));
+        return *this;
+    }
+
+    /*
+     * Добавляет метод name. Первый параметр функтора - ссылка на значение типа T,
+     * хранящееся в объекте, остальные параметры принимают аргументы вызова.
+     * Вызов метода у объекта, не хранящего значение типа T, выбрасывает исключение runtime_error
+     */
+    template <typename T, typename Fn>
+    NativeClass& AddMethod(std::string name, Fn fn) {
+        using Signature = detail::Signature<Fn>;
+        using Arguments = typename Signature::Arguments;
+        constexpr size_t arity = std::tuple_size_v<Arguments> - 1;
+        static_assert(arity <= MAX_NATIVE_ARGS, "Too many native method parameters");
+        using Method = detail::NativeMethod<Fn>;
+        auto invoker = [](const void* method, Object* self, NativeArgs args, Context& /*context*/) {
+            return detail::InvokeMethod<T, Fn, typename Signature::Result>(
+                *static_cast<const Method*>(method), self, args, static_cast<Arguments*>(nullptr),
+                std::make_index_sequence<arity>());
+        };
+        std::string method_name = name;
+        methods_.insert_or_assign(std::move(method_name),
+                                  NativeFunction(std::move(name), arity, invoker,
+                                                 std::make_shared<const Method>(Method{std::move(fn), name_})));
+        return *this;
+    }
+
+    // Создаёт объект класса. Если конструктор не задан, выбрасывает исключение runtime_error
+    ObjectHolder Construct(NativeArgs args, Context& context);
+
+    // Возвращает указатель на метод name или nullptr, если метод с таким именем отсутствует
+    [[nodiscard]] const NativeFunction* GetMethod(const std::string& name) const;
+
+    [[nodiscard]] const std::string& GetName() const;
+
+    // Выводит в os строку "Class <имя класса>"
+    void Print(std::ostream& os, Context& context) override;
+
+private:
+    std::string name_;
+    std::optional<NativeFunction> constructor_;
+    std::unordered_map<std::string, NativeFunction> methods_;
+};
+
+// Имя функции, через которую модуль, загружаемый из разделяемой библиотеки,
+// регистрирует свои функции и классы. Функция объявляется как
+// extern "C" void mython_register_module(runtime::NativeRegistry& registry)
+inline constexpr const char* NATIVE_MODULE_ENTRY = "mython_register_module";
+
+/*
+ * Реестр нативных функций и классов, доступных программе в глобальной области видимости.
+ * Вызовы зарегистрированных функций и классов связываются с ними при разборе программы
+ */
+class NativeRegistry {
+public:
+    // Регистрирует функцию name (см. MakeNativeFunction)
+    template <typename Fn>
+    NativeRegistry& AddFunction(std::string name, Fn fn) {
+        std::string key = name;
+        functions_.insert_or_assign(std::move(key), MakeNativeFunction(std::move(name), std::move(fn)));
+        return *this;
+    }
+
+    // Регистрирует класс name и возвращает ссылку на него для добавления конструктора и методов
+    NativeClass& AddClass(std::string name);
+
+    /*
+     * Загружает разделяемую библиотеку path и вызывает её функцию NATIVE_MODULE_ENTRY.
+     * Библиотека не выгружается до завершения процесса, поскольку её функции могут
+     * использоваться программами, пережившими реестр. Модуль использует классы
+     * интерпретатора, поэтому интерпретатор должен экспортировать свои символы
+     * (компоноваться с флагом -rdynamic).
+     * Если библиотеку не удалось загрузить, в ней нет функции NATIVE_MODULE_ENTRY либо функция
+     * выбросила исключение, выбрасывает исключение runtime_error. Библиотека при этом выгружается,
+     * а реестр остаётся прежним
+     */
+    void LoadModule(const std::string& path);
+
+    // Возвращает функцию либо класс name или пустой ObjectHolder, если такого имени нет
+    [[nodiscard]] ObjectHolder FindFunction(const std::string& name) const;
+    [[nodiscard]] ObjectHolder FindClass(const std::string& name) const;
+
+private:
+    std::unordered_map<std::string, ObjectHolder> functions_;
+    std::unordered_map<std::string, ObjectHolder> classes_;
+};
+
+}  // namespace runtime
@@ -0,0 +1,226 @@
+#include "output.h"
+
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+OutputMerger::OutputMerger(ostream& output, Order order)
+: output_(output)
+, order_(order)
+, head_(new Node)
+, tail_(head_.load()) {
+    writer_ = thread([this] {
+        RunWriter();
+    });
+}
+
+OutputMerger::~OutputMerger() {
+    {
+        lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    delete tail_;
+}
+
+void OutputMerger::Write(size_t stream, string text) {
+    if (text.empty()) {
+        return;
+    }
+    auto* node = new Node;
+    node->stream = stream;
+    node->text = move(text);
+    Push(node);
+}
+
+void OutputMerger::Close(size_t stream) {
+    auto* node = new Node;
+    node->stream = stream;
+    node->close = true;
+    Push(node);
+}
+
+void OutputMerger::Flush() {
+    const size_t target = pushed_.load();
+    unique_lock lock(mutex_);
+    flushed_.wait(lock, [this, target] {
+        return handled_ >= target;
+    });
+}
+
+size_t OutputMerger::GetWrittenChunks() const {
+    return written_chunks_.load(memory_order_relaxed);
+}
+
+size_t OutputMerger::GetWrittenBytes() const {
+    return written_bytes_.load(memory_order_relaxed);
+}
+
+void OutputMerger::Push(Node* node) {
+    pushed_.fetch_add(1);
+    Node* previous = head_.exchange(node, memory_order_acq_rel);
+    previous->next.store(node, memory_order_release);
+    // Писатель проверяет очередь под мьютексом перед тем, как заснуть,
+    // поэтому будить его нужно, только если он уже спит
+    if (sleeping_.exchange(false)) {
+        lock_guard lock(mutex_);
+        wake_.notify_one();
+    }
+}
+
+OutputMerger::Node* OutputMerger::Pop() {
+    Node* next = tail_->next.load(memory_order_acquire);
+    if (!next) {
+        return nullptr;
+    }
+    delete tail_;
+    tail_ = next;
+    return next;
+}
+
+void OutputMerger::RunWriter() {
+    for (;;) {
+        size_t handled = 0;
+        while (Node* node = Pop()) {
+            Handle(*node);
+            ++handled;
+        }
+        output_.flush();
+
+        unique_lock lock(mutex_);
+        handled_ += handled;
+        flushed_.notify_all();
+        sleeping_ = true;
+        // Узел мог быть добавлен после последней проверки: тогда писатель не засыпает
+        if (tail_->next.load(memory_order_acquire)) {
+            sleeping_ = false;
+            continue;
+        }
+        if (stopping_) {
+            break;
+        }
+        wake_.wait(lock, [this] {
+            return !sleeping_ || stopping_;
+        });
+        sleeping_ = false;
+    }
+
+    // Вывод незакрытых потоков не теряется
+    for (auto& [stream, pending] : pending_) {
+        for (const string& chunk : pending.chunks) {
+            WriteChunk(chunk);
+        }
+    }
+    pending_.clear();
+    output_.flush();
+}
+
+void OutputMerger::Handle(Node& node) {
+    if (order_ == Order::ARRIVAL) {
+        WriteChunk(node.text);
+        return;
+    }
+    if (node.stream != next_stream_) {
+        // Поток ещё не дошёл до вывода: фрагмент ждёт закрытия предыдущих потоков
+        PendingStream& pending = pending_[node.stream];
+        if (node.close) {
+            pending.closed = true;
+        } else {
+            pending.chunks.push_back(move(node.text));
+        }
+        return;
+    }
+    if (!node.close) {
+        WriteChunk(node.text);
+        return;
+    }
+    // Текущий поток закрыт: выводятся накопленные фрагменты следующих потоков
+    for (++next_stream_;; ++next_stream_) {
+        auto it = pending_.find(next_stream_);
+        if (it == pending_.end()) {
+            break;
+        }
+        for (const string& chunk : it->second.chunks) {
+            WriteChunk(chunk);
+        }
+        const bool closed = it->second.closed;
+        pending_.erase(it);
+        if (!closed) {
+            break;
+        }
+    }
+}
+
+void OutputMerger::WriteChunk(const string& text) {
+    output_.write(text.data(), static_cast<streamsize>(text.size()));
+    written_chunks_.fetch_add(1, memory_order_relaxed);
+    written_bytes_.fetch_add(text.size(), memory_order_relaxed);
+}
+
+BufferedContext::BufferedContext(OutputMerger& merger, size_t stream, size_t buffer_size)
+: buffer_(merger, stream, buffer_size)
+, output_(&buffer_)
+, merger_(merger)
+, stream_(stream) {
+}
+
+BufferedContext::~BufferedContext() {
+    buffer_.Drain();
+    merger_.Close(stream_);
+}
+
+ostream& BufferedContext::GetOutputStream() {
+    return output_;
+}
+
+BufferedContext::Buffer::Buffer(OutputMerger& merger, size_t stream, size_t capacity)
+: merger_(merger)
+, stream_(stream)
+, capacity_(capacity) {
+}
+
+void BufferedContext::Buffer::Drain() {
+    merger_.Write(stream_, exchange(data_, string()));
+}
+
+BufferedContext::Buffer::int_type BufferedContext::Buffer::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    data_.push_back(traits_type::to_char_type(ch));
+    MaybeDrain();
+    return ch;
+}
+
+streamsize BufferedContext::Buffer::xsputn(const char* s, streamsize count) {
+    data_.append(s, static_cast<size_t>(count));
+    MaybeDrain();
+    return count;
+}
+
+int BufferedContext::Buffer::sync() {
+    Drain();
+    return 0;
+}
+
+void BufferedContext::Buffer::MaybeDrain() {
+    if (data_.size() < capacity_) {
+        return;
+    }
+    // Фрагмент заканчивается целой строкой, чтобы при выводе по мере поступления
+    // строки разных потоков не перемешивались
+    const size_t line_end = data_.rfind('\n');
+    if (line_end == string::npos) {
+        Drain();
+        return;
+    }
+    string rest = data_.substr(line_end + 1);
+    data_.resize(line_end + 1);
+    Drain();
+    data_ = move(rest);
+}
+
+}  // namespace runtime
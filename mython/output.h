@@ -0,0 +1,148 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace runtime {
+
+/*
+ * Выводит в общий поток output вывод многих интерпретаторов, работающих параллельно.
+ * Вывод каждого интерпретатора - отдельный поток вывода с номером. Фрагменты вывода
+ * передаются через lock-free очередь с многими писателями и одним читателем, а в output
+ * их записывает единственный поток-писатель, поэтому интерпретаторы не блокируют друг друга.
+ *
+ * Порядок фрагментов одного потока вывода сохраняется. При упорядочении STREAM потоки
+ * выводятся целиком по возрастанию номеров, начиная с нуля: вывод следующего потока
+ * накапливается, пока не закрыт предыдущий, и результат не зависит от планирования.
+ * При упорядочении ARRIVAL фрагменты выводятся по мере поступления
+ */
+class OutputMerger {
+public:
+    enum class Order { STREAM, ARRIVAL };
+
+    explicit OutputMerger(std::ostream& output, Order order = Order::STREAM);
+    // Выводит всё переданное, в том числе вывод незакрытых потоков, и останавливает писателя
+    ~OutputMerger();
+
+    OutputMerger(const OutputMerger&) = delete;
+    OutputMerger& operator=(const OutputMerger&) = delete;
+
+    // Передаёт писателю фрагмент вывода потока stream. Может вызываться из любого потока,
+    // но фрагменты одного потока вывода должны передаваться из одного потока
+    void Write(size_t stream, std::string text);
+    // Сообщает, что вывод потока stream завершён
+    void Close(size_t stream);
+
+    // Дожидается, пока писатель обработает всё, что было передано до вызова.
+    // Фрагменты потоков, ожидающих закрытия предыдущих, при этом остаются у писателя
+    void Flush();
+
+    // Возвращает количество фрагментов и байт, записанных в output
+    [[nodiscard]] size_t GetWrittenChunks() const;
+    [[nodiscard]] size_t GetWrittenBytes() const;
+
+private:
+    struct Node {
+        std::atomic<Node*> next = nullptr;
+        size_t stream = 0;
+        std::string text;
+        bool close = false;
+    };
+
+    struct PendingStream {
+        std::vector<std::string> chunks;
+        bool closed = false;
+    };
+
+    void Push(Node* node);
+    // Извлекает фрагмент из очереди. Вызывается только писателем
+    Node* Pop();
+    void RunWriter();
+    void Handle(Node& node);
+    void WriteChunk(const std::string& text);
+
+    std::ostream& output_;
+    const Order order_;
+
+    // Очередь Вьюкова: писатели добавляют узлы в голову, читатель забирает из хвоста.
+    // Хвост - уже прочитанный узел-заглушка
+    std::atomic<Node*> head_;
+    Node* tail_;
+
+    // Поток-писатель засыпает, только когда очередь пуста
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    std::atomic<bool> sleeping_ = false;
+    bool stopping_ = false;
+    std::atomic<size_t> pushed_ = 0;
+    size_t handled_ = 0;
+
+    // Состояние писателя при упорядочении STREAM
+    size_t next_stream_ = 0;
+    std::map<size_t, PendingStream> pending_;
+
+    std::atomic<size_t> written_chunks_ = 0;
+    std::atomic<size_t> written_bytes_ = 0;
+
+    std::thread writer_;
+};
+
+/*
+ * Контекст, выводящий в поток вывода stream объекта OutputMerger. Вывод накапливается
+ * в собственном буфере контекста без блокировок и передаётся писателю фрагментами
+ * по целым строкам, когда буфер заполнен, а также при явном сбросе потока и разрушении
+ * контекста. Контекст используется одним потоком
+ */
+class BufferedContext : public Context {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 16 * 1024;
+
+    BufferedContext(OutputMerger& merger, size_t stream, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    // Передаёт остаток буфера и закрывает поток вывода
+    ~BufferedContext();
+
+    BufferedContext(const BufferedContext&) = delete;
+    BufferedContext& operator=(const BufferedContext&) = delete;
+
+    std::ostream& GetOutputStream() override;
+
+private:
+    class Buffer : public std::streambuf {
+    public:
+        Buffer(OutputMerger& merger, size_t stream, size_t capacity);
+
+        // Передаёт писателю весь накопленный вывод
+        void Drain();
+
+    protected:
+        int_type overflow(int_type ch) override;
+        std::streamsize xsputn(const char* s, std::streamsize count) override;
+        int sync() override;
+
+    private:
+        void MaybeDrain();
+
+        OutputMerger& merger_;
+        const size_t stream_;
+        const size_t capacity_;
+        std::string data_;
+    };
+
+    Buffer buffer_;
+    std::ostream output_;
+    OutputMerger& merger_;
+    const size_t stream_;
+};
+
+}  // namespace runtime
@@ -1,8 +1,16 @@
 #include "parse.h"
 
 #include "lexer.h"
+#include "module.h"
+#include "native.h"
+#include "region.h"
+#include "stack.h"
 #include "statement.h"
 
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
 using namespace std;
 
 namespace TokenType = parse::token_type;
@@ -17,24 +25,142 @@ bool operator!=(const parse::Token& token, char c) {
     return !(token == c);
 }
 
+// Классы и функции программы, видимые при отложенном разборе тел методов.
+// Заполняются после разбора всей программы. Объектами владеет программа,
+// поэтому здесь хранятся указатели
+struct Declarations {
+    struct DeclaredClass {
+        const runtime::Class* cls;
+        // Порядковый номер объявления
+        size_t index;
+    };
+
+    ParseOptions options;
+    unordered_map<string, DeclaredClass> classes;
+    unordered_map<string, runtime::Function*> functions;
+};
+
 class Parser {
 public:
-    explicit Parser(parse::Lexer& lexer)
-        : lexer_(lexer) {
+    // Если module не равен nullptr, разбирается модуль: импорты не попадают
+    // в результат, а записываются в module->imports
+    Parser(parse::Lexer& lexer, const ParseOptions& options, parse::Module* module = nullptr)
+        : lexer_(lexer)
+        , options_(options)
+        , module_(module) {
+        if (options.lazy_method_bodies) {
+            lazy_declarations_ = make_shared<Declarations>();
+            lazy_declarations_->options = options;
+        }
+        if (options.prelude && !module_) {
+            AddImport(options.prelude, nullptr);
+        }
+    }
+
+    // Разбирает отложенное тело метода, видящее объявления declarations.
+    // Из классов тело видит только первые visible_classes, как и при разборе без отложенных тел
+    Parser(parse::Lexer& lexer, const Declarations& declarations, size_t visible_classes)
+        : lexer_(lexer)
+        , options_(declarations.options)
+        , module_(nullptr)
+        , outer_(&declarations)
+        , visible_classes_(visible_classes)
+        , in_method_(true) {
     }
 
     // Program -> eps
     //          | Statement \n Program
+    //          | def FunctionDefinition Program
+    //          | import id \n Program
     unique_ptr<ast::Statement> ParseProgram() {
         auto result = make_unique<ast::Compound>();
-        while (!lexer_.CurrentToken().Is<TokenType::Eof>()) {
-            result->AddStatement(ParseStatement());
+        while (auto statement = ParseTopLevelStatement()) {
+            result->AddStatement(std::move(statement));
         }
-
         return result;
     }
 
+    // Возвращает очередную инструкцию верхнего уровня либо nullptr в конце программы
+    unique_ptr<ast::Statement> ParseTopLevelStatement() {
+        if (lexer_.CurrentToken().Is<TokenType::Eof>()) {
+            // Функция может быть вызвана до своего объявления, поэтому такие вызовы
+            // проверяются в конце
+            for (const auto& [name, arg_count] : function_calls_) {
+                CheckFunctionCall(name, *declared_functions_.at(name).TryAs<runtime::Function>(),
+                                  arg_count);
+            }
+            function_calls_.clear();
+            return nullptr;
+        }
+        if (lexer_.CurrentToken().Is<TokenType::Def>()) {
+            return ParseFunctionDefinition();
+        }
+        if (lexer_.CurrentToken().Is<TokenType::Import>()) {
+            return ParseImport();
+        }
+        return ParseStatement();
+    }
+
+    // Константы разбираемых далее инструкций переживут сами инструкции, если на них сослались
+    // переменные. Нужно, когда инструкции освобождаются сразу после выполнения
+    void ShareConstants() {
+        shared_constants_ = true;
+    }
+
+    // Разбирает модуль, переданный в конструктор
+    void ParseModule() {
+        module_->body = ParseProgram();
+        module_->classes = std::move(defined_classes_);
+        module_->functions = std::move(defined_functions_);
+    }
+
+    // Разбирает текст тела метода, сохранённый ParseMethodBody
+    static unique_ptr<ast::Statement> ParseDeferredBody(const Declarations& declarations,
+                                                        size_t visible_classes, const string& text) {
+        // Метод может впервые выполниться внутри региона, а его тело живёт дольше региона
+        runtime::Region::Scope no_region(nullptr);
+        istringstream input(text);
+        parse::Lexer lexer(input);
+        return Parser{lexer, declarations, visible_classes}.ParseDeferredSuite();
+    }
+
 private:
+    // DeferredSuite -> INDENT (Statement)+ DEDENT
+    unique_ptr<ast::Statement> ParseDeferredSuite() {
+        lexer_.Expect<TokenType::Indent>();
+        lexer_.NextToken();
+
+        auto result = make_unique<ast::Compound>();
+        while (!lexer_.CurrentToken().Is<TokenType::Dedent>()) {
+            result->AddStatement(ParseStatement());
+        }
+        lexer_.ExpectNext<TokenType::Eof>();
+        return result;
+    }
+
+    // Разбирает тело метода или функции. При отложенном разборе сохраняет только его текст
+    unique_ptr<ast::MethodBody> ParseMethodBody() {
+        if (!lazy_declarations_) {
+            in_method_ = true;
+            auto body = ParseSuite();
+            in_method_ = false;
+            return make_unique<ast::MethodBody>(std::move(body));
+        }
+        lexer_.Expect<TokenType::Newline>();
+        string text = lexer_.SkipBlock();
+        if (text.empty()) {
+            throw ParseError("Expected an indented block"s);
+        }
+        lexer_.NextToken();
+        // Тело видит классы, объявленные до него, но не свой класс и не следующие:
+        // без отложенного разбора они к этому моменту ещё не объявлены
+        return make_unique<ast::MethodBody>([declarations = lazy_declarations_,
+                                             visible_classes = lazy_declarations_->classes.size(),
+                                             text = std::move(text)] {
+            return ParseDeferredBody(*declarations, visible_classes, text);
+        });
+    }
+
     // Suite -> NEWLINE INDENT (Statement)+ DEDENT
     unique_ptr<ast::Statement> ParseSuite()  // NOLINT
     {
@@ -63,26 +189,164 @@ private:
             runtime::Method m;
 
             m.name = lexer_.ExpectNext<TokenType::Id>().value;
-            lexer_.ExpectNext<TokenType::Char>('(');
+            m.formal_params = ParseFormalParams();
 
-            if (lexer_.NextToken().Is<TokenType::Id>()) {
-                m.formal_params.push_back(lexer_.Expect<TokenType::Id>().value);
-                while (lexer_.NextToken() == ',') {
-                    m.formal_params.push_back(lexer_.ExpectNext<TokenType::Id>().value);
-                }
+            m.body = ParseMethodBody();
+
+            result.push_back(std::move(m));
+        }
+        return result;
+    }
+
+    // Params -> '(' [id [',' id]*] ')' ':'
+    vector<string> ParseFormalParams() {
+        vector<string> result;
+        lexer_.ExpectNext<TokenType::Char>('(');
+
+        if (lexer_.NextToken().Is<TokenType::Id>()) {
+            result.push_back(lexer_.Expect<TokenType::Id>().value);
+            while (lexer_.NextToken() == ',') {
+                result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
             }
+        }
 
-            lexer_.Expect<TokenType::Char>(')');
-            lexer_.ExpectNext<TokenType::Char>(':');
-            lexer_.NextToken();
+        lexer_.Expect<TokenType::Char>(')');
+        lexer_.ExpectNext<TokenType::Char>(':');
+        lexer_.NextToken();
+        return result;
+    }
 
-            m.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+    // FunctionDefinition -> def id Params Suite
+    unique_ptr<ast::Statement> ParseFunctionDefinition() {
+        string name = lexer_.ExpectNext<TokenType::Id>().value;
+        if (declared_classes_.count(name) != 0) {
+            throw ParseError("Function "s + name + " conflicts with class "s + name);
+        }
+        runtime::ObjectHolder function_h = DeclareFunction(name);
+        auto& function = *function_h.TryAs<runtime::Function>();
+        if (function.IsDefined()) {
+            throw ParseError("Function "s + name + " already exists"s);
+        }
 
-            result.push_back(std::move(m));
+        vector<string> params = ParseFormalParams();
+        // Тело может вызывать саму функцию, поэтому она объявляется до разбора тела
+        function.Define(std::move(params), ParseMethodBody());
+        defined_functions_.emplace_back(name, function_h);
+        return make_unique<ast::FunctionDefinition>(std::move(function_h));
+    }
+
+    // Import -> import id \n
+    unique_ptr<ast::Statement> ParseImport() {
+        if (!options_.modules) {
+            throw ParseError("Modules are not available"s);
+        }
+        string name = lexer_.ExpectNext<TokenType::Id>().value;
+        lexer_.ExpectNext<TokenType::Newline>();
+        lexer_.NextToken();
+
+        auto module = options_.modules->Load(name, options_);
+        if (module_) {
+            module_->imports.push_back(module);
         }
+        auto result = make_unique<ast::Compound>();
+        AddImport(module, result.get());
         return result;
     }
 
+    // Объявляет классы и функции модуля и его зависимостей. В программу, если она задана,
+    // добавляется выполнение каждого модуля, ещё не импортированного ею, после его зависимостей
+    void AddImport(const shared_ptr<const parse::Module>& module, ast::Compound* program) {
+        if (!imported_modules_.insert(module.get()).second) {
+            return;
+        }
+        for (const auto& dependency : module->imports) {
+            AddImport(dependency, program);
+        }
+        for (const auto& [name, cls] : module->classes) {
+            auto [it, inserted] = declared_classes_.emplace(name, cls);
+            if (!inserted && it->second.Get() != cls.Get()) {
+                throw ParseError("Class "s + name + " imported from "s + module->name
+                                 + " already exists"s);
+            }
+            PublishClass(name, cls);
+        }
+        for (const auto& [name, function] : module->functions) {
+            runtime::ObjectHolder& declared = declared_functions_[name];
+            if (declared && declared.Get() != function.Get()) {
+                throw ParseError("Function "s + name + " imported from "s + module->name
+                                 + " already exists"s);
+            }
+            declared = function;
+            PublishFunction(name, function);
+        }
+        if (!module_ && program) {
+            program->AddStatement(make_unique<ast::Import>(module));
+        }
+    }
+
+    // Возвращает функцию name, создавая её, если функция ещё не объявлена
+    runtime::ObjectHolder DeclareFunction(const string& name) {
+        runtime::ObjectHolder& function = declared_functions_[name];
+        if (!function) {
+            function = runtime::ObjectHolder::Own(runtime::Function(name));
+            PublishFunction(name, function);
+        }
+        return function;
+    }
+
+    // Делают объявление верхнего уровня видимым для отложенных тел методов.
+    // Тела могут разбираться до окончания разбора программы, если она выполняется потоково
+    void PublishClass(const string& name, const runtime::ObjectHolder& cls) {
+        if (lazy_declarations_) {
+            const size_t index = lazy_declarations_->classes.size();
+            lazy_declarations_->classes.emplace(
+                name, Declarations::DeclaredClass{cls.TryAs<runtime::Class>(), index});
+        }
+    }
+
+    void PublishFunction(const string& name, const runtime::ObjectHolder& function) {
+        if (lazy_declarations_) {
+            lazy_declarations_->functions.emplace(name, function.TryAs<runtime::Function>());
+        }
+    }
+
+    static void CheckFunctionCall(const string& name, const runtime::Function& function,
+                                  size_t arg_count) {
+        if (!function.IsDefined()) {
+            throw ParseError("Unknown call to "s + name + "()"s);
+        }
+        if (function.GetMethod().formal_params.size() != arg_count) {
+            throw ParseError("Function "s + name + " takes "s
+                             + to_string(function.GetMethod().formal_params.size()) + " arguments"s);
+        }
+    }
+
+    // Связывает вызов функции верхнего уровня name с её объектом
+    unique_ptr<ast::Statement> MakeFunctionCall(const string& name, vector<unique_ptr<ast::Statement>> args) {
+        auto& function = BindFunctionCall(name, args.size());
+        return make_unique<ast::FunctionCall>(function, std::move(args));
+    }
+
+    // Возвращает объект функции верхнего уровня name для вызова с arg_count аргументами
+    runtime::Function& BindFunctionCall(const string& name, size_t arg_count) {
+        if (outer_) {
+            // Программа уже разобрана, поэтому вызов проверяется сразу
+            auto it = outer_->functions.find(name);
+            if (it == outer_->functions.end()) {
+                throw ParseError("Unknown call to "s + name + "()"s);
+            }
+            CheckFunctionCall(name, *it->second, arg_count);
+            return *it->second;
+        }
+        auto& function = *DeclareFunction(name).TryAs<runtime::Function>();
+        if (function.IsDefined()) {
+            CheckFunctionCall(name, function, arg_count);
+        } else {
+            function_calls_.emplace_back(name, arg_count);
+        }
+        return function;
+    }
+
     // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
     unique_ptr<ast::Statement> ParseClassDefinition()  // NOLINT
     {
@@ -96,11 +360,10 @@ private:
             lexer_.ExpectNext<TokenType::Char>(')');
             lexer_.NextToken();
 
-            auto it = declared_classes_.find(name);
-            if (it == declared_classes_.end()) {
+            base_class = FindClass(name);
+            if (!base_class) {
                 throw ParseError("Base class "s + name + " not found for class "s + class_name);
             }
-            base_class = static_cast<const runtime::Class*>(it->second.Get());  // NOLINT
         }
 
         lexer_.Expect<TokenType::Char>(':');
@@ -117,13 +380,29 @@ private:
             runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class)),
         });
 
-        if (!inserted) {
+        if (!inserted || (outer_ && outer_->classes.count(class_name) != 0)) {
             throw ParseError("Class "s + class_name + " already exists"s);
         }
+        defined_classes_.emplace_back(class_name, it->second);
+        PublishClass(class_name, it->second);
 
         return make_unique<ast::ClassDefinition>(it->second);
     }
 
+    // Возвращает объявленный класс name либо nullptr
+    const runtime::Class* FindClass(const string& name) const {
+        if (auto it = declared_classes_.find(name); it != declared_classes_.end()) {
+            return it->second.TryAs<runtime::Class>();
+        }
+        if (outer_) {
+            if (auto it = outer_->classes.find(name);
+                it != outer_->classes.end() && it->second.index < visible_classes_) {
+                return it->second.cls;
+            }
+        }
+        return nullptr;
+    }
+
     vector<string> ParseDottedIds() {
         vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
 
@@ -135,11 +414,15 @@ private:
     }
 
     //  AssgnOrCall -> DottedIds = Expr
+    //               | DottedIds ['[' Test ']']+ = Expr
     //               | DottedIds '(' ExprList ')'
     unique_ptr<ast::Statement> ParseAssignmentOrCall() {
         lexer_.Expect<TokenType::Id>();
 
         vector<string> id_list = ParseDottedIds();
+        if (lexer_.CurrentToken() == '[') {
+            return ParseIndexAssignment(make_unique<ast::VariableValue>(std::move(id_list)));
+        }
         string last_name = id_list.back();
         id_list.pop_back();
 
@@ -155,10 +438,6 @@ private:
         lexer_.Expect<TokenType::Char>('(');
         lexer_.NextToken();
 
-        if (id_list.empty()) {
-            throw ParseError("Mython doesn't support functions, only methods: "s + last_name);
-        }
-
         vector<unique_ptr<ast::Statement>> args;
         if (lexer_.CurrentToken() != ')') {
             args = ParseTestList();
@@ -166,10 +445,33 @@ private:
         lexer_.Expect<TokenType::Char>(')');
         lexer_.NextToken();
 
+        if (id_list.empty()) {
+            if (auto call = MakeNativeCall(last_name, args)) {
+                return call;
+            }
+            return MakeFunctionCall(last_name, std::move(args));
+        }
+
         return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(id_list)),
                                             std::move(last_name), std::move(args));
     }
 
+    // Элементы вложенных списков присваиваются через цепочку индексов: m[i][j] = value
+    unique_ptr<ast::Statement> ParseIndexAssignment(unique_ptr<ast::Statement> object) {
+        for (;;) {
+            lexer_.NextToken();
+            auto index = ParseTest();
+            lexer_.Expect<TokenType::Char>(']');
+            if (lexer_.NextToken() != '[') {
+                lexer_.Expect<TokenType::Char>('=');
+                lexer_.NextToken();
+                return make_unique<ast::IndexAssignment>(std::move(object), std::move(index),
+                                                         ParseTest());
+            }
+            object = make_unique<ast::Index>(std::move(object), std::move(index));
+        }
+    }
+
     // Expr -> Adder ['+'/'-' Adder]*
     unique_ptr<ast::Statement> ParseExpression()  // NOLINT
     {
@@ -204,17 +506,61 @@ private:
         return result;
     }
 
-    // Mult -> '(' Expr ')'
+    // Mult -> '-' Mult
+    //       | Atom ['[' Subscript ']']*
+    unique_ptr<ast::Statement> ParseMult()  // NOLINT
+    {
+        if (lexer_.CurrentToken() == '-') {
+            lexer_.NextToken();
+            return make_unique<ast::Mult>(ParseMult(), MakeConst(runtime::Number(-1)));
+        }
+        auto result = ParseAtom();
+        while (lexer_.CurrentToken() == '[') {
+            result = ParseSubscript(std::move(result));
+        }
+        return result;
+    }
+
+    // Subscript -> Test
+    //            | [Test] ':' [Test]
+    unique_ptr<ast::Statement> ParseSubscript(unique_ptr<ast::Statement> object) {
+        if (lexer_.NextToken() == ']') {
+            throw ParseError("Empty subscript"s);
+        }
+        unique_ptr<ast::Statement> start;
+        if (lexer_.CurrentToken() != ':') {
+            start = ParseTest();
+        }
+        if (lexer_.CurrentToken() == ':') {
+            unique_ptr<ast::Statement> stop;
+            if (lexer_.NextToken() != ']') {
+                stop = ParseTest();
+            }
+            lexer_.Expect<TokenType::Char>(']');
+            lexer_.NextToken();
+            return make_unique<ast::Slice>(std::move(object), std::move(start), std::move(stop));
+        }
+        lexer_.Expect<TokenType::Char>(']');
+        lexer_.NextToken();
+        return make_unique<ast::Index>(std::move(object), std::move(start));
+    }
+
+    // Atom -> '(' Expr ')'
+    //       | '[' [ExprList] ']'
+    //       | '{' [Test ':' Test [',' Test ':' Test]*] '}'
     //       | NUMBER
-    //       | '-' Mult
     //       | STRING
     //       | NONE
     //       | TRUE
     //       | FALSE
     //       | DottedIds '(' ExprList ')'
     //       | DottedIds
-    unique_ptr<ast::Statement> ParseMult()  // NOLINT
+    //       | spawn DottedIds '(' [ExprList] ')'
+    unique_ptr<ast::Statement> ParseAtom()  // NOLINT
     {
+        if (lexer_.CurrentToken().Is<TokenType::Spawn>()) {
+            return ParseSpawn();
+        }
         if (lexer_.CurrentToken() == '(') {
             lexer_.NextToken();
             auto result = ParseTest();
@@ -222,27 +568,50 @@ private:
             lexer_.NextToken();
             return result;
         }
-        if (lexer_.CurrentToken() == '-') {
+        if (lexer_.CurrentToken() == '[') {
+            vector<unique_ptr<ast::Statement>> items;
+            if (lexer_.NextToken() != ']') {
+                items = ParseTestList();
+            }
+            lexer_.Expect<TokenType::Char>(']');
+            lexer_.NextToken();
+            return make_unique<ast::ListLiteral>(std::move(items));
+        }
+        if (lexer_.CurrentToken() == '{') {
+            vector<ast::DictLiteral::Item> items;
+            if (lexer_.NextToken() != '}') {
+                for (;;) {
+                    auto key = ParseTest();
+                    lexer_.Expect<TokenType::Char>(':');
+                    lexer_.NextToken();
+                    items.emplace_back(std::move(key), ParseTest());
+                    if (lexer_.CurrentToken() != ',') {
+                        break;
+                    }
+                    lexer_.NextToken();
+                }
+            }
+            lexer_.Expect<TokenType::Char>('}');
             lexer_.NextToken();
-            return make_unique<ast::Mult>(ParseMult(), make_unique<ast::NumericConst>(-1));
+            return make_unique<ast::DictLiteral>(std::move(items));
         }
         if (const auto* num = lexer_.CurrentToken().TryAs<TokenType::Number>()) {
             int result = num->value;
             lexer_.NextToken();
-            return make_unique<ast::NumericConst>(result);
+            return MakeConst(runtime::Number(result));
         }
         if (const auto* str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
             string result = str->value;
             lexer_.NextToken();
-            return make_unique<ast::StringConst>(std::move(result));
+            return MakeConst(runtime::String(std::move(result)));
         }
         if (lexer_.CurrentToken().Is<TokenType::True>()) {
             lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(true));
+            return MakeConst(runtime::Bool(true));
         }
         if (lexer_.CurrentToken().Is<TokenType::False>()) {
             lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(false));
+            return MakeConst(runtime::Bool(false));
         }
         if (lexer_.CurrentToken().Is<TokenType::None>()) {
             lexer_.NextToken();
@@ -252,6 +621,31 @@ private:
         return ParseDottedIdsInMultExpr();
     }
 
+    // Запуск в пуле потоков метода экземпляра класса либо функции верхнего уровня
+    unique_ptr<ast::Statement> ParseSpawn() {
+        lexer_.NextToken();
+        vector<string> names = ParseDottedIds();
+        lexer_.Expect<TokenType::Char>('(');
+        vector<unique_ptr<ast::Statement>> args;
+        if (lexer_.NextToken() != ')') {
+            args = ParseTestList();
+        }
+        lexer_.Expect<TokenType::Char>(')');
+        lexer_.NextToken();
+
+        auto method_name = names.back();
+        names.pop_back();
+        if (!names.empty()) {
+            return make_unique<ast::Spawn>(make_unique<ast::VariableValue>(std::move(names)),
+                                           std::move(method_name), std::move(args));
+        }
+        if (FindClass(method_name)) {
+            throw ParseError("Only method and function calls can be spawned"s);
+        }
+        auto& function = BindFunctionCall(method_name, args.size());
+        return make_unique<ast::Spawn>(function, std::move(args));
+    }
+
     std::unique_ptr<ast::Statement> ParseDottedIdsInMultExpr() {
         vector<string> names = ParseDottedIds();
 
@@ -272,9 +666,8 @@ private:
                     make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
                     std::move(args));
             }
-            if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
-                return make_unique<ast::NewInstance>(
-                    static_cast<const runtime::Class&>(*it->second), std::move(args));  // NOLINT
+            if (const runtime::Class* cls = FindClass(method_name)) {
+                return make_unique<ast::NewInstance>(*cls, std::move(args));
             }
             if (method_name == "str"sv) {
                 if (args.size() != 1) {
@@ -282,11 +675,52 @@ private:
                 }
                 return make_unique<ast::Stringify>(std::move(args.front()));
             }
-            throw ParseError("Unknown call to "s + method_name + "()"s);
+            if (method_name == "len"sv) {
+                if (args.size() != 1) {
+                    throw ParseError("Function len takes exactly one argument"s);
+                }
+                return make_unique<ast::Length>(std::move(args.front()));
+            }
+            if (method_name == "join"sv) {
+                if (args.size() != 1) {
+                    throw ParseError("Function join takes exactly one argument"s);
+                }
+                return make_unique<ast::Join>(std::move(args.front()));
+            }
+            if (auto call = MakeNativeCall(method_name, args)) {
+                return call;
+            }
+            return MakeFunctionCall(method_name, std::move(args));
         }
         return make_unique<ast::VariableValue>(std::move(names));
     }
 
+    // Возвращает вызов нативной функции либо создание объекта нативного класса name
+    // или nullptr, если такого имени нет среди нативных
+    unique_ptr<ast::Statement> MakeNativeCall(const string& name, vector<unique_ptr<ast::Statement>>& args) {
+        if (!options_.natives) {
+            return nullptr;
+        }
+        auto function = options_.natives->FindFunction(name);
+        auto cls = options_.natives->FindClass(name);
+        if ((function || cls) && args.size() > runtime::MAX_NATIVE_ARGS) {
+            throw ParseError("Native calls take at most "s + to_string(runtime::MAX_NATIVE_ARGS)
+                             + " arguments"s);
+        }
+        if (function) {
+            const size_t arity = function.TryAs<runtime::NativeFunction>()->GetArity();
+            if (arity != runtime::NativeFunction::VARIADIC && arity != args.size()) {
+                throw ParseError("Native function "s + name + " takes "s + to_string(arity)
+                                 + " arguments"s);
+            }
+            return make_unique<ast::NativeCall>(std::move(function), std::move(args));
+        }
+        if (cls) {
+            return make_unique<ast::NewNativeInstance>(std::move(cls), std::move(args));
+        }
+        return nullptr;
+    }
+
     vector<unique_ptr<ast::Statement>> ParseTestList()  // NOLINT
     {
         vector<unique_ptr<ast::Statement>> result;
@@ -323,12 +757,56 @@ private:
                                         std::move(else_body));
     }
 
+    // Loop -> while LogicalExpr: Suite
+    unique_ptr<ast::Statement> ParseWhile()  // NOLINT
+    {
+        lexer_.Expect<TokenType::While>();
+        lexer_.NextToken();
+
+        auto condition = ParseTest();
+
+        lexer_.Expect<TokenType::Char>(':');
+        lexer_.NextToken();
+
+        return make_unique<ast::While>(std::move(condition), ParseSuite());
+    }
+
+    // Loop -> for Id in range '(' Expr [, Expr [, Expr]] ')': Suite
+    unique_ptr<ast::Statement> ParseFor()  // NOLINT
+    {
+        lexer_.Expect<TokenType::For>();
+        string var = lexer_.ExpectNext<TokenType::Id>().value;
+        lexer_.ExpectNext<TokenType::In>();
+        lexer_.ExpectNext<TokenType::Id>("range"s);
+        lexer_.ExpectNext<TokenType::Char>('(');
+        lexer_.NextToken();
+
+        vector<unique_ptr<ast::Statement>> args;
+        if (lexer_.CurrentToken() != ')') {
+            args = ParseTestList();
+        }
+        if (args.empty() || args.size() > 3) {
+            throw ParseError("Function range takes from one to three arguments"s);
+        }
+        lexer_.Expect<TokenType::Char>(')');
+        lexer_.ExpectNext<TokenType::Char>(':');
+        lexer_.NextToken();
+
+        if (args.size() == 1) {
+            args.insert(args.begin(), MakeConst(runtime::Number(0)));
+        }
+        unique_ptr<ast::Statement> step = args.size() == 3 ? std::move(args[2]) : nullptr;
+        return make_unique<ast::ForRange>(std::move(var), std::move(args[0]), std::move(args[1]),
+                                          std::move(step), ParseSuite());
+    }
+
     // LogicalExpr -> AndTest [OR AndTest]
     // AndTest -> NotTest [AND NotTest]
     // NotTest -> [NOT] NotTest
     //          | Comparison
     unique_ptr<ast::Statement> ParseTest()  // NOLINT
     {
+        runtime::CheckStack();
         auto result = ParseAndTest();
         while (lexer_.CurrentToken().Is<TokenType::Or>()) {
             lexer_.NextToken();
@@ -357,12 +835,25 @@ private:
     }
 
     // Comparison -> Expr [COMP_OP Expr]
+    //             | Expr ['not'] 'in' Expr
     unique_ptr<ast::Statement> ParseComparison()  // NOLINT
     {
         auto result = ParseExpression();
 
         const auto tok = lexer_.CurrentToken();
 
+        if (tok.Is<TokenType::In>()) {
+            lexer_.NextToken();
+            return make_unique<ast::Comparison>(runtime::Contains, std::move(result),
+                                                ParseExpression());
+        }
+        if (tok.Is<TokenType::Not>()) {
+            lexer_.ExpectNext<TokenType::In>();
+            lexer_.NextToken();
+            return make_unique<ast::Comparison>(runtime::NotContains, std::move(result),
+                                                ParseExpression());
+        }
+
         if (tok == '<') {
             lexer_.NextToken();
             return make_unique<ast::Comparison>(runtime::Less, std::move(result),
@@ -399,6 +890,7 @@ private:
     // Statement -> SimpleStatement Newline
     //           | class ClassDefinition
     //           | if Condition
+    //           | Loop
     unique_ptr<ast::Statement> ParseStatement()  // NOLINT
     {
         const auto& tok = lexer_.CurrentToken();
@@ -410,6 +902,18 @@ private:
         if (tok.Is<TokenType::If>()) {
             return ParseCondition();
         }
+        if (tok.Is<TokenType::While>()) {
+            return ParseWhile();
+        }
+        if (tok.Is<TokenType::For>()) {
+            return ParseFor();
+        }
+        if (tok.Is<TokenType::Def>()) {
+            throw ParseError("Functions can only be defined at the top level"s);
+        }
+        if (tok.Is<TokenType::Import>()) {
+            throw ParseError("Modules can only be imported at the top level"s);
+        }
         auto result = ParseSimpleStatement();
         lexer_.Expect<TokenType::Newline>();
         lexer_.NextToken();
@@ -418,11 +922,31 @@ private:
 
     // StatementBody -> return Expression
     //               | print ExpressionList
+    //               | del DottedIds ['[' Test ']']+
     //               | AssignmentOrCall
     unique_ptr<ast::Statement> ParseSimpleStatement() {
         const auto& tok = lexer_.CurrentToken();
 
+        if (tok.Is<TokenType::Del>()) {
+            lexer_.ExpectNext<TokenType::Id>();
+            unique_ptr<ast::Statement> object = make_unique<ast::VariableValue>(ParseDottedIds());
+            lexer_.Expect<TokenType::Char>('[');
+            for (;;) {
+                lexer_.NextToken();
+                auto index = ParseTest();
+                lexer_.Expect<TokenType::Char>(']');
+                if (lexer_.NextToken() != '[') {
+                    return make_unique<ast::DeleteItem>(std::move(object), std::move(index));
+                }
+                object = make_unique<ast::Index>(std::move(object), std::move(index));
+            }
+        }
+
         if (tok.Is<TokenType::Return>()) {
+            // Возврат передаётся телу метода (см. ast::Return), поэтому вне метода его нет
+            if (!in_method_) {
+                throw ParseError("'return' outside of a method"s);
+            }
             lexer_.NextToken();
             return make_unique<ast::Return>(ParseTest());
         }
@@ -437,12 +961,69 @@ private:
         return ParseAssignmentOrCall();
     }
 
+    template <typename T>
+    unique_ptr<ast::Statement> MakeConst(T value) const {
+        if (shared_constants_) {
+            return make_unique<ast::SharedValueStatement<T>>(std::move(value));
+        }
+        return make_unique<ast::ValueStatement<T>>(std::move(value));
+    }
+
     parse::Lexer& lexer_;
+    const ParseOptions& options_;
+    parse::Module* module_;
+    // Объявления, которые увидят отложенные тела методов этой программы
+    shared_ptr<Declarations> lazy_declarations_;
+    // Объявления программы, если разбирается отложенное тело метода
+    const Declarations* outer_ = nullptr;
+    // Количество классов outer_, видимых отложенному телу
+    size_t visible_classes_ = 0;
+    bool shared_constants_ = false;
+    // Разбирается тело метода или функции
+    bool in_method_ = false;
     runtime::Closure declared_classes_;
+    runtime::Closure declared_functions_;
+    // Имена функций, вызванных до их объявления, и количество аргументов вызова
+    vector<pair<string, size_t>> function_calls_;
+    // Классы и функции, объявленные в разбираемом тексте, а не импортированные
+    vector<pair<string, runtime::ObjectHolder>> defined_classes_;
+    vector<pair<string, runtime::ObjectHolder>> defined_functions_;
+    unordered_set<const parse::Module*> imported_modules_;
 };
 
 }  // namespace
 
-unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{lexer}.ParseProgram();
+namespace parse {
+void ParseModule(Lexer& lexer, const ParseOptions& options, Module& module) {
+    Parser{lexer, options, &module}.ParseModule();
+}
+}  // namespace parse
+
+unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, const ParseOptions& options) {
+    return Parser{lexer, options}.ParseProgram();
+}
+
+class ProgramStream::Impl {
+public:
+    Impl(parse::Lexer& lexer, const ParseOptions& options)
+        : options(options)
+        , parser(lexer, this->options) {
+        // Инструкция освобождается после выполнения, а глобальные переменные ссылаются
+        // на её константы
+        parser.ShareConstants();
+    }
+
+    // Парсер хранит ссылку на параметры, поэтому они копируются на время разбора
+    ParseOptions options;
+    Parser parser;
+};
+
+ProgramStream::ProgramStream(parse::Lexer& lexer, const ParseOptions& options)
+: impl_(make_unique<Impl>(lexer, options)) {
+}
+
+ProgramStream::~ProgramStream() = default;
+
+unique_ptr<runtime::Executable> ProgramStream::Next() {
+    return impl_->parser.ParseTopLevelStatement();
 }
@@ -5,14 +5,53 @@
 
 namespace parse {
 class Lexer;
+class ModuleCache;
+struct Module;
 }
 
 namespace runtime {
 class Executable;
+class NativeRegistry;
 }
 
 struct ParseError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
+// Параметры разбора программы
+struct ParseOptions {
+    // Нативные функции и классы, вызовы которых связываются при разборе.
+    // Реестр должен существовать до окончания разбора
+    const runtime::NativeRegistry* natives = nullptr;
+    // Кеш, из которого загружаются импортируемые модули. Без него import недоступен
+    parse::ModuleCache* modules = nullptr;
+    // Разбирать тела методов и функций при первом вызове, а не при загрузке программы.
+    // Ошибки в теле обнаруживаются при первом вызове и выбрасываются как ParseError.
+    // Реестр natives в этом режиме должен существовать, пока существует программа
+    bool lazy_method_bodies = false;
+    // Модуль, классы и функции которого видны программе, как если бы она его импортировала.
+    // Сам модуль программа не выполняет: например, его глобальные переменные восстановлены из снимка
+    std::shared_ptr<const parse::Module> prelude;
+};
+
+std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, const ParseOptions& options = {});
+
+// Разбирает программу по одной инструкции верхнего уровня. Каждую инструкцию можно выполнить
+// сразу после разбора и освободить после выполнения, поэтому в памяти одновременно находится
+// только одна инструкция. Объявленные классы и функции живут, пока жив ProgramStream.
+// Константы инструкции живут, пока на них ссылаются переменные, и после освобождения инструкции.
+// Функция, вызванная инструкцией верхнего уровня до своего объявления, к моменту
+// выполнения вызова ещё не определена, и вызов выбрасывает исключение
+class ProgramStream {
+public:
+    explicit ProgramStream(parse::Lexer& lexer, const ParseOptions& options = {});
+    ~ProgramStream();
+
+    // Возвращает очередную инструкцию верхнего уровня либо nullptr, если программа закончилась.
+    // В конце программы проверяет вызовы функций, объявленных после вызова
+    std::unique_ptr<runtime::Executable> Next();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
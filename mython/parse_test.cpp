@@ -1,17 +1,32 @@
+#include "execution_limits.h"
 #include "lexer.h"
+#include "module.h"
+#include "native.h"
 #include "parse.h"
+#include "region.h"
+#include "stack.h"
 #include "statement.h"
 
 #include <test_runner.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
 using namespace std;
 
 namespace parse {
 
-unique_ptr<ast::Statement> ParseProgramFromString(const string& program) {
+unique_ptr<ast::Statement> ParseProgramFromString(const string& program,
+                                                  const ParseOptions& options = {}) {
     istringstream is(program);
     parse::Lexer lexer(is);
-    return ParseProgram(lexer);
+    return ParseProgram(lexer, options);
 }
 
 void TestSimpleProgram() {
@@ -245,6 +260,811 @@ print r, c, t1, t2
                  "Rect(10x20) Circle(52) Triangle(3, 4, 5) Wrong triangle\n"s);
 }
 
+void TestTailCalls() {
+    const string program = R"(
+class Counter:
+  def count(n, acc):
+    if n == 0:
+      return acc
+    return self.count(n - 1, acc + 1)
+
+class Even:
+  def check(n, odd):
+    if n == 0:
+      return True
+    return odd.check(n - 1, self)
+
+class Odd:
+  def check(n, even):
+    if n == 0:
+      return False
+    return even.check(n - 1, self)
+
+counter = Counter()
+print counter.count(50000, 0)
+e = Even()
+print e.check(50001, Odd()), e.check(50000, Odd())
+)"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "50000\nFalse True\n"s);
+
+    // Возврат передаётся телу метода, поэтому вне методов и функций return запрещён
+    ASSERT_THROWS(ParseProgramFromString("x = 1\nreturn x\n"s), ParseError);
+}
+
+// Долгий тест: запускается ключом --slow-tests
+void TestDeepTailCalls() {
+    const string program = R"(
+class Counter:
+  def count(n, acc):
+    if n == 0:
+      return acc
+    return self.count(n - 1, acc + 1)
+
+counter = Counter()
+print counter.count(10000000, 0)
+)"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "10000000\n"s);
+}
+
+void TestExecutionStack() {
+    const string program = R"(
+class Sum:
+  def calc(n):
+    if n == 0:
+      return 0
+    result = self.calc(n - 1)
+    return result + 1
+
+s = Sum()
+print s.calc(depth)
+)"s;
+    auto tree = ParseProgramFromString(program);
+
+    auto run = [&tree](int depth) {
+        runtime::DummyContext context;
+        runtime::Closure closure{{"depth"s, runtime::ObjectHolder::Own(runtime::Number(depth))}};
+        tree->Execute(closure, context);
+        return context.output.str();
+    };
+
+    // Глубина рекурсии, недостижимая на стеке потока по умолчанию
+    string output;
+    runtime::ExecutionStack large_stack(1024 * 1024 * 1024);
+    large_stack.Run([&] {
+        output = run(30000);
+    });
+    ASSERT_EQUAL(output, "30000\n"s);
+
+    runtime::ExecutionStack small_stack(1024 * 1024);
+    ASSERT_THROWS(small_stack.Run([&] {
+        run(30000);
+    }),
+                  runtime::StackOverflowError);
+    // После переполнения стек снова пригоден для работы
+    small_stack.Run([&] {
+        output = run(10);
+    });
+    ASSERT_EQUAL(output, "10\n"s);
+
+    // Стек переключается в том же потоке, поэтому ограничения и регион потока продолжают действовать
+    runtime::Region region;
+    runtime::Region::Scope region_scope(region);
+    runtime::LimitScope limits({100, {}});
+    ASSERT_THROWS(small_stack.Run([&] {
+        ASSERT(runtime::Region::Current() == &region);
+        run(1000);
+    }),
+                  runtime::FuelExhaustedError);
+}
+
+void TestLoops() {
+    const string program = R"(
+class Math:
+  def first_square_above(limit):
+    for i in range(limit):
+      if i * i > limit:
+        return i
+    return None
+
+i = 0
+total = 0
+while i < 5:
+  i = i + 1
+  total = total + i
+print i, total
+
+evens = 0
+for j in range(0, 1000, 2):
+  evens = evens + 1
+print evens, j
+
+for k in range(3, 0, -1):
+  print k
+for k in range(3, 3):
+  print k
+
+m = Math()
+print m.first_square_above(50)
+
+saved = []
+for n in range(4):
+  if n == 1:
+    kept = n
+  if n > 1:
+    saved.append(n)
+print saved, kept, n
+)"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    // Значения счётчика, сохранённые телом цикла, не меняются на следующих итерациях
+    ASSERT_EQUAL(context.output.str(), "5 15\n500 998\n3\n2\n1\n8\n[2, 3] 1 3\n"s);
+
+    ASSERT_THROWS(ParseProgramFromString("for i in range():\n  print i\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("for i in range(1, 2, 3, 4):\n  print i\n"s),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramFromString("for i in range(0, 1, 0):\n  print i\n"s)
+                      ->Execute(closure, context),
+                  std::runtime_error);
+}
+
+void TestLists() {
+    const string program = R"(
+def shrink(items):
+  items.pop()
+  return 10
+
+class Stack:
+  def __init__():
+    self.items = []
+  def push(value):
+    self.items.append(value)
+  def pop():
+    return self.items.pop()
+
+squares = []
+for i in range(5):
+  squares.append(i * i)
+print squares, len(squares), squares[1], squares[-1]
+print squares[1:3], squares[:2], squares[3:], squares[-10:10]
+
+squares[0] = 'zero'
+grid = [[1, 2], [3, 4]]
+grid[1][0] = grid[0][1] + 10
+print squares[0], grid, len(grid[1])
+
+s = Stack()
+s.push(1)
+s.push(2)
+print s.pop(), s.items, [1, [2]] == [1, [2]], [1] != [1, 2]
+if []:
+  print 'empty'
+if s.items:
+  print 'not empty'
+print 'mython'[1:3], 'mython'[-1]
+shorter = [1, 2, 3, 4]
+print shorter[0:shrink(shorter)]
+)"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(),
+                 "[0, 1, 4, 9, 16] 5 1 16\n"
+                 "[1, 4] [0, 1] [9, 16] [0, 1, 4, 9, 16]\n"
+                 "zero [[1, 2], [12, 4]] 2\n"
+                 "2 [1] True True\n"
+                 "not empty\n"
+                 "yt n\n"
+                 "[1, 2, 3]\n"s);
+
+    ASSERT_THROWS(ParseProgramFromString("x = [1, 2]\nprint x[]\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("x = [1, 2]\nprint x[2]\n"s)->Execute(closure, context),
+                  std::runtime_error);
+    ASSERT_THROWS(ParseProgramFromString("x = []\nx.pop()\n"s)->Execute(closure, context),
+                  std::runtime_error);
+}
+
+void TestDicts() {
+    const string program = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+  def __hash__():
+    return self.x * 31 + self.y
+  def __eq__(other):
+    return self.x == other.x and self.y == other.y
+
+ages = {'ann': 30, 'bob': 25}
+ages['eve'] = 41
+ages['bob'] = ages['bob'] + 1
+print ages, len(ages), 'bob' in ages, 'joe' in ages, 'joe' not in ages
+del ages['ann']
+print ages, ages.get('ann'), ages.get('ann', 0), ages.keys()
+
+visits = {}
+for i in range(6):
+  p = Point(i / 2, 1)
+  visits[p] = visits.get(p, 0) + 1
+print len(visits), visits[Point(2, 1)], {1: [2]} == {1: [2]}, 'th' in 'mython', 2 in [1, 2]
+if {}:
+  print 'empty'
+)"s;
+
+    runtime::DummyContext context;
+
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(),
+                 "{ann: 30, bob: 26, eve: 41} 3 True False True\n"
+                 "{bob: 26, eve: 41} None 0 [bob, eve]\n"
+                 "3 2 True True True\n"s);
+
+    // Метод __eq__ ключа перестраивает словарь посреди поиска
+    auto mutating = ParseProgramFromString(R"(
+class Key:
+  def __init__(name, target):
+    self.name = name
+    self.target = target
+    self.grown = False
+  def __hash__():
+    return 1
+  def __eq__(other):
+    if not self.grown:
+      self.grown = True
+      for i in range(100):
+        self.target[i + 100] = i
+    return self.name == other.name
+
+d = {}
+d[Key('a', d)] = 'first'
+print d[Key('a', d)], len(d)
+)"s);
+    runtime::DummyContext mutating_context;
+    runtime::Closure mutating_closure;
+    mutating->Execute(mutating_closure, mutating_context);
+    ASSERT_EQUAL(mutating_context.output.str(), "first 101\n"s);
+    // Словарь и ключи ссылаются друг на друга
+    mutating_closure.at("d"s).TryAs<runtime::Dict>()->ClearReferences();
+
+    ASSERT_THROWS(ParseProgramFromString("d = {1: 2}\ndel d[3]\n"s)->Execute(closure, context),
+                  std::runtime_error);
+    ASSERT_THROWS(ParseProgramFromString("d = {}\nprint d['x']\n"s)->Execute(closure, context),
+                  std::runtime_error);
+}
+
+void TestFunctions() {
+    const string program = R"(
+def fact(n):
+  if n < 2:
+    return 1
+  return n * fact(n - 1)
+
+def count_down(n, acc):
+  if n == 0:
+    return acc
+  return count_down(n - 1, acc + 1)
+
+def is_even(n):
+  if n == 0:
+    return True
+  return is_odd(n - 1)
+
+class Doubler:
+  def apply(x):
+    return double(x)
+
+def is_odd(n):
+  if n == 0:
+    return False
+  return is_even(n - 1)
+
+def double(x):
+  return x * 2
+
+def greet(name):
+  print 'hello,', name
+
+greet('world')
+d = Doubler()
+print fact(6), count_down(20000, 0), is_even(7), d.apply(21), double
+)"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program)->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "hello, world\n720 20000 False 42 Function double\n"s);
+
+    ASSERT_THROWS(ParseProgramFromString("def f(x):\n  return x\nprint f()\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("print g(1)\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("def f():\n  return 1\ndef f():\n  return 2\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("if True:\n  def f():\n    return 1\n"s), ParseError);
+}
+
+void TestLazyMethodBodies() {
+    const string program = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+  def __str__():
+    return str(self.x) + ':' + str(self.y)
+
+class Counter:
+  def __init__():
+    self.n = 0
+
+  # комментарий внутри класса
+  def add(k):
+
+    # пустые строки и комментарии внутри тела
+    for i in range(k):
+      if i / 2 * 2 == i:
+        self.n = self.n + 1
+    return Point(self.n, twice(self.n))
+
+  def broken():
+    return self.n[]
+
+def twice(x):
+  if x == 0:
+    return 0
+  return 2 + twice(x - 1)
+
+c = Counter()
+print c.add(5)
+print c.add(2)
+)"s;
+
+    ParseOptions options;
+    options.lazy_method_bodies = true;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program, options)->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "3:6\n4:8\n"s);
+
+    // Ошибка в теле обнаруживается при первом вызове
+    ASSERT_THROWS(ParseProgramFromString(program + "c.broken()\n"s, options)->Execute(closure, context),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramFromString(program + "c.broken()\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("def f():\n  return g()\nf()\n"s, options)
+                      ->Execute(closure, context),
+                  ParseError);
+
+    // Отложенное тело видит те же классы, что и при разборе сразу:
+    // объявленные до его класса, но не сам класс и не последующие
+    for (const string& body : {"B()"s, "A()"s}) {
+        const string forward = "class A:\n  def make():\n    return "s + body
+                               + "\n\nclass B:\n  def f():\n    return 1\n\na = A()\na.make()\n"s;
+        ASSERT_THROWS(ParseProgramFromString(forward), ParseError);
+        ASSERT_THROWS(ParseProgramFromString(forward, options)->Execute(closure, context), ParseError);
+    }
+}
+
+void TestConcurrentExecution() {
+    const string program = R"(
+class Node:
+  def __init__(value, next):
+    self.value = value
+    self.next = next
+
+  def sum(k):
+    if k == 1:
+      return self.value
+    return self.value + self.next.sum(k - 1)
+
+def build(n, acc):
+  if n == 0:
+    return acc
+  return build(n - 1, Node(n, acc))
+
+total = 0
+for i in range(10):
+  items = {'head': build(20, None), 'tail': [i, 'x']}
+  head = items['head']
+  total = total + head.sum(20) + items['tail'][0]
+print total, str(total) + '!'
+)"s;
+    // Тест выполняется при каждом запуске, поэтому потоков и повторов немного
+    constexpr size_t THREAD_COUNT = 4;
+    constexpr int RUN_COUNT = 2;
+
+    for (bool lazy : {false, true}) {
+        ParseOptions options;
+        options.lazy_method_bodies = lazy;
+        // Одно дерево программы выполняется всеми потоками, у каждого свои глобальные переменные
+        const auto tree = ParseProgramFromString(program, options);
+
+        vector<string> outputs(THREAD_COUNT);
+        vector<thread> threads;
+        for (size_t i = 0; i < THREAD_COUNT; ++i) {
+            threads.emplace_back([&tree, &output = outputs[i]] {
+                for (int run = 0; run < RUN_COUNT; ++run) {
+                    runtime::DummyContext context;
+                    runtime::Closure closure;
+                    tree->Execute(closure, context);
+                    output += context.output.str();
+                }
+            });
+        }
+        for (thread& t : threads) {
+            t.join();
+        }
+
+        string expected;
+        for (int run = 0; run < RUN_COUNT; ++run) {
+            expected += "2145 2145!\n"s;
+        }
+        for (const string& output : outputs) {
+            ASSERT_EQUAL(output, expected);
+        }
+    }
+}
+
+void TestSpawn() {
+    const string program = R"(
+class Walker:
+  def __init__(start):
+    self.pos = start
+    self.path = []
+
+  def walk(steps):
+    for i in range(steps):
+      self.pos = self.pos + i
+      self.path.append(self.pos)
+    print 'walked', steps
+    return self
+
+  def fib(n):
+    if n < 2:
+      return n
+    a = spawn self.fib(n - 1)
+    b = self.fib(n - 2)
+    return join(a) + b
+
+def mark(items, same):
+  items.append('x')
+  return len(same)
+
+w = Walker(10)
+futures = []
+for k in range(1, 5):
+  futures.append(spawn w.walk(k))
+total = 0
+for k in range(4):
+  f = futures[k]
+  result = join(f)
+  total = total + result.pos
+shared = [1]
+f = spawn mark(shared, shared)
+fib = spawn w.fib(12)
+print total, w.pos, len(w.path), join(f), len(shared), join(fib), f
+)"s;
+
+    for (bool lazy : {false, true}) {
+        ParseOptions options;
+        options.lazy_method_bodies = lazy;
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ParseProgramFromString(program, options)->Execute(closure, context);
+
+        // Вывод задач появляется в порядке join, изменения копий self не видны вызывающему,
+        // а общие ссылки между аргументами сохраняются при копировании
+        ASSERT_EQUAL(context.output.str(),
+                     "walked 1\nwalked 2\nwalked 3\nwalked 4\n50 10 0 2 1 144 <future>\n"s);
+    }
+
+    // Исключение задачи пробрасывается из join после вывода, сделанного задачей
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    auto failing = ParseProgramFromString(R"(
+class Broken:
+  def run():
+    print 'started'
+    return self.missing
+
+  def take(x):
+    return x
+
+b = Broken()
+f = spawn b.run()
+print 'before'
+x = join(f)
+)"s);
+    ASSERT_THROWS(failing->Execute(closure, context), std::runtime_error);
+    ASSERT_EQUAL(context.output.str(), "before\nstarted\n"s);
+    // Future нельзя передать другой задаче
+    auto pass_future = ParseProgramFromString(
+        "class A:\n  def f(x):\n    return x\na = A()\nf = spawn a.f(1)\ng = spawn a.f(f)\n"s);
+    ASSERT_THROWS(pass_future->Execute(closure, context), std::runtime_error);
+
+    ASSERT_THROWS(ParseProgramFromString("class A:\n  def f():\n    return 1\nx = spawn A()\n"s),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramFromString("x = join()\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("x = spawn g(1)\n"s), ParseError);
+}
+
+void WriteModule(const string& dir, const string& name, const string& text) {
+    ofstream(dir + "/"s + name + ".my"s) << text;
+    // Время модификации меняется явно: запись в пределах одного тика часов его не меняет
+    const string path = dir + "/"s + name + ".my"s;
+    struct stat info {};
+    stat(path.c_str(), &info);
+    timespec times[2] = {info.st_atim, info.st_mtim};
+    ++times[1].tv_sec;
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+void TestImport() {
+    char dir_template[] = "/tmp/mython_modules_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+
+    WriteModule(dir, "shapes"s, R"(
+import util
+
+class Rect:
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def area():
+    return scale(self.w * self.h)
+
+print 'shapes loaded'
+)"s);
+    WriteModule(dir, "util"s, R"(
+def scale(x):
+  return x * factor()
+
+def factor():
+  return 10
+
+hidden = 1
+)"s);
+    WriteModule(dir, "loop_a"s, "import loop_b\n"s);
+    WriteModule(dir, "loop_b"s, "import loop_a\n"s);
+
+    ModuleCache cache({"/nonexistent"s, dir});
+    ParseOptions options;
+    options.modules = &cache;
+
+    const string program = R"(
+import shapes
+import util
+r = Rect(2, 3)
+print r.area(), scale(1)
+print hidden
+)"s;
+    {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ASSERT_THROWS(ParseProgramFromString(program, options)->Execute(closure, context),
+                      runtime_error);
+        // Переменные модуля не видны программе
+        ASSERT_EQUAL(context.output.str(), "shapes loaded\n60 10\n"s);
+        ASSERT_EQUAL(cache.GetParseCount(), 2U);
+    }
+    {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ParseProgramFromString("import shapes\nr = Rect(1, 1)\nprint r.area(), scale\n"s, options)
+            ->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "shapes loaded\n10 Function scale\n"s);
+        ASSERT_EQUAL(cache.GetParseCount(), 2U);
+    }
+
+    // Файл с прежним содержимым не разбирается заново, с новым - разбирается
+    WriteModule(dir, "util"s, R"(
+def scale(x):
+  return x * factor()
+
+def factor():
+  return 10
+
+hidden = 1
+)"s);
+    ParseProgramFromString("import util\n"s, options);
+    ASSERT_EQUAL(cache.GetParseCount(), 2U);
+    WriteModule(dir, "util"s, "def scale(x):\n  return x\n"s);
+    {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        ParseProgramFromString("import util\nprint scale(7)\n"s, options)->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "7\n"s);
+        ASSERT_EQUAL(cache.GetParseCount(), 3U);
+    }
+
+    ASSERT_THROWS(ParseProgramFromString("import loop_a\n"s, options), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("import missing\n"s, options), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("import util\ndef scale(x):\n  return x\n"s, options),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramFromString("if True:\n  import util\n"s, options), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("import util\n"s), ParseError);
+
+    for (const char* name : {"shapes", "util", "loop_a", "loop_b"}) {
+        remove((dir + "/"s + name + ".my"s).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+struct Accumulator {
+    int total = 0;
+    int count = 0;
+};
+
+int Gcd(int a, int b) {
+    return b == 0 ? a : Gcd(b, a % b);
+}
+
+void TestNativeFunctions() {
+    runtime::NativeRegistry natives;
+    natives.AddFunction("gcd"s, Gcd);
+    natives.AddFunction("shout"s, [](string_view text, int times) {
+        string result;
+        for (int i = 0; i < times; ++i) {
+            result += text;
+        }
+        return result + "!"s;
+    });
+    vector<string> log;
+    natives.AddFunction("log"s, [&log](const string& message) {
+        log.push_back(message);
+    });
+    natives.AddFunction("count"s, [](runtime::NativeArgs args, runtime::Context& /*context*/) {
+        return runtime::ObjectHolder::Own(runtime::Number(static_cast<int>(args.GetSize())));
+    });
+    runtime::NativeClass& accumulator = natives.AddClass("Accumulator"s)
+        .SetConstructor<Accumulator>([](int start) {
+            return Accumulator{start, 0};
+        })
+        .AddMethod<Accumulator>("add"s, [](Accumulator& self, int value) {
+            self.total += value;
+            ++self.count;
+        })
+        .AddMethod<Accumulator>("mean"s, [](Accumulator& self) {
+            return self.count == 0 ? 0 : self.total / self.count;
+        })
+        .AddMethod<Accumulator>("__str__"s, [](Accumulator& self) {
+            return "Accumulator("s + to_string(self.total) + ")"s;
+        });
+
+    ParseOptions options;
+    options.natives = &natives;
+
+    const string program = R"(
+class Stats:
+  def __init__():
+    self.acc = Accumulator(0)
+  def add(x):
+    return self.acc.add(x)
+
+print gcd(84, 36), shout('ab', 3), count(), count(1, 'x', None)
+log('started')
+s = Stats()
+for i in range(1, 5):
+  s.add(i * 10)
+print s.acc, s.acc.mean()
+)"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program, options)->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "12 ababab! 0 3\nAccumulator(100) 25\n"s);
+    ASSERT_EQUAL(log, vector<string>{"started"s});
+
+    ASSERT_THROWS(ParseProgramFromString("print gcd(1)\n"s, options), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("print gcd(1, 2)\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("print gcd('a', 2)\n"s, options)->Execute(closure, context),
+                  std::runtime_error);
+    ASSERT_THROWS(ParseProgramFromString("a = Accumulator(1)\na.missing()\n"s, options)
+                      ->Execute(closure, context),
+                  std::runtime_error);
+
+    // Метод нативного класса проверяет тип объекта, у которого вызван
+    runtime::String text("text"s);
+    ASSERT_THROWS(accumulator.GetMethod("mean"s)->Call(&text, {nullptr, 0}, context), std::runtime_error);
+
+    ASSERT_THROWS(natives.LoadModule("/nonexistent/module.so"s), std::runtime_error);
+    ASSERT_THROWS(natives.LoadModule("libm.so.6"s), std::runtime_error);
+}
+
+// Долгий тест: собирает нативный модуль компилятором из переменной CXX (по умолчанию c++)
+// с заголовками из каталога этого файла. Запускается ключом --slow-tests
+void TestNativeModule() {
+    char dir_template[] = "/tmp/mython_native_XXXXXX";
+    const string dir = mkdtemp(dir_template);
+    const string source = dir + "/module.cpp"s;
+    const string library = dir + "/module.so"s;
+    ofstream(source) << R"(
+#include "native.h"
+
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+struct Counter {
+    int value = 0;
+};
+}  // namespace
+
+extern "C" void mython_register_module(runtime::NativeRegistry& registry) {
+    registry.AddFunction("triple", [](int x) {
+        return x * 3;
+    });
+    if (std::getenv("MYTHON_TEST_MODULE_FAIL")) {
+        registry.AddFunction("partial", [] {
+            return 1;
+        });
+        throw std::runtime_error("registration failed");
+    }
+    registry.AddClass("Counter")
+        .SetConstructor<Counter>([](int start) {
+            return Counter{start};
+        })
+        .AddMethod<Counter>("add", [](Counter& self, int value) {
+            self.value += value;
+            return self.value;
+        });
+}
+)"s;
+    const string file = __FILE__;
+    const string include_dir = file.substr(0, file.rfind('/') + 1);
+    const char* compiler = getenv("CXX");
+    const string command = (compiler ? string(compiler) : "c++"s) + " -std=c++17 -shared -fPIC -I"s
+                         + (include_dir.empty() ? "."s : include_dir) + " "s + source + " -o "s + library;
+    ASSERT_EQUAL(system(command.c_str()), 0);
+
+    runtime::NativeRegistry natives;
+    natives.LoadModule(library);
+    ParseOptions options;
+    options.natives = &natives;
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString("c = Counter(10)\nc.add(5)\nprint triple(7), c.add(1)\n"s, options)
+        ->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "21 16\n"s);
+
+    // Регистрация, прерванная исключением, не оставляет в реестре функций модуля
+    runtime::NativeRegistry failing;
+    setenv("MYTHON_TEST_MODULE_FAIL", "1", 1);
+    ASSERT_THROWS(failing.LoadModule(library), std::runtime_error);
+    unsetenv("MYTHON_TEST_MODULE_FAIL");
+    ASSERT(!failing.FindFunction("triple"s));
+    ASSERT(!failing.FindFunction("partial"s));
+
+    remove(source.c_str());
+    remove(library.c_str());
+    rmdir(dir.c_str());
+}
+
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -256,4 +1076,20 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestRecursion2);
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
+    RUN_TEST(tr, parse::TestTailCalls);
+    RUN_TEST(tr, parse::TestExecutionStack);
+    RUN_TEST(tr, parse::TestLoops);
+    RUN_TEST(tr, parse::TestLists);
+    RUN_TEST(tr, parse::TestDicts);
+    RUN_TEST(tr, parse::TestNativeFunctions);
+    RUN_TEST(tr, parse::TestFunctions);
+    RUN_TEST(tr, parse::TestLazyMethodBodies);
+    RUN_TEST(tr, parse::TestConcurrentExecution);
+    RUN_TEST(tr, parse::TestSpawn);
+    RUN_TEST(tr, parse::TestImport);
+}
+
+void TestParseProgramSlow(TestRunner& tr) {
+    RUN_TEST(tr, parse::TestDeepTailCalls);
+    RUN_TEST(tr, parse::TestNativeModule);
 }
@@ -0,0 +1,193 @@
+#include "reclaimer.h"
+
+#include <chrono>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+atomic<DeferredReclaimer*> current_reclaimer{nullptr};
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result *= 2;
+    }
+    return result;
+}
+}  // namespace
+
+DeferredReclaimer::DeferredReclaimer(Options options)
+: options_(options) {
+    const size_t capacity = RoundUpToPowerOfTwo(max<size_t>(options_.queue_capacity, 2));
+    cells_ = make_unique<Cell[]>(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        cells_[i].sequence.store(i, memory_order_relaxed);
+    }
+    mask_ = capacity - 1;
+    thread_ = thread([this] {
+        Run();
+    });
+}
+
+DeferredReclaimer::~DeferredReclaimer() {
+    stop_ = true;
+    {
+        lock_guard guard(mutex_);
+        wake_up_.notify_one();
+    }
+    thread_.join();
+
+    ObjectHolder object;
+    while (TryDequeue(object)) {
+        object = {};
+        reclaimed_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+// Ограниченная MPMC-очередь Вьюкова: каждая ячейка хранит номер позиции,
+// на которой её может занять производитель либо забрать потребитель
+bool DeferredReclaimer::TryEnqueue(ObjectHolder& object) {
+    size_t pos = enqueue_pos_.load(memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &cells_[pos & mask_];
+        const size_t sequence = cell->sequence.load(memory_order_acquire);
+        const auto diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            inline_releases_.fetch_add(1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = enqueue_pos_.load(memory_order_relaxed);
+        }
+    }
+    cell->object = move(object);
+    cell->sequence.store(pos + 1, memory_order_release);
+    enqueued_.fetch_add(1, memory_order_relaxed);
+
+    if (sleeping_.load()) {
+        lock_guard guard(mutex_);
+        wake_up_.notify_one();
+    }
+    return true;
+}
+
+bool DeferredReclaimer::TryDequeue(ObjectHolder& object) {
+    size_t pos = dequeue_pos_.load(memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &cells_[pos & mask_];
+        const size_t sequence = cell->sequence.load(memory_order_acquire);
+        const auto diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos_.load(memory_order_relaxed);
+        }
+    }
+    object = move(cell->object);
+    cell->sequence.store(pos + mask_ + 1, memory_order_release);
+    return true;
+}
+
+void DeferredReclaimer::Flush() {
+    const size_t target = enqueued_.load();
+    unique_lock lock(mutex_);
+    wake_up_.notify_one();
+    drained_.wait(lock, [this, target] {
+        return reclaimed_.load() >= target;
+    });
+}
+
+ReclaimerStats DeferredReclaimer::GetStats() const {
+    ReclaimerStats stats;
+    stats.enqueued = enqueued_.load(memory_order_relaxed);
+    stats.reclaimed = reclaimed_.load(memory_order_relaxed);
+    stats.inline_releases = inline_releases_.load(memory_order_relaxed);
+    stats.batches = batches_.load(memory_order_relaxed);
+    return stats;
+}
+
+void DeferredReclaimer::Run() {
+    vector<ObjectHolder> batch;
+    batch.reserve(options_.batch_size);
+    for (;;) {
+        ObjectHolder object;
+        while (batch.size() < options_.batch_size && TryDequeue(object)) {
+            batch.push_back(move(object));
+        }
+        if (!batch.empty()) {
+            const size_t count = batch.size();
+            batch.clear();
+            reclaimed_.fetch_add(count);
+            batches_.fetch_add(1, memory_order_relaxed);
+            {
+                lock_guard guard(mutex_);
+            }
+            drained_.notify_all();
+            continue;
+        }
+        if (stop_) {
+            break;
+        }
+
+        unique_lock lock(mutex_);
+        sleeping_ = true;
+        if (dequeue_pos_.load() == enqueue_pos_.load() && !stop_) {
+            // Тайм-аут страхует от пропущенного пробуждения
+            wake_up_.wait_for(lock, 10ms);
+        }
+        sleeping_ = false;
+    }
+}
+
+void EnableDeferredReclamation(DeferredReclaimer::Options options) {
+    DisableDeferredReclamation();
+    current_reclaimer.store(new DeferredReclaimer(options), memory_order_release);
+}
+
+void DisableDeferredReclamation() {
+    delete current_reclaimer.exchange(nullptr, memory_order_acq_rel);
+}
+
+ReclaimerStats GetReclaimerStats() {
+    DeferredReclaimer* reclaimer = current_reclaimer.load(memory_order_acquire);
+    return reclaimer ? reclaimer->GetStats() : ReclaimerStats{};
+}
+
+void FlushDeferredReclamation() {
+    if (DeferredReclaimer* reclaimer = current_reclaimer.load(memory_order_acquire)) {
+        reclaimer->Flush();
+    }
+}
+
+void Retire(ObjectHolder&& object) {
+    ObjectHolder released = move(object);
+    DeferredReclaimer* reclaimer = current_reclaimer.load(memory_order_acquire);
+    // Объекты региона освобождаются вместе с ним, а значения не ссылаются на другие объекты
+    if (!reclaimer || !released.IsUnique() || Region::Current() || !released.TryAs<Collectable>()) {
+        return;
+    }
+    reclaimer->TryEnqueue(released);
+}
+
+void Retire(Closure&& closure) {
+    Closure released = move(closure);
+    if (!current_reclaimer.load(memory_order_acquire)) {
+        return;
+    }
+    for (auto& [name, value] : released) {
+        Retire(move(value));
+    }
+}
+
+}  // namespace runtime
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace runtime {
+
+// Статистика отложенного освобождения объектов
+struct ReclaimerStats {
+    // Количество объектов, переданных фоновому потоку
+    size_t enqueued = 0;
+    // Количество объектов, освобождённых фоновым потоком
+    size_t reclaimed = 0;
+    // Количество объектов, освобождённых на месте из-за переполнения очереди
+    size_t inline_releases = 0;
+    // Количество обработанных пакетов
+    size_t batches = 0;
+};
+
+/*
+ * Фоновый поток, освобождающий графы объектов вне критического пути исполнения.
+ * Последняя ссылка на объект, способный ссылаться на другие объекты, помещается
+ * в ограниченную lock-free очередь, а фоновый поток разрушает такие объекты пакетами.
+ * Если очередь заполнена, объект освобождается на месте, что ограничивает рост очереди.
+ */
+class DeferredReclaimer {
+public:
+    struct Options {
+        // Максимальное количество объектов в очереди (округляется до степени двойки)
+        size_t queue_capacity = 4096;
+        // Максимальное количество объектов, освобождаемых за один пакет
+        size_t batch_size = 256;
+    };
+
+    explicit DeferredReclaimer(Options options);
+    // Освобождает все объекты, оставшиеся в очереди, и останавливает фоновый поток
+    ~DeferredReclaimer();
+
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+    // Передаёт object фоновому потоку. Возвращает false, если очередь заполнена
+    bool TryEnqueue(ObjectHolder& object);
+
+    // Дожидается освобождения всех объектов, переданных до вызова
+    void Flush();
+
+    [[nodiscard]] ReclaimerStats GetStats() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        ObjectHolder object;
+    };
+
+    bool TryDequeue(ObjectHolder& object);
+    void Run();
+
+    Options options_;
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> sleeping_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_up_;
+    std::condition_variable drained_;
+
+    std::atomic<size_t> enqueued_{0};
+    std::atomic<size_t> reclaimed_{0};
+    std::atomic<size_t> inline_releases_{0};
+    std::atomic<size_t> batches_{0};
+
+    std::thread thread_;
+};
+
+// Включает режим отложенного освобождения объектов для всех потоков
+void EnableDeferredReclamation(DeferredReclaimer::Options options = {});
+// Выключает режим отложенного освобождения, освобождая все объекты из очереди
+void DisableDeferredReclamation();
+// Возвращает статистику отложенного освобождения или пустую статистику, если режим выключен
+ReclaimerStats GetReclaimerStats();
+// Дожидается освобождения всех объектов, переданных фоновому потоку
+void FlushDeferredReclamation();
+
+/*
+ * Отказывается от ссылки object. Если это последняя ссылка на объект, хранящий другие
+ * объекты, а режим отложенного освобождения включён, объект разрушается фоновым потоком.
+ * В противном случае ссылка освобождается сразу
+ */
+void Retire(ObjectHolder&& object);
+// Отказывается от всех ссылок, хранящихся в closure
+void Retire(Closure&& closure);
+
+}  // namespace runtime
@@ -0,0 +1,119 @@
+#include "region.h"
+
+#include "memory_account.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+Region::Region()
+: Region(Options{}) {
+}
+
+Region::Region(Options options)
+: options_(options) {
+}
+
+Region::~Region() {
+    // Объекты уничтожаются в порядке создания. Удалители ссылок внутри региона ничего
+    // не делают, поэтому деструктор одного объекта не вызывает деструкторы других
+    for (const Destructible& object : objects_) {
+        object.destroy(object.object);
+    }
+    for (const AccountCharge& charge : charges_) {
+        charge.account->Release(charge.bytes);
+    }
+    for (const Chunk& chunk : chunks_) {
+        if (chunk.mapped) {
+            munmap(chunk.data, chunk.size);
+        } else {
+            ::operator delete(chunk.data);
+        }
+    }
+}
+
+Region::Scope::Scope(Region& region)
+: previous_(detail::thread_memory.region) {
+    detail::thread_memory.region = &region;
+}
+
+Region::Scope::Scope(nullptr_t)
+: previous_(detail::thread_memory.region) {
+    detail::thread_memory.region = nullptr;
+}
+
+Region::Scope::~Scope() {
+    detail::thread_memory.region = previous_;
+}
+
+Region* Region::Current() {
+    return detail::thread_memory.region;
+}
+
+void* Region::Allocate(size_t bytes, size_t alignment) {
+    auto aligned = reinterpret_cast<char*>(AlignUp(reinterpret_cast<uintptr_t>(bump_), alignment));
+    if (!bump_ || aligned + bytes > end_) {
+        AddChunk(bytes + alignment);
+        aligned = reinterpret_cast<char*>(AlignUp(reinterpret_cast<uintptr_t>(bump_), alignment));
+    }
+    bump_ = aligned + bytes;
+    allocated_bytes_ += bytes;
+    return aligned;
+}
+
+void Region::Charge(MemoryAccount& account, size_t bytes) {
+    // Обычно все объекты региона учитываются одним учётом
+    if (charges_.empty() || charges_.back().account != &account) {
+        charges_.push_back({&account, 0});
+    }
+    account.Charge(bytes);
+    charges_.back().bytes += bytes;
+}
+
+size_t Region::GetObjectCount() const {
+    return objects_.size();
+}
+
+size_t Region::GetAllocatedBytes() const {
+    return allocated_bytes_;
+}
+
+void Region::AddChunk(size_t min_size) {
+    Chunk chunk{nullptr, max(options_.chunk_size, min_size), false};
+    if (options_.huge_pages) {
+        chunk.size = AlignUp(chunk.size, HUGE_PAGE_SIZE);
+        void* data = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED) {
+            // Зарезервированных больших страниц нет: просим ядро использовать прозрачные
+            data = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+            if (data == MAP_FAILED) {
+                throw bad_alloc();
+            }
+            madvise(data, chunk.size, MADV_HUGEPAGE);
+        }
+        chunk.data = static_cast<char*>(data);
+        chunk.mapped = true;
+    } else {
+        chunk.data = static_cast<char*>(::operator new(chunk.size));
+    }
+    chunks_.push_back(chunk);
+    bump_ = chunk.data;
+    end_ = chunk.data + chunk.size;
+}
+
+}  // namespace runtime
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace runtime {
+
+class MemoryAccount;
+
+/*
+ * Регион памяти для объектов, созданных за один запуск программы.
+ * Пока регион активен в потоке (см. Region::Scope), ObjectHolder::Own размещает объекты
+ * в нём простым сдвигом указателя. Удалители таких объектов ничего не делают, поэтому
+ * освобождение последней ссылки не запускает каскад деструкторов. При уничтожении региона
+ * деструкторы всех его объектов вызываются по очереди без рекурсии, после чего память
+ * возвращается одним блоком.
+ *
+ * Ссылки на объекты региона не должны переживать сам регион.
+ */
+class Region {
+public:
+    struct Options {
+        // Размер одного блока памяти региона
+        size_t chunk_size = 1 << 20;
+        // Использовать ли большие страницы памяти (если система их поддерживает)
+        bool huge_pages = false;
+    };
+
+    Region();
+    explicit Region(Options options);
+    ~Region();
+
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    // Делает регион текущим для потока на время своей жизни
+    class Scope {
+    public:
+        explicit Scope(Region& region);
+        // Отключает активный регион: объекты снова размещаются в пуле потока.
+        // Нужно для объектов, которые должны пережить регион
+        explicit Scope(std::nullptr_t);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Region* previous_;
+    };
+
+    // Возвращает регион, активный в текущем потоке, либо nullptr
+    [[nodiscard]] static Region* Current();
+
+    // Выделяет bytes байт с выравниванием alignment
+    void* Allocate(size_t bytes, size_t alignment);
+
+    // Размещает object в регионе и возвращает указатель, разделяющий владение с регионом
+    template <typename T>
+    std::shared_ptr<T> Own(T&& object) {
+        return Make<T>(std::forward<T>(object));
+    }
+
+    // Создаёт в регионе объект типа T из args
+    template <typename T, typename... Args>
+    std::shared_ptr<T> Make(Args&&... args) {
+        T* ptr = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        objects_.push_back({ptr, [](void* p) {
+                                static_cast<T*>(p)->~T();
+                            }});
+        return std::shared_ptr<T>(ptr, [](T* /*p*/) { /* do nothing */ }, Allocator<T>(*this));
+    }
+
+    // Относит bytes байт на учёт account (см. MemoryAccount::Charge). Память возвращается на учёт
+    // при уничтожении региона после уничтожения его объектов
+    void Charge(MemoryAccount& account, size_t bytes);
+
+    // Возвращает количество объектов и байт, размещённых в регионе
+    [[nodiscard]] size_t GetObjectCount() const;
+    [[nodiscard]] size_t GetAllocatedBytes() const;
+
+private:
+    // Аллокатор для управляющих блоков shared_ptr. Память возвращается вместе с регионом
+    template <typename T>
+    class Allocator {
+    public:
+        using value_type = T;
+
+        explicit Allocator(Region& region) noexcept
+            : region_(&region) {
+        }
+
+        template <typename U>
+        Allocator(const Allocator<U>& other) noexcept  // NOLINT(google-explicit-constructor)
+            : region_(other.region_) {
+        }
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(region_->Allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* /*p*/, size_t /*n*/) noexcept {
+        }
+
+        template <typename U>
+        bool operator==(const Allocator<U>& other) const {
+            return region_ == other.region_;
+        }
+
+        template <typename U>
+        bool operator!=(const Allocator<U>& other) const {
+            return region_ != other.region_;
+        }
+
+    private:
+        template <typename U>
+        friend class Allocator;
+
+        Region* region_;
+    };
+
+    struct Chunk {
+        char* data;
+        size_t size;
+        bool mapped;
+    };
+
+    struct Destructible {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    struct AccountCharge {
+        MemoryAccount* account;
+        size_t bytes;
+    };
+
+    void AddChunk(size_t min_size);
+
+    Options options_;
+    std::vector<Chunk> chunks_;
+    std::vector<Destructible> objects_;
+    std::vector<AccountCharge> charges_;
+    char* bump_ = nullptr;
+    char* end_ = nullptr;
+    size_t allocated_bytes_ = 0;
+};
+
+}  // namespace runtime
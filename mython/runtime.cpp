@@ -1,5 +1,9 @@
 #include "runtime.h"
 
+#include "collector.h"
+#include "reclaimer.h"
+#include "stack.h"
+
 #include <cassert>
 #include <optional>
 #include <sstream>
@@ -11,6 +15,53 @@ using namespace std;
 
 namespace runtime {
 
+namespace {
+// Контейнеры, которые выводятся либо сравниваются в текущем потоке: при выводе - пары
+// {контейнер, nullptr}, при сравнении - пары сравниваемых контейнеров
+thread_local std::vector<std::pair<const Object*, const Object*>> active_containers;
+
+// Отмечает контейнер на время вывода или сравнения. Контейнер, содержащий сам себя,
+// обнаруживает повторный вход вместо бесконечной рекурсии
+class ReentryGuard {
+public:
+    explicit ReentryGuard(const Object* lhs, const Object* rhs = nullptr)
+        : reentry_(std::find(active_containers.begin(), active_containers.end(), std::pair(lhs, rhs))
+                   != active_containers.end()) {
+        if (!reentry_) {
+            active_containers.emplace_back(lhs, rhs);
+        }
+    }
+
+    ~ReentryGuard() {
+        if (!reentry_) {
+            active_containers.pop_back();
+        }
+    }
+
+    ReentryGuard(const ReentryGuard&) = delete;
+    ReentryGuard& operator=(const ReentryGuard&) = delete;
+
+    [[nodiscard]] bool IsReentry() const {
+        return reentry_;
+    }
+
+private:
+    bool reentry_;
+};
+}  // namespace
+
+namespace detail {
+
+DetachedContainers::DetachedContainers() {
+    containers_.swap(active_containers);
+}
+
+DetachedContainers::~DetachedContainers() {
+    containers_.swap(active_containers);
+}
+
+}  // namespace detail
+
 ObjectHolder::ObjectHolder(std::shared_ptr<Object> data)
     : data_(std::move(data)) {
 }
@@ -20,8 +71,13 @@ void ObjectHolder::AssertIsValid() const {
 }
 
 ObjectHolder ObjectHolder::Share(Object& object) {
-    // Возвращаем невладеющий shared_ptr (его deleter ничего не делает)
-    return ObjectHolder(std::shared_ptr<Object>(&object, [](auto* /*p*/) { /* do nothing */ }));
+    if (auto owner = object.weak_from_this().lock()) {
+        return ObjectHolder(std::move(owner));
+    }
+    // Возвращаем невладеющий shared_ptr без управляющего блока (aliasing-конструктор с пустым
+    // владельцем). В отличие от shared_ptr с пустым deleter он не записывает weak_this
+    // в object, поэтому константы программы можно разделять между потоками без гонок
+    return ObjectHolder(std::shared_ptr<Object>(std::shared_ptr<Object>(), &object));
 }
 
 ObjectHolder ObjectHolder::None() {
@@ -46,6 +102,10 @@ ObjectHolder::operator bool() const {
     return Get() != nullptr;
 }
 
+bool ObjectHolder::IsUnique() const {
+    return data_.use_count() == 1;
+}
+
 bool IsTrue(const ObjectHolder& object) {
     if (!object) {
         return false;
@@ -56,6 +116,10 @@ bool IsTrue(const ObjectHolder& object) {
         return !str->GetValue().empty();
     } else if (auto boolean = dynamic_cast<Bool*>(object.Get())) {
         return boolean->GetValue();
+    } else if (auto list = dynamic_cast<List*>(object.Get())) {
+        return !list->Items().empty();
+    } else if (auto dict = dynamic_cast<Dict*>(object.Get())) {
+        return dict->GetSize() != 0;
     }
     return false;
 }
@@ -73,6 +137,10 @@ bool ClassInstance::HasMethod(const std::string& method, size_t argument_count)
     return met && met->formal_params.size() == argument_count;
 }
 
+const Class& ClassInstance::GetClass() const {
+    return cls_;
+}
+
 Closure& ClassInstance::Fields() {
     return closure_;
 }
@@ -85,9 +153,30 @@ ClassInstance::ClassInstance(const Class& cls)
 : cls_(cls) {
 }
 
+ClassInstance::~ClassInstance() {
+    StopTracking();
+}
+
+void ClassInstance::ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const {
+    for (const auto& [name, value] : closure_) {
+        fn(value);
+    }
+}
+
+void ClassInstance::ClearReferences() {
+    Closure fields;
+    fields.swap(closure_);
+}
+
+size_t ClassInstance::GetMemoryUsage() const {
+    return sizeof(*this) + closure_.bucket_count() * sizeof(void*)
+         + closure_.size() * (sizeof(Closure::value_type) + sizeof(void*));
+}
+
 ObjectHolder ClassInstance::Call(const std::string& method,
                                  const std::vector<ObjectHolder>& actual_args,
                                  Context& context) {
+    CheckStack();
     auto met = cls_.GetMethod(method);
     if (!met || met->formal_params.size() != actual_args.size()) {
         throw std::runtime_error("Error in ClassInstance::Call: \""s + method + "\" method in Call was not found"s);
@@ -96,7 +185,9 @@ ObjectHolder ClassInstance::Call(const std::string& method,
     for (size_t i = 0; i < actual_args.size(); ++i) {
         closure[met->formal_params[i]] = actual_args[i];
     }
-    return met->body->Execute(closure, context);
+    ObjectHolder result = met->body->Execute(closure, context);
+    Retire(std::move(closure));
+    return result;
 }
 
 Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
@@ -130,10 +221,382 @@ void Class::Print(ostream& os, Context& /*context*/) {
     os << "Class "sv << name_;
 }
 
+Function::Function(std::string name) {
+    method_.name = move(name);
+}
+
+void Function::Define(std::vector<std::string> formal_params, std::unique_ptr<Executable> body) {
+    method_.formal_params = move(formal_params);
+    method_.body = move(body);
+}
+
+bool Function::IsDefined() const {
+    return method_.body != nullptr;
+}
+
+ObjectHolder Function::Call(const std::vector<ObjectHolder>& actual_args, Context& context) {
+    CheckStack();
+    if (!IsDefined()) {
+        // Возможно при потоковом выполнении, если функция объявлена после вызова
+        throw std::runtime_error("Error in Function::Call: \""s + method_.name + "\" is not defined"s);
+    }
+    if (method_.formal_params.size() != actual_args.size()) {
+        throw std::runtime_error("Error in Function::Call: \""s + method_.name + "\" takes "s
+                                 + to_string(method_.formal_params.size()) + " arguments"s);
+    }
+    Closure closure;
+    for (size_t i = 0; i < actual_args.size(); ++i) {
+        closure[method_.formal_params[i]] = actual_args[i];
+    }
+    ObjectHolder result = method_.body->Execute(closure, context);
+    Retire(std::move(closure));
+    return result;
+}
+
+const Method& Function::GetMethod() const {
+    return method_;
+}
+
+void Function::Print(ostream& os, Context& /*context*/) {
+    os << "Function "sv << method_.name;
+}
+
 void Bool::Print(std::ostream& os, [[maybe_unused]] Context& context) {
     os << (GetValue() ? "True"sv : "False"sv);
 }
 
+List::List(std::vector<ObjectHolder> items)
+: items_(move(items)) {
+}
+
+List::~List() {
+    StopTracking();
+}
+
+void List::Print(std::ostream& os, Context& context) {
+    // Список, содержащий сам себя, выводится внутри себя как [...]
+    const ReentryGuard guard(this);
+    if (guard.IsReentry()) {
+        os << "[...]"sv;
+        return;
+    }
+    os << '[';
+    bool first = true;
+    for (const ObjectHolder& item : items_) {
+        if (!first) {
+            os << ", "sv;
+        }
+        first = false;
+        if (item) {
+            item->Print(os, context);
+        } else {
+            os << "None"sv;
+        }
+    }
+    os << ']';
+}
+
+ObjectHolder List::Call(const std::string& method, const std::vector<ObjectHolder>& actual_args) {
+    if (method == "append"sv && actual_args.size() == 1) {
+        items_.push_back(actual_args[0]);
+        UpdateMemoryUsage();
+        return ObjectHolder::None();
+    }
+    if (method == "pop"sv && actual_args.size() <= 1) {
+        if (items_.empty()) {
+            throw std::runtime_error("Error in List::Call: pop from empty list"s);
+        }
+        const size_t index = actual_args.empty() ? items_.size() - 1 : NormalizeIndex(actual_args[0], items_.size());
+        ObjectHolder result = std::move(items_[index]);
+        items_.erase(items_.begin() + index);
+        return result;
+    }
+    throw std::runtime_error("Error in List::Call: \""s + method + "\" method was not found"s);
+}
+
+std::vector<ObjectHolder>& List::Items() {
+    return items_;
+}
+
+const std::vector<ObjectHolder>& List::Items() const {
+    return items_;
+}
+
+void List::ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const {
+    for (const ObjectHolder& item : items_) {
+        fn(item);
+    }
+}
+
+void List::ClearReferences() {
+    std::vector<ObjectHolder> items;
+    items.swap(items_);
+}
+
+size_t List::GetMemoryUsage() const {
+    return sizeof(*this) + items_.capacity() * sizeof(ObjectHolder);
+}
+
+Dict::~Dict() {
+    StopTracking();
+}
+
+void Dict::Print(std::ostream& os, Context& context) {
+    auto print = [&os, &context](const ObjectHolder& object) {
+        if (object) {
+            object->Print(os, context);
+        } else {
+            os << "None"sv;
+        }
+    };
+    const ReentryGuard guard(this);
+    if (guard.IsReentry()) {
+        os << "{...}"sv;
+        return;
+    }
+    os << '{';
+    bool first = true;
+    ForEachItem([&](const ObjectHolder& key, const ObjectHolder& value) {
+        if (!first) {
+            os << ", "sv;
+        }
+        first = false;
+        print(key);
+        os << ": "sv;
+        print(value);
+    });
+    os << '}';
+}
+
+ObjectHolder Dict::Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
+                        Context& context) {
+    if (method == "get"sv && (actual_args.size() == 1 || actual_args.size() == 2)) {
+        if (ObjectHolder* value = Find(actual_args[0], context)) {
+            return *value;
+        }
+        return actual_args.size() == 2 ? actual_args[1] : ObjectHolder::None();
+    }
+    if ((method == "keys"sv || method == "values"sv) && actual_args.empty()) {
+        std::vector<ObjectHolder> items;
+        items.reserve(size_);
+        const bool keys = method == "keys"sv;
+        ForEachItem([&items, keys](const ObjectHolder& key, const ObjectHolder& value) {
+            items.push_back(keys ? key : value);
+        });
+        return ObjectHolder::Own(List(std::move(items)));
+    }
+    throw std::runtime_error("Error in Dict::Call: \""s + method + "\" method was not found"s);
+}
+
+size_t Dict::FindSlot(const ObjectHolder& key, size_t hash, Context& context) {
+    for (;;) {
+        const uint64_t version = version_;
+        bool changed = false;
+        const size_t slot = index_.Find(hash, [&](uint32_t index) {
+            const Entry& entry = entries_[index];
+            if (entry.hash != hash) {
+                return false;
+            }
+            if (entry.key.Get() == key.Get()) {
+                return true;
+            }
+            // Метод __eq__ может изменить словарь, поэтому ключ удерживается на время сравнения
+            ObjectHolder stored = entry.key;
+            const bool equal = KeyEqual(stored, key, context);
+            // Если словарь изменился, индекс мог быть перестроен: поиск прекращается,
+            // не обращаясь к нему, и начинается заново
+            changed = version_ != version;
+            return equal || changed;
+        });
+        if (!changed) {
+            return slot;
+        }
+    }
+}
+
+ObjectHolder* Dict::Find(const ObjectHolder& key, Context& context) {
+    const size_t slot = FindSlot(key, Hash(key, context), context);
+    return slot == HashIndex::NPOS ? nullptr : &entries_[index_.GetEntry(slot)].value;
+}
+
+ObjectHolder& Dict::Set(const ObjectHolder& key, ObjectHolder value, Context& context) {
+    const size_t hash = Hash(key, context);
+    if (const size_t slot = FindSlot(key, hash, context); slot != HashIndex::NPOS) {
+        ObjectHolder& stored = entries_[index_.GetEntry(slot)].value;
+        Retire(std::exchange(stored, std::move(value)));
+        return stored;
+    }
+    if (index_.IsFull()) {
+        Rehash(std::max<size_t>(size_ * 2, 8));
+    }
+    entries_.push_back({key, std::move(value), hash});
+    index_.Insert(hash, static_cast<uint32_t>(entries_.size() - 1));
+    ++size_;
+    ++version_;
+    UpdateMemoryUsage();
+    return entries_.back().value;
+}
+
+bool Dict::Erase(const ObjectHolder& key, Context& context) {
+    const size_t slot = FindSlot(key, Hash(key, context), context);
+    if (slot == HashIndex::NPOS) {
+        return false;
+    }
+    Entry& entry = entries_[index_.GetEntry(slot)];
+    index_.Erase(slot);
+    entry.erased = true;
+    ++version_;
+    ObjectHolder erased_key = std::move(entry.key);
+    ObjectHolder erased_value = std::move(entry.value);
+    --size_;
+    // Удалённые записи вытесняются, когда их становится больше, чем живых
+    if (entries_.size() >= 2 * size_ + 16) {
+        Rehash(size_ * 2);
+    }
+    Retire(std::move(erased_value));
+    return true;
+}
+
+size_t Dict::GetSize() const {
+    return size_;
+}
+
+void Dict::ForEachItem(const std::function<void(const ObjectHolder&, const ObjectHolder&)>& fn) const {
+    for (const Entry& entry : entries_) {
+        if (!entry.erased) {
+            fn(entry.key, entry.value);
+        }
+    }
+}
+
+void Dict::Rehash(size_t count) {
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [](const Entry& entry) {
+                                      return entry.erased;
+                                  }),
+                   entries_.end());
+    index_.Reset(std::max(count, size_));
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        index_.Insert(entries_[i].hash, static_cast<uint32_t>(i));
+    }
+    ++version_;
+}
+
+void Dict::ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const {
+    ForEachItem([&fn](const ObjectHolder& key, const ObjectHolder& value) {
+        fn(key);
+        fn(value);
+    });
+}
+
+void Dict::ClearReferences() {
+    std::vector<Entry> entries;
+    entries.swap(entries_);
+    index_ = HashIndex{};
+    size_ = 0;
+    ++version_;
+}
+
+size_t Dict::GetMemoryUsage() const {
+    return sizeof(*this) + entries_.capacity() * sizeof(Entry) + index_.GetMemoryUsage();
+}
+
+namespace {
+// Перемешивает биты хеша, чтобы близкие значения попадали в разные группы индекса
+size_t MixHash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return static_cast<size_t>(value);
+}
+}  // namespace
+
+size_t Hash(const ObjectHolder& key, Context& context) {
+    if (!key) {
+        return MixHash(0x9e3779b97f4a7c15ULL);
+    } else if (auto number = key.TryAs<Number>()) {
+        return MixHash(static_cast<uint64_t>(number->GetValue()));
+    } else if (auto str = key.TryAs<String>()) {
+        return MixHash(std::hash<std::string>{}(str->GetValue()));
+    } else if (auto boolean = key.TryAs<Bool>()) {
+        return MixHash(boolean->GetValue() ? 1 : 0);
+    } else if (auto cls_ins = key.TryAs<ClassInstance>()) {
+        if (cls_ins->HasMethod("__hash__"s, 0)) {
+            auto hash = cls_ins->Call("__hash__"s, {}, context);
+            if (auto number = hash.TryAs<Number>()) {
+                return MixHash(static_cast<uint64_t>(number->GetValue()));
+            }
+            throw std::runtime_error("__hash__ must return a number"s);
+        }
+    } else if (key.TryAs<List>() || key.TryAs<Dict>()) {
+        throw std::runtime_error("Lists and dicts cannot be used as dict keys"s);
+    }
+    return MixHash(reinterpret_cast<uintptr_t>(key.Get()));
+}
+
+bool KeyEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+    if (!lhs || !rhs) {
+        return !lhs && !rhs;
+    } else if (auto number1 = lhs.TryAs<Number>()) {
+        auto number2 = rhs.TryAs<Number>();
+        return number2 && number1->GetValue() == number2->GetValue();
+    } else if (auto str1 = lhs.TryAs<String>()) {
+        auto str2 = rhs.TryAs<String>();
+        return str2 && str1->GetValue() == str2->GetValue();
+    } else if (auto bool1 = lhs.TryAs<Bool>()) {
+        auto bool2 = rhs.TryAs<Bool>();
+        return bool2 && bool1->GetValue() == bool2->GetValue();
+    } else if (auto cls_ins = lhs.TryAs<ClassInstance>()) {
+        if (cls_ins->HasMethod("__eq__"s, 1)) {
+            return Equal(lhs, rhs, context);
+        }
+    } else if ((lhs.TryAs<List>() && rhs.TryAs<List>()) || (lhs.TryAs<Dict>() && rhs.TryAs<Dict>())) {
+        return Equal(lhs, rhs, context);
+    }
+    return lhs.Get() == rhs.Get();
+}
+
+bool Contains(const ObjectHolder& element, const ObjectHolder& container, Context& context) {
+    if (auto dict = container.TryAs<Dict>()) {
+        return dict->Find(element, context) != nullptr;
+    } else if (auto list = container.TryAs<List>()) {
+        // Метод __eq__ может изменить список, поэтому элементы перебираются по индексу
+        for (size_t i = 0; i < list->Items().size(); ++i) {
+            ObjectHolder item = list->Items()[i];
+            if (KeyEqual(item, element, context)) {
+                return true;
+            }
+        }
+        return false;
+    } else if (auto str = container.TryAs<String>()) {
+        if (auto substr = element.TryAs<String>()) {
+            return str->GetValue().find(substr->GetValue()) != std::string::npos;
+        }
+    }
+    throw std::runtime_error("Cannot check membership"s);
+}
+
+bool NotContains(const ObjectHolder& element, const ObjectHolder& container, Context& context) {
+    return !Contains(element, container, context);
+}
+
+size_t NormalizeIndex(const ObjectHolder& index, size_t size) {
+    auto number = index.TryAs<Number>();
+    if (!number) {
+        throw std::runtime_error("Indices must be numbers"s);
+    }
+    long long value = number->GetValue();
+    if (value < 0) {
+        value += static_cast<long long>(size);
+    }
+    if (value < 0 || value >= static_cast<long long>(size)) {
+        throw std::runtime_error("Index out of range"s);
+    }
+    return static_cast<size_t>(value);
+}
+
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
     if (!lhs || !rhs) {
         if (!lhs && !rhs) {
@@ -155,6 +618,43 @@ bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
         if (auto bool2 = dynamic_cast<Bool*>(rhs.Get())) {
             return bool1->GetValue() == bool2->GetValue();
         }
+    } else if (auto list1 = dynamic_cast<List*>(lhs.Get())) {
+        if (auto list2 = dynamic_cast<List*>(rhs.Get())) {
+            const auto& items1 = list1->Items();
+            const auto& items2 = list2->Items();
+            if (items1.size() != items2.size()) {
+                return false;
+            }
+            const ReentryGuard guard(list1, list2);
+            if (guard.IsReentry()) {
+                throw std::runtime_error("Cannot compare recursive containers"s);
+            }
+            for (size_t i = 0; i < items1.size(); ++i) {
+                // Как и в Python, элемент равен самому себе: список, содержащий себя, равен себе
+                if (items1[i].Get() != items2[i].Get() && !KeyEqual(items1[i], items2[i], context)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    } else if (auto dict1 = dynamic_cast<Dict*>(lhs.Get())) {
+        if (auto dict2 = dynamic_cast<Dict*>(rhs.Get())) {
+            if (dict1->GetSize() != dict2->GetSize()) {
+                return false;
+            }
+            const ReentryGuard guard(dict1, dict2);
+            if (guard.IsReentry()) {
+                throw std::runtime_error("Cannot compare recursive containers"s);
+            }
+            bool equal = true;
+            dict1->ForEachItem([&](const ObjectHolder& key, const ObjectHolder& value) {
+                if (equal) {
+                    ObjectHolder* other = dict2->Find(key, context);
+                    equal = other && (value.Get() == other->Get() || KeyEqual(value, *other, context));
+                }
+            });
+            return equal;
+        }
     }
     throw std::runtime_error("Cannot compare objects for equality"s);
 }
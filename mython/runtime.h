@@ -1,13 +1,23 @@
 #pragma once
 
+#include "allocator.h"
+#include "hash_table.h"
+#include "memory_account.h"
+#include "region.h"
+
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
 namespace runtime {
 
+class CycleCollector;
+
 // Контекст исполнения инструкций Mython
 class Context {
 public:
@@ -18,8 +28,9 @@ protected:
     ~Context() = default;
 };
 
-// Базовый класс для всех объектов языка Mython
-class Object {
+// Базовый класс для всех объектов языка Mython.
+// Объект, которым владеет ObjectHolder, может получить владеющую ссылку на самого себя
+class Object : public std::enable_shared_from_this<Object> {
 public:
     virtual ~Object() = default;
     // выводит в os своё представление в виде строки
@@ -34,13 +45,23 @@ public:
 
     // Возвращает ObjectHolder, владеющий объектом типа T
     // Тип T - конкретный класс-наследник Object.
-    // object копируется или перемещается в кучу
+    // object копируется или перемещается в активный регион (см. Region::Scope),
+    // а если его нет - в пул объектов текущего потока.
+    // Память объекта относится на учёт, действующий в потоке (см. MemoryAccount::Scope)
     template <typename T>
     [[nodiscard]] static ObjectHolder Own(T&& object) {
-        return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+        const detail::ThreadMemory& thread = detail::thread_memory;
+        if (thread.account) {
+            return OwnAccounted(std::forward<T>(object), *thread.account, thread.region);
+        }
+        if (thread.region) {
+            return ObjectHolder(thread.region->Own(std::forward<T>(object)));
+        }
+        return ObjectHolder(std::allocate_shared<T>(PoolAllocator<T>(), std::forward<T>(object)));
     }
 
-    // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки)
+    // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки).
+    // Если объектом уже владеет другой ObjectHolder, результат разделяет с ним владение
     [[nodiscard]] static ObjectHolder Share(Object& object);
     // Создаёт пустой ObjectHolder, соответствующий значению None
     [[nodiscard]] static ObjectHolder None();
@@ -63,10 +84,16 @@ public:
     // Возвращает true, если ObjectHolder не пуст
     explicit operator bool() const;
 
+    // Возвращает true, если других ссылок на объект нет
+    [[nodiscard]] bool IsUnique() const;
+
 private:
     explicit ObjectHolder(std::shared_ptr<Object> data);
     void AssertIsValid() const;
 
+    template <typename T>
+    static ObjectHolder OwnAccounted(T&& object, MemoryAccount& account, Region* region);
+
     std::shared_ptr<Object> data_;
 };
 
@@ -86,6 +113,12 @@ public:
         return value_;
     }
 
+    // Заменяет значение. Допустимо, только пока на объект нет других ссылок
+    // (см. ObjectHolder::IsUnique): значения Mython неизменяемы
+    void SetValue(T v) {
+        value_ = std::move(v);
+    }
+
 private:
     T value_;
 };
@@ -94,7 +127,8 @@ private:
 using Closure = std::unordered_map<std::string, ObjectHolder>;
 
 // Проверяет, содержится ли в object значение, приводимое к True
-// Для отличных от нуля чисел, True и непустых строк возвращается true. В остальных случаях - false.
+// Для отличных от нуля чисел, True, непустых строк, списков и словарей возвращается true.
+// В остальных случаях - false.
 bool IsTrue(const ObjectHolder& object);
 
 // Интерфейс для выполнения действий над объектами Mython
@@ -103,7 +137,7 @@ public:
     virtual ~Executable() = default;
     // Выполняет действие над объектами внутри closure, используя context
     // Возвращает результирующее значение либо None
-    virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
+    virtual ObjectHolder Execute(Closure& closure, Context& context) const = 0;
 };
 
 // Строковое значение
@@ -151,10 +185,90 @@ private:
     const Class* parent_;
 };
 
+/*
+ * Функция, объявленная на верхнем уровне программы.
+ * Вызовы функции связываются с ней при разборе программы, поэтому функция может быть
+ * создана до того, как разобрано её тело
+ */
+class Function : public Object {
+public:
+    explicit Function(std::string name);
+
+    // Задаёт параметры и тело функции
+    void Define(std::vector<std::string> formal_params, std::unique_ptr<Executable> body);
+    // Возвращает true, если тело функции задано
+    [[nodiscard]] bool IsDefined() const;
+
+    /*
+     * Вызывает функцию, передавая ей actual_args параметров. В отличие от метода,
+     * функция не получает параметр self. Если количество аргументов не совпадает
+     * с количеством параметров, выбрасывает исключение runtime_error
+     */
+    ObjectHolder Call(const std::vector<ObjectHolder>& actual_args, Context& context);
+
+    // Возвращает имя, параметры и тело функции
+    [[nodiscard]] const Method& GetMethod() const;
+
+    // Выводит в os строку "Function <имя функции>"
+    void Print(std::ostream& os, Context& context) override;
+
+private:
+    Method method_;
+};
+
+/*
+ * Объект, хранящий ссылки на другие объекты и потому способный образовать цикл.
+ * Такие объекты отслеживает сборщик циклических ссылок потока, в котором они созданы
+ * (см. CycleCollector)
+ */
+class Collectable : public Object {
+public:
+    Collectable();
+    Collectable(const Collectable& other);
+    Collectable(Collectable&& other) noexcept;
+    Collectable& operator=(const Collectable& /*rhs*/) {
+        return *this;
+    }
+    Collectable& operator=(Collectable&& /*rhs*/) noexcept {
+        return *this;
+    }
+    ~Collectable() override;
+
+    // Вызывает fn для каждой ссылки, хранящейся в объекте
+    virtual void ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const = 0;
+    // Удаляет все ссылки, хранящиеся в объекте
+    virtual void ClearReferences() = 0;
+    // Возвращает приблизительный объём памяти, занимаемый объектом
+    [[nodiscard]] virtual size_t GetMemoryUsage() const = 0;
+
+    // Учитывает изменение памяти, занимаемой содержимым объекта. Вызывается после изменений,
+    // которые могут увеличить объект. При превышении квоты выбрасывает MemoryQuotaExceededError,
+    // оставляя изменение в силе: оно будет учтено при следующем вызове.
+    // Объект, созданный без учёта памяти, ничего не делает (см. ObjectHolder::Own)
+    virtual void UpdateMemoryUsage() {
+    }
+
+protected:
+    // Снимает объект с учёта сборщика. Наследники вызывают этот метод в начале своего
+    // деструктора, пока хранящиеся в них ссылки ещё не разрушены
+    void StopTracking() noexcept;
+
+private:
+    friend class CycleCollector;
+
+    CycleCollector* collector_ = nullptr;
+    Collectable* prev_ = nullptr;
+    Collectable* next_ = nullptr;
+    bool old_ = false;
+};
+
 // Экземпляр класса
-class ClassInstance : public Object {
+class ClassInstance : public Collectable {
 public:
     explicit ClassInstance(const Class& cls);
+    ClassInstance(const ClassInstance& other) = default;
+    ClassInstance(ClassInstance&& other) = default;
+    ~ClassInstance() override;
 
     /*
      * Если у объекта есть метод __str__, выводит в os результат, возвращённый этим методом.
@@ -174,20 +288,150 @@ public:
     // Возвращает true, если объект имеет метод method, принимающий argument_count параметров
     [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
 
+    // Возвращает класс объекта
+    [[nodiscard]] const Class& GetClass() const;
+
     // Возвращает ссылку на Closure, содержащий поля объекта
     [[nodiscard]] Closure& Fields();
     // Возвращает константную ссылку на Closure, содержащую поля объекта
     [[nodiscard]] const Closure& Fields() const;
-    
+
+    void ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const override;
+    void ClearReferences() override;
+    [[nodiscard]] size_t GetMemoryUsage() const override;
+
 private:
     const Class& cls_;
     Closure closure_;
 };
 
+// Список значений
+class List : public Collectable {
+public:
+    List() = default;
+    explicit List(std::vector<ObjectHolder> items);
+    List(const List& other) = default;
+    List(List&& other) = default;
+    ~List() override;
+
+    // Выводит в os элементы списка через запятую в квадратных скобках, например [1, 2, 3]
+    void Print(std::ostream& os, Context& context) override;
+
+    /*
+     * Вызывает у списка встроенный метод:
+     *  append(value) - добавляет value в конец списка и возвращает None
+     *  pop() / pop(index) - удаляет и возвращает последний элемент либо элемент index
+     * Для остальных методов выбрасывает исключение runtime_error
+     */
+    ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args);
+
+    [[nodiscard]] std::vector<ObjectHolder>& Items();
+    [[nodiscard]] const std::vector<ObjectHolder>& Items() const;
+
+    void ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const override;
+    void ClearReferences() override;
+    [[nodiscard]] size_t GetMemoryUsage() const override;
+
+private:
+    std::vector<ObjectHolder> items_;
+};
+
+/*
+ * Словарь. Ключами могут быть None, числа, строки, значения типа Bool и объекты.
+ * Объект с методом __hash__ хешируется результатом этого метода и сравнивается
+ * с другими ключами методом __eq__, остальные объекты сравниваются по адресу.
+ * Порядок обхода словаря совпадает с порядком добавления ключей
+ */
+class Dict : public Collectable {
+public:
+    Dict() = default;
+    Dict(const Dict& other) = default;
+    Dict(Dict&& other) = default;
+    ~Dict() override;
+
+    // Выводит в os пары ключ-значение в фигурных скобках, например {a: 1, b: 2}
+    void Print(std::ostream& os, Context& context) override;
+
+    /*
+     * Вызывает у словаря встроенный метод:
+     *  get(key) / get(key, default) - возвращает значение по ключу либо default (по умолчанию None)
+     *  keys() / values() - возвращает список ключей либо значений
+     * Для остальных методов выбрасывает исключение runtime_error
+     */
+    ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
+                      Context& context);
+
+    // Возвращает указатель на значение по ключу key либо nullptr, если ключа нет в словаре.
+    // Параметр context задаёт контекст для выполнения методов __hash__ и __eq__ ключей
+    [[nodiscard]] ObjectHolder* Find(const ObjectHolder& key, Context& context);
+    // Присваивает значение value по ключу key и возвращает ссылку на него
+    ObjectHolder& Set(const ObjectHolder& key, ObjectHolder value, Context& context);
+    // Удаляет ключ key. Возвращает false, если ключа не было в словаре
+    bool Erase(const ObjectHolder& key, Context& context);
+
+    [[nodiscard]] size_t GetSize() const;
+
+    // Вызывает fn для каждой пары ключ-значение в порядке добавления ключей
+    void ForEachItem(const std::function<void(const ObjectHolder&, const ObjectHolder&)>& fn) const;
+
+    void ForEachReference(const std::function<void(const ObjectHolder&)>& fn) const override;
+    void ClearReferences() override;
+    [[nodiscard]] size_t GetMemoryUsage() const override;
+
+private:
+    struct Entry {
+        ObjectHolder key;
+        ObjectHolder value;
+        size_t hash = 0;
+        bool erased = false;
+    };
+
+    [[nodiscard]] size_t FindSlot(const ObjectHolder& key, size_t hash, Context& context);
+    // Удаляет из entries_ удалённые записи и перестраивает индекс под count записей
+    void Rehash(size_t count);
+
+    HashIndex index_;
+    std::vector<Entry> entries_;
+    size_t size_ = 0;
+    // Увеличивается при каждой вставке, удалении и перестроении индекса
+    uint64_t version_ = 0;
+};
+
+/*
+ * Возвращает хеш ключа словаря. Для объекта с методом __hash__ возвращает хеш результата
+ * вызова этого метода, для остальных объектов - хеш их адреса.
+ * Для списков и словарей выбрасывает исключение runtime_error
+ */
+size_t Hash(const ObjectHolder& key, Context& context);
+
+/*
+ * Сравнивает ключи словаря и элементы списков и словарей. В отличие от Equal, значения
+ * разных типов не равны друг другу, а объекты без метода __eq__ сравниваются по адресу
+ */
+bool KeyEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+/*
+ * Операция element in container. Проверяет наличие ключа в словаре, элемента в списке
+ * либо подстроки в строке. Для остальных значений container выбрасывает исключение runtime_error
+ */
+bool Contains(const ObjectHolder& element, const ObjectHolder& container, Context& context);
+// Возвращает значение, противоположное Contains(element, container, context)
+bool NotContains(const ObjectHolder& element, const ObjectHolder& container, Context& context);
+
+/*
+ * Приводит индекс элемента последовательности длины size к неотрицательному.
+ * Отрицательные индексы отсчитываются от конца последовательности.
+ * Если индекс выходит за границы, выбрасывает исключение runtime_error
+ */
+size_t NormalizeIndex(const ObjectHolder& index, size_t size);
+
 /*
  * Возвращает true, если lhs и rhs содержат одинаковые числа, строки или значения типа Bool.
  * Если lhs - объект с методом __eq__, функция возвращает результат вызова lhs.__eq__(rhs),
  * приведённый к типу Bool. Если lhs и rhs имеют значение None, функция возвращает true.
+ * Списки равны, если равны их длины и попарно равны элементы.
+ * Словари равны, если содержат одинаковые ключи с равными значениями.
+ * Элементы списков и словарей сравниваются функцией KeyEqual.
  * В остальных случаях функция выбрасывает исключение runtime_error.
  *
  * Параметр context задаёт контекст для выполнения метода __eq__
@@ -212,6 +456,93 @@ bool LessOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& cont
 // Возвращает значение, противоположное Less(lhs, rhs, context)
 bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
+namespace detail {
+/*
+ * Объект, рост содержимого которого относится на учёт памяти. Поля учёта есть только
+ * у объектов, созданных при действующем учёте, а не у каждого Collectable
+ */
+template <typename T>
+class Accounted final : public T {
+public:
+    Accounted(T&& object, MemoryAccount& account)
+        : T(std::move(object))
+        , account_(account) {
+    }
+
+    Accounted(const Accounted&) = delete;
+    Accounted& operator=(const Accounted&) = delete;
+
+    ~Accounted() override {
+        if (accounted_bytes_ > 0) {
+            account_.Release(accounted_bytes_);
+        }
+    }
+
+    void UpdateMemoryUsage() override {
+        // Память самого объекта учтена при его размещении
+        const size_t usage = this->GetMemoryUsage() - sizeof(T);
+        if (usage > accounted_bytes_) {
+            account_.Charge(usage - accounted_bytes_);
+        } else if (usage < accounted_bytes_) {
+            // Учёт не может быть удалён: на нём числится память самого объекта
+            account_.Release(accounted_bytes_ - usage);
+        }
+        accounted_bytes_ = usage;
+    }
+
+private:
+    MemoryAccount& account_;
+    size_t accounted_bytes_ = 0;
+};
+
+// Отделяет от потока контейнеры, которые в нём выводятся или сравниваются, и возвращает их
+// в деструкторе. Сессия планировщика, уступающая поток посреди вывода контейнера,
+// не должна делить их с другими сессиями этого потока
+class DetachedContainers {
+public:
+    DetachedContainers();
+    ~DetachedContainers();
+
+    DetachedContainers(const DetachedContainers&) = delete;
+    DetachedContainers& operator=(const DetachedContainers&) = delete;
+
+private:
+    std::vector<std::pair<const Object*, const Object*>> containers_;
+};
+
+}  // namespace detail
+
+template <typename T>
+ObjectHolder ObjectHolder::OwnAccounted(T&& object, MemoryAccount& account, Region* region) {
+    if constexpr (std::is_base_of_v<Collectable, T>) {
+        using Stored = detail::Accounted<T>;
+        std::shared_ptr<Stored> result;
+        if (region) {
+            region->Charge(account, sizeof(Stored));
+            result = region->Make<Stored>(std::forward<T>(object), account);
+        } else {
+            result = std::allocate_shared<Stored>(AccountedAllocator<Stored>(account, 0), std::forward<T>(object),
+                                                  account);
+        }
+        result->UpdateMemoryUsage();
+        return ObjectHolder(std::move(result));
+    } else {
+        // Содержимое строки не меняется, поэтому учитывается вместе с объектом
+        size_t extra_bytes = 0;
+        if constexpr (std::is_same_v<T, String>) {
+            extra_bytes = detail::GetHeapSize(object.GetValue());
+        }
+        std::shared_ptr<T> result;
+        if (region) {
+            region->Charge(account, sizeof(T) + extra_bytes);
+            result = region->Own(std::forward<T>(object));
+        } else {
+            result = std::allocate_shared<T>(AccountedAllocator<T>(account, extra_bytes), std::forward<T>(object));
+        }
+        return ObjectHolder(std::move(result));
+    }
+}
+
 // Контекст-заглушка, применяется в тестах.
 // В этом контексте весь вывод перенаправляется в строковый поток вывода output
 struct DummyContext : Context {
@@ -1,6 +1,15 @@
 #include "runtime.h"
 
+#include "collector.h"
+#include "epoch.h"
+#include "output.h"
+#include "reclaimer.h"
+
+#include <atomic>
 #include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include <test_runner.h>
 
 using namespace std;
@@ -98,7 +107,7 @@ struct TestMethodBody : Executable {
         : body(std::move(body)) {
     }
 
-    ObjectHolder Execute(Closure& closure, Context& context) override {
+    ObjectHolder Execute(Closure& closure, Context& context) const override {
         if (body) {
             return body(closure, context);
         }
@@ -242,6 +251,349 @@ void TestMove() {
     }
 }
 
+void TestPoolAllocator() {
+    const AllocatorStats before = GetAllocatorStats();
+    {
+        vector<ObjectHolder> objects;
+        for (int i = 0; i < 1000; ++i) {
+            objects.push_back(ObjectHolder::Own(Number{i}));
+        }
+        const AllocatorStats stats = GetAllocatorStats();
+        ASSERT(stats.live_objects >= before.live_objects + 1000);
+        ASSERT(stats.live_bytes >= before.live_bytes + 1000 * sizeof(Number));
+    }
+    const AllocatorStats after_free = GetAllocatorStats();
+    ASSERT_EQUAL(after_free.live_objects, before.live_objects);
+
+    // Освобождённые блоки переиспользуются
+    for (int i = 0; i < 1000; ++i) {
+        auto oh = ObjectHolder::Own(Number{i});
+        ASSERT(oh);
+    }
+    const AllocatorStats stats = GetAllocatorStats();
+    ASSERT(stats.pool_hits >= after_free.pool_hits + 1000);
+    ASSERT(stats.HitRate() > 0.0);
+}
+
+void TestMemoryAccount() {
+    ASSERT(MemoryAccount::Current() == nullptr);
+    const string long_text(1000, 'x');
+    ObjectHolder escaped;
+    {
+        MemoryAccount::Scope scope;
+        {
+            // Содержимое строки учитывается вместе с объектом
+            ObjectHolder text = ObjectHolder::Own(String(long_text));
+            ASSERT(scope.GetUsage().current >= sizeof(String) + long_text.size());
+            // Рост списка учитывается при добавлении элементов
+            ObjectHolder list = ObjectHolder::Own(List());
+            const size_t before = scope.GetUsage().current;
+            for (int i = 0; i < 100; ++i) {
+                list.TryAs<List>()->Call("append"s, {text});
+            }
+            ASSERT(scope.GetUsage().current >= before + 100 * sizeof(ObjectHolder));
+        }
+        // Освобождённая память возвращается на учёт, наибольший объём остаётся в статистике
+        ASSERT_EQUAL(scope.GetUsage().current, 0U);
+        ASSERT(scope.GetUsage().peak >= sizeof(String) + long_text.size() + 100 * sizeof(ObjectHolder));
+
+        // Память объектов региона возвращается при уничтожении региона
+        {
+            Region region;
+            Region::Scope region_scope(region);
+            ObjectHolder text = ObjectHolder::Own(String(long_text));
+            ASSERT(scope.GetUsage().current >= long_text.size());
+        }
+        ASSERT_EQUAL(scope.GetUsage().current, 0U);
+
+        // Вложенный учёт относит память и на объемлющий, а квоты не ослабляют друг друга
+        {
+            MemoryAccount::Scope inner(4096);
+            ObjectHolder text = ObjectHolder::Own(String(long_text));
+            // На объемлющий учёт отнесён и запас потока, взятый вложенным
+            ASSERT(inner.GetUsage().current >= sizeof(String) + long_text.size());
+            ASSERT(scope.GetUsage().current >= inner.GetUsage().current);
+            ASSERT_THROWS(static_cast<void>(ObjectHolder::Own(String(string(5000, 'y')))), MemoryQuotaExceededError);
+            ObjectHolder list = ObjectHolder::Own(List());
+            auto grow = [&list, &text] {
+                for (int i = 0; i < 1000; ++i) {
+                    list.TryAs<List>()->Call("append"s, {text});
+                }
+            };
+            ASSERT_THROWS(grow(), MemoryQuotaExceededError);
+            ASSERT(inner.GetUsage().current <= 4096U);
+            ASSERT(inner.GetUsage().peak <= 4096U);
+            {
+                MemoryAccount::Scope unlimited;
+                ASSERT_EQUAL(MemoryAccount::Current()->GetRemaining(), 4096 - inner.GetUsage().current);
+                ASSERT_THROWS(static_cast<void>(ObjectHolder::Own(String(string(5000, 'y')))), MemoryQuotaExceededError);
+            }
+        }
+        ASSERT_EQUAL(scope.GetUsage().current, 0U);
+
+        {
+            MemoryAccount::Scope detached(nullptr);
+            ASSERT(MemoryAccount::Current() == nullptr);
+        }
+        escaped = ObjectHolder::Own(String(long_text));
+    }
+    ASSERT(MemoryAccount::Current() == nullptr);
+    // Учёт существует, пока жив учтённый объект, и объект можно освободить в другом потоке
+    thread([escaped = move(escaped)]() mutable {
+        escaped = ObjectHolder::None();
+    }).join();
+}
+
+void TestRegion() {
+    ASSERT_EQUAL(Logger::instance_count, 0);
+    Class node_class{"Node"s, {}, nullptr};
+    {
+        Region region;
+        {
+            Region::Scope scope(region);
+            // Длинная цепочка объектов, связанных через поля
+            ObjectHolder head = ObjectHolder::Own(ClassInstance{node_class});
+            for (int i = 0; i < 100'000; ++i) {
+                auto node = ObjectHolder::Own(ClassInstance{node_class});
+                node.TryAs<ClassInstance>()->Fields()["next"s] = std::move(head);
+                head = std::move(node);
+            }
+            head.TryAs<ClassInstance>()->Fields()["logger"s] = ObjectHolder::Own(Logger(1));
+            ASSERT(Region::Current() == &region);
+        }
+        ASSERT(Region::Current() == nullptr);
+        ASSERT_EQUAL(region.GetObjectCount(), 100'002U);
+        ASSERT_EQUAL(Logger::instance_count, 1);
+    }
+    ASSERT_EQUAL(Logger::instance_count, 0);
+
+    {
+        Region region(Region::Options{1 << 16, true});
+        Region::Scope scope(region);
+        auto oh = ObjectHolder::Own(Number{42});
+        ASSERT_EQUAL(oh.TryAs<Number>()->GetValue(), 42);
+        ASSERT(region.GetAllocatedBytes() >= sizeof(Number));
+    }
+}
+
+void TestCycleCollector() {
+    ASSERT_EQUAL(Logger::instance_count, 0);
+    Class node_class{"Node"s, {}, nullptr};
+    auto& collector = CycleCollector::Current();
+    collector.Collect();
+    const CollectorStats before = collector.GetStats();
+
+    auto make_cycle = [&node_class](int id) {
+        auto a = ObjectHolder::Own(ClassInstance{node_class});
+        auto b = ObjectHolder::Own(ClassInstance{node_class});
+        a.TryAs<ClassInstance>()->Fields()["next"s] = b;
+        a.TryAs<ClassInstance>()->Fields()["logger"s] = ObjectHolder::Own(Logger(id));
+        b.TryAs<ClassInstance>()->Fields()["prev"s] = a;
+        return a;
+    };
+
+    make_cycle(1);
+    ObjectHolder alive = make_cycle(2);
+    ASSERT_EQUAL(Logger::instance_count, 2);
+
+    ASSERT_EQUAL(collector.Collect(false), 2U);
+    ASSERT_EQUAL(Logger::instance_count, 1);
+
+    // Цикл, на который ссылается объект старшего поколения, не собирается
+    ObjectHolder holder = ObjectHolder::Own(ClassInstance{node_class});
+    collector.Collect(false);
+    holder.TryAs<ClassInstance>()->Fields()["child"s] = make_cycle(3);
+    ASSERT_EQUAL(collector.Collect(false), 0U);
+    ASSERT_EQUAL(Logger::instance_count, 2);
+
+    alive = {};
+    holder = {};
+    ASSERT_EQUAL(collector.Collect(), 4U);
+    ASSERT_EQUAL(Logger::instance_count, 0);
+
+    const CollectorStats stats = collector.GetStats();
+    ASSERT_EQUAL(stats.reclaimed_objects, before.reclaimed_objects + 6);
+    ASSERT(stats.reclaimed_bytes > before.reclaimed_bytes);
+    ASSERT_EQUAL(stats.young_collections, before.young_collections + 3);
+    ASSERT_EQUAL(stats.tracked_objects, before.tracked_objects);
+}
+
+// Объект, подсчитывающий количество живых экземпляров в любом потоке
+class InstanceCounter : public Object {
+public:
+    static atomic<int> alive;
+
+    InstanceCounter() {
+        ++alive;
+    }
+
+    InstanceCounter(const InstanceCounter& /*other*/) {
+        ++alive;
+    }
+
+    ~InstanceCounter() override {
+        --alive;
+    }
+
+    void Print(ostream& /*os*/, Context& /*context*/) override {
+    }
+};
+
+atomic<int> InstanceCounter::alive{0};
+
+void TestDeferredReclamation() {
+    Class node_class{"Node"s, {}, nullptr};
+
+    EnableDeferredReclamation({4, 2});
+    for (int i = 0; i < 100; ++i) {
+        auto node = ObjectHolder::Own(ClassInstance{node_class});
+        node.TryAs<ClassInstance>()->Fields()["counter"s] = ObjectHolder::Own(InstanceCounter());
+        Retire(std::move(node));
+        ASSERT(!node);
+    }
+    // Значения и объекты, на которые есть другие ссылки, освобождаются на месте
+    auto shared = ObjectHolder::Own(ClassInstance{node_class});
+    Retire(ObjectHolder(shared));
+    Retire(ObjectHolder::Own(Number{1}));
+
+    FlushDeferredReclamation();
+    ASSERT_EQUAL(InstanceCounter::alive.load(), 0);
+    const ReclaimerStats stats = GetReclaimerStats();
+    ASSERT_EQUAL(stats.enqueued + stats.inline_releases, 100U);
+    ASSERT_EQUAL(stats.reclaimed, stats.enqueued);
+    ASSERT(stats.batches > 0);
+    DisableDeferredReclamation();
+
+    ASSERT_EQUAL(GetReclaimerStats().enqueued, 0U);
+}
+
+void TestEpochReclamation() {
+    EpochDomain domain;
+    atomic<int> freed = 0;
+    const auto retire = [&domain, &freed] {
+        domain.Retire([&freed] {
+            ++freed;
+        });
+    };
+
+    retire();
+    // Без читателей заменённые данные освобождаются сразу
+    ASSERT_EQUAL(freed.load(), 1);
+    {
+        EpochDomain::Guard reader(domain);
+        retire();
+        {
+            // Читатель, пришедший после замены, не удерживает заменённые данные
+            EpochDomain::Guard late_reader(domain);
+            ASSERT_EQUAL(domain.TryReclaim(), 0U);
+        }
+        ASSERT_EQUAL(freed.load(), 1);
+        ASSERT_EQUAL(domain.GetRetiredCount(), 1U);
+    }
+    // Последний читатель освобождает данные при выходе
+    ASSERT_EQUAL(freed.load(), 2);
+    ASSERT_EQUAL(domain.GetRetiredCount(), 0U);
+
+    // Версия, опубликованная писателем, видна читателям, и ни одна не освобождается,
+    // пока её читают
+    struct Version {
+        explicit Version(int value)
+            : value(value) {
+        }
+        ~Version() {
+            value = -1;
+        }
+        int value;
+    };
+    atomic<Version*> current = new Version(0);
+    atomic<bool> stop = false;
+    atomic<int> bad_reads = 0;
+    vector<thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            while (!stop) {
+                EpochDomain::Guard guard(domain);
+                const Version* version = current.load();
+                for (int j = 0; j < 100; ++j) {
+                    if (version->value < 0) {
+                        ++bad_reads;
+                    }
+                }
+            }
+        });
+    }
+    for (int i = 1; i <= 1000; ++i) {
+        Version* previous = current.exchange(new Version(i));
+        domain.Retire([previous] {
+            delete previous;
+        });
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    domain.TryReclaim();
+    ASSERT_EQUAL(bad_reads.load(), 0);
+    ASSERT_EQUAL(domain.GetRetiredCount(), 0U);
+    delete current.load();
+}
+
+void TestOutputMerger() {
+    const auto stream_text = [](size_t stream) {
+        string text;
+        for (int line = 0; line < 200; ++line) {
+            text += "stream "s + to_string(stream) + " line "s + to_string(line) + "\n"s;
+        }
+        return text;
+    };
+    const auto run = [&stream_text](OutputMerger& merger) {
+        vector<thread> threads;
+        // Потоки вывода закрываются в обратном порядке: результат от этого не зависит
+        for (size_t stream = 4; stream-- > 0;) {
+            threads.emplace_back([&merger, &stream_text, stream] {
+                BufferedContext context(merger, stream, 64);
+                for (int line = 0; line < 200; ++line) {
+                    context.GetOutputStream() << "stream "sv << stream << " line "sv << line << '\n';
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+
+    ostringstream ordered;
+    {
+        OutputMerger merger(ordered);
+        run(merger);
+        merger.Flush();
+        ASSERT(merger.GetWrittenChunks() > 4U);
+    }
+    string expected;
+    for (size_t stream = 0; stream < 4; ++stream) {
+        expected += stream_text(stream);
+    }
+    ASSERT_EQUAL(ordered.str(), expected);
+
+    // По мере поступления строки разных потоков не разрываются, а порядок строк потока сохраняется
+    ostringstream arrived;
+    {
+        OutputMerger merger(arrived, OutputMerger::Order::ARRIVAL);
+        run(merger);
+    }
+    ASSERT_EQUAL(arrived.str().size(), expected.size());
+    vector<int> next_line(4, 0);
+    istringstream lines(arrived.str());
+    string word;
+    size_t stream = 0;
+    int line = 0;
+    while (lines >> word >> stream >> word >> line) {
+        ASSERT(stream < 4);
+        ASSERT_EQUAL(line, next_line[stream]++);
+    }
+    ASSERT_EQUAL(next_line, vector<int>(4, 200));
+}
+
 void TestNullptr() {
     ObjectHolder oh;
     ASSERT(!oh);
@@ -529,6 +881,94 @@ void TestClassInstance() {
     ASSERT_THROWS(instance.Call("missing_method"s, {}, ctx), runtime_error);
 }
 
+void TestList() {
+    DummyContext ctx;
+    auto make_list = [](vector<ObjectHolder> items) {
+        return ObjectHolder::Own(List{move(items)});
+    };
+    auto list = make_list({ObjectHolder::Own(Number{1}), ObjectHolder::Own(String{"two"s})});
+    List& items = *list.TryAs<List>();
+
+    ostringstream out;
+    items.Print(out, ctx);
+    ASSERT_EQUAL(out.str(), "[1, two]"s);
+
+    ASSERT(IsTrue(list));
+    ASSERT(!IsTrue(make_list({})));
+    ASSERT(Equal(list, make_list({ObjectHolder::Own(Number{1}), ObjectHolder::Own(String{"two"s})}), ctx));
+    ASSERT(!Equal(list, make_list({ObjectHolder::Own(Number{1})}), ctx));
+
+    ASSERT(items.Call("append"s, {ObjectHolder::None()}).Get() == nullptr);
+    ASSERT_EQUAL(items.Items().size(), 3U);
+    ASSERT_EQUAL(items.Call("pop"s, {ObjectHolder::Own(Number{-3})}).TryAs<Number>()->GetValue(), 1);
+    ASSERT_EQUAL(items.Items().size(), 2U);
+    ASSERT_THROWS(items.Call("pop"s, {ObjectHolder::Own(Number{2})}), runtime_error);
+    ASSERT_THROWS(items.Call("missing_method"s, {}), runtime_error);
+
+    // Список, содержащий сам себя, освобождается сборщиком циклов
+    auto& collector = CycleCollector::Current();
+    collector.Collect();
+    items.Call("append"s, {list});
+    // Список, содержащий сам себя, выводится внутри себя как [...] и равен себе
+    ostringstream recursive;
+    items.Print(recursive, ctx);
+    ASSERT_EQUAL(recursive.str(), "[two, None, [...]]"s);
+    ASSERT(Equal(list, list, ctx));
+    // Сравнение списков, содержащих друг друга, не зацикливается
+    auto first = make_list({});
+    auto second = make_list({first});
+    first.TryAs<List>()->Call("append"s, {second});
+    ASSERT_THROWS(Equal(first, second, ctx), runtime_error);
+    first = {};
+    second = {};
+    list = {};
+    ASSERT_EQUAL(collector.Collect(), 3U);
+}
+
+void TestDict() {
+    DummyContext ctx;
+    auto dict_h = ObjectHolder::Own(Dict{});
+    Dict& dict = *dict_h.TryAs<Dict>();
+    ASSERT(!IsTrue(dict_h));
+
+    dict.Set(ObjectHolder::Own(String{"a"s}), ObjectHolder::Own(Number{1}), ctx);
+    dict.Set(ObjectHolder::Own(Number{1}), ObjectHolder::Own(String{"one"s}), ctx);
+    dict.Set(ObjectHolder::None(), ObjectHolder::Own(Bool{true}), ctx);
+    dict.Set(ObjectHolder::Own(String{"a"s}), ObjectHolder::Own(Number{2}), ctx);
+    ASSERT(IsTrue(dict_h));
+    ASSERT_EQUAL(dict.GetSize(), 3U);
+
+    ostringstream out;
+    dict.Print(out, ctx);
+    ASSERT_EQUAL(out.str(), "{a: 2, 1: one, None: True}"s);
+
+    // Ключи разных типов не равны друг другу
+    ASSERT(dict.Find(ObjectHolder::Own(Bool{true}), ctx) == nullptr);
+    ASSERT(dict.Find(ObjectHolder::Own(String{"1"s}), ctx) == nullptr);
+    ASSERT(Contains(ObjectHolder::Own(Number{1}), dict_h, ctx));
+    ASSERT_THROWS(dict.Set(ObjectHolder::Own(List{}), ObjectHolder::None(), ctx), runtime_error);
+
+    // Вставка и удаление большого числа ключей перестраивают индекс
+    for (int i = 0; i < 10000; ++i) {
+        dict.Set(ObjectHolder::Own(Number{i}), ObjectHolder::Own(Number{i * 2}), ctx);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        ASSERT(dict.Erase(ObjectHolder::Own(Number{i}), ctx));
+    }
+    ASSERT(!dict.Erase(ObjectHolder::Own(Number{0}), ctx));
+    ASSERT_EQUAL(dict.GetSize(), 5002U);
+    for (int i = 0; i < 10000; ++i) {
+        ObjectHolder* value = dict.Find(ObjectHolder::Own(Number{i}), ctx);
+        ASSERT_EQUAL(value != nullptr, i % 2 == 1);
+        ASSERT(!value || value->TryAs<Number>()->GetValue() == i * 2);
+    }
+
+    auto other_h = ObjectHolder::Own(Dict{dict});
+    ASSERT(Equal(dict_h, other_h, ctx));
+    other_h.TryAs<Dict>()->Set(ObjectHolder::Own(Number{1}), ObjectHolder::None(), ctx);
+    ASSERT(!Equal(dict_h, other_h, ctx));
+}
+
 }  // namespace
 
 void RunObjectsTests(TestRunner& tr) {
@@ -540,6 +980,8 @@ void RunObjectsTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestComparison);
     RUN_TEST(tr, runtime::TestClass);
     RUN_TEST(tr, runtime::TestClassInstance);
+    RUN_TEST(tr, runtime::TestList);
+    RUN_TEST(tr, runtime::TestDict);
 }
 
 void RunObjectHolderTests(TestRunner& tr) {
@@ -547,6 +989,13 @@ void RunObjectHolderTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestOwning);
     RUN_TEST(tr, runtime::TestMove);
     RUN_TEST(tr, runtime::TestNullptr);
+    RUN_TEST(tr, runtime::TestPoolAllocator);
+    RUN_TEST(tr, runtime::TestRegion);
+    RUN_TEST(tr, runtime::TestMemoryAccount);
+    RUN_TEST(tr, runtime::TestCycleCollector);
+    RUN_TEST(tr, runtime::TestDeferredReclamation);
+    RUN_TEST(tr, runtime::TestEpochReclamation);
+    RUN_TEST(tr, runtime::TestOutputMerger);
 }
 
 }  // namespace runtime
@@ -0,0 +1,372 @@
+#include "scheduler.h"
+
+#include "native.h"
+#include "region.h"
+#include "stack.h"
+
+#include <ucontext.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+// Количество точек переключения между проверками часов
+constexpr long YIELD_CHECK_INTERVAL = 256;
+
+// Сессия, выполняемая в текущем потоке, и контекст рабочего потока, в который она возвращается
+thread_local Session* current_session = nullptr;
+thread_local ucontext_t* worker_context = nullptr;
+thread_local chrono::steady_clock::time_point slice_start;
+thread_local chrono::nanoseconds slice_length{0};
+}  // namespace
+
+namespace detail {
+
+thread_local long yield_countdown = LONG_MAX;
+
+void CheckTimeSlice() {
+    if (!current_session) {
+        yield_countdown = LONG_MAX;
+        return;
+    }
+    yield_countdown = YIELD_CHECK_INTERVAL;
+    if (chrono::steady_clock::now() - slice_start >= slice_length) {
+        // Сессия остаётся в состоянии RUNNING: рабочий поток вернёт её в очередь
+        current_session->Suspend();
+    }
+}
+
+}  // namespace detail
+
+struct Session::Fiber {
+    explicit Fiber(size_t stack_size)
+        : stack(stack_size) {
+    }
+
+    ExecutionStack stack;
+    ucontext_t context{};
+    ostringstream output;
+    SimpleContext session_context{output};
+};
+
+Session::Session(Scheduler& scheduler, size_t worker, function<void(Context&)> body)
+: scheduler_(scheduler)
+, worker_(worker)
+, body_(move(body))
+, fiber_(make_unique<Fiber>(scheduler.options_.stack_size)) {
+    getcontext(&fiber_->context);
+    const StackBounds bounds = fiber_->stack.GetBounds();
+    fiber_->context.uc_stack.ss_sp = const_cast<char*>(bounds.low);
+    fiber_->context.uc_stack.ss_size = bounds.size;
+    fiber_->context.uc_link = nullptr;
+    makecontext(&fiber_->context, &Session::Enter, 0);
+}
+
+Session::~Session() = default;
+
+void Session::PushInput(string line) {
+    {
+        lock_guard lock(mutex_);
+        input_.push_back(move(line));
+        if (state_ != State::WAITING) {
+            return;
+        }
+        state_ = State::READY;
+    }
+    scheduler_.MakeReady(shared_from_this());
+}
+
+void Session::CloseInput() {
+    {
+        lock_guard lock(mutex_);
+        input_closed_ = true;
+        if (state_ != State::WAITING) {
+            return;
+        }
+        state_ = State::READY;
+    }
+    scheduler_.MakeReady(shared_from_this());
+}
+
+string Session::TakeOutput() {
+    lock_guard lock(mutex_);
+    return exchange(output_, string());
+}
+
+void Session::Wait() {
+    unique_lock lock(mutex_);
+    finished_.wait(lock, [this] {
+        return state_ == State::FINISHED && !fiber_;
+    });
+}
+
+bool Session::IsFinished() const {
+    lock_guard lock(mutex_);
+    return state_ == State::FINISHED;
+}
+
+string Session::GetError() const {
+    lock_guard lock(mutex_);
+    return error_;
+}
+
+SessionStats Session::GetStats() const {
+    lock_guard lock(mutex_);
+    return stats_;
+}
+
+optional<string> Session::ReadLine() {
+    Session* session = current_session;
+    if (!session) {
+        throw runtime_error("read_line() can only be called in a scheduler session"s);
+    }
+    for (;;) {
+        {
+            lock_guard lock(session->mutex_);
+            if (!session->input_.empty()) {
+                string line = move(session->input_.front());
+                session->input_.pop_front();
+                return line;
+            }
+            if (session->input_closed_) {
+                return nullopt;
+            }
+            // PushInput может вернуть сессию в очередь ещё до того, как она уступит поток,
+            // но рабочий поток возьмёт её из очереди только после переключения
+            session->state_ = State::WAITING;
+            ++session->stats_.input_waits;
+        }
+        session->Suspend();
+    }
+}
+
+void Session::Enter() {
+    Session* session = current_session;
+    session->Run();
+    // Стек сессии больше не используется: рабочий поток освободит его
+    setcontext(worker_context);
+}
+
+void Session::Run() {
+    string error;
+    try {
+        body_(fiber_->session_context);
+    } catch (const exception& e) {
+        error = e.what();
+    } catch (...) {
+        error = "Unknown error"s;
+    }
+    FlushOutput();
+    lock_guard lock(mutex_);
+    error_ = move(error);
+    state_ = State::FINISHED;
+}
+
+void Session::Suspend() {
+    FlushOutput();
+    // Регион, учёт памяти и выводимые контейнеры сессии не должны достаться другим сессиям
+    // этого потока. Деструкторы вернут их после возобновления
+    Region::Scope detached(nullptr);
+    MemoryAccount::Scope detached_account(nullptr);
+    detail::DetachedContainers detached_containers;
+    swapcontext(&fiber_->context, worker_context);
+}
+
+void Session::FlushOutput() {
+    string text = fiber_->output.str();
+    if (text.empty()) {
+        return;
+    }
+    fiber_->output.str({});
+    lock_guard lock(mutex_);
+    output_ += text;
+}
+
+Scheduler::Scheduler(SchedulerOptions options)
+: options_(options) {
+    size_t thread_count = options_.threads;
+    if (thread_count == 0) {
+        thread_count = max(thread::hardware_concurrency(), 1U);
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(make_unique<Worker>());
+    }
+    for (auto& worker : workers_) {
+        worker->thread = thread([this, &worker = *worker] {
+            RunWorker(worker);
+        });
+    }
+    stats_.threads = thread_count;
+}
+
+Scheduler::~Scheduler() {
+    vector<shared_ptr<Session>> sessions;
+    {
+        lock_guard lock(mutex_);
+        sessions.assign(live_.begin(), live_.end());
+    }
+    for (auto& session : sessions) {
+        session->CloseInput();
+    }
+    for (auto& session : sessions) {
+        session->Wait();
+    }
+    for (auto& worker : workers_) {
+        {
+            lock_guard lock(worker->mutex);
+            worker->stopping = true;
+        }
+        worker->ready_cv.notify_one();
+        worker->thread.join();
+    }
+}
+
+shared_ptr<Session> Scheduler::Start(Body body) {
+    size_t index = 0;
+    size_t least_sessions = SIZE_MAX;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        lock_guard lock(workers_[i]->mutex);
+        if (workers_[i]->sessions < least_sessions) {
+            least_sessions = workers_[i]->sessions;
+            index = i;
+        }
+    }
+    shared_ptr<Session> session(new Session(*this, index, move(body)));
+    {
+        lock_guard lock(mutex_);
+        live_.insert(session);
+        ++stats_.sessions;
+    }
+    {
+        lock_guard lock(workers_[index]->mutex);
+        ++workers_[index]->sessions;
+    }
+    MakeReady(session);
+    return session;
+}
+
+SchedulerStats Scheduler::GetStats() const {
+    lock_guard lock(mutex_);
+    SchedulerStats stats = stats_;
+    stats.waiting = count_if(live_.begin(), live_.end(), [](const shared_ptr<Session>& session) {
+        lock_guard session_lock(session->mutex_);
+        return session->state_ == Session::State::WAITING;
+    });
+    return stats;
+}
+
+void Scheduler::MakeReady(shared_ptr<Session> session) {
+    Worker& worker = *workers_[session->worker_];
+    {
+        lock_guard lock(worker.mutex);
+        worker.ready.push_back(move(session));
+    }
+    worker.ready_cv.notify_one();
+}
+
+void Scheduler::RunWorker(Worker& worker) {
+    for (;;) {
+        shared_ptr<Session> session;
+        {
+            unique_lock lock(worker.mutex);
+            worker.ready_cv.wait(lock, [&worker] {
+                return worker.stopping || !worker.ready.empty();
+            });
+            if (worker.ready.empty()) {
+                break;
+            }
+            session = move(worker.ready.front());
+            worker.ready.pop_front();
+        }
+        Resume(session);
+    }
+}
+
+void Scheduler::Resume(const shared_ptr<Session>& session) {
+    {
+        lock_guard lock(session->mutex_);
+        session->state_ = Session::State::RUNNING;
+        ++session->stats_.slices;
+    }
+
+    ucontext_t context;
+    current_session = session.get();
+    worker_context = &context;
+    slice_length = options_.time_slice;
+    const StackBounds previous = SetStackBounds(session->fiber_->stack.GetBounds());
+    const auto start = chrono::steady_clock::now();
+    slice_start = start;
+    detail::yield_countdown = YIELD_CHECK_INTERVAL;
+    const detail::LimitState previous_limits = detail::ExchangeLimitState(session->limits_);
+
+    swapcontext(&context, &session->fiber_->context);
+
+    session->limits_ = detail::ExchangeLimitState(previous_limits);
+    const auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+    detail::yield_countdown = LONG_MAX;
+    SetStackBounds(previous);
+    current_session = nullptr;
+    worker_context = nullptr;
+
+    Session::State state;
+    bool preempted = false;
+    {
+        lock_guard lock(session->mutex_);
+        session->stats_.run_time += elapsed;
+        if (session->state_ == Session::State::RUNNING) {
+            // Квант исчерпан: сессия встаёт в конец очереди
+            session->state_ = Session::State::READY;
+            ++session->stats_.preemptions;
+            preempted = true;
+        }
+        state = session->state_;
+    }
+    {
+        lock_guard lock(mutex_);
+        ++stats_.switches;
+        stats_.max_slice = max(stats_.max_slice, elapsed);
+        if (preempted) {
+            ++stats_.preemptions;
+        }
+    }
+
+    if (preempted) {
+        MakeReady(session);
+    } else if (state == Session::State::FINISHED) {
+        Worker& worker = *workers_[session->worker_];
+        {
+            lock_guard lock(worker.mutex);
+            --worker.sessions;
+        }
+        {
+            lock_guard lock(mutex_);
+            live_.erase(session);
+            ++stats_.finished;
+        }
+        // Session::Wait возвращается, когда стек сессии освобождён и статистика обновлена
+        {
+            lock_guard lock(session->mutex_);
+            session->fiber_.reset();
+        }
+        session->finished_.notify_all();
+    }
+    // Сессию, ожидающую ввода, в очередь вернёт PushInput или CloseInput. Если они успели
+    // это сделать до переключения, сессия уже стоит в очереди в состоянии READY
+}
+
+void RegisterSessionFunctions(NativeRegistry& registry) {
+    registry.AddFunction("read_line"s, []() {
+        optional<string> line = Session::ReadLine();
+        return line ? ObjectHolder::Own(String(move(*line))) : ObjectHolder::None();
+    });
+}
+
+}  // namespace runtime
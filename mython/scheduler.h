@@ -0,0 +1,188 @@
+#pragma once
+
+#include "execution_limits.h"
+#include "runtime.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace runtime {
+
+class NativeRegistry;
+
+namespace detail {
+// Количество точек переключения до следующей проверки кванта времени
+extern thread_local long yield_countdown;
+void CheckTimeSlice();
+}  // namespace detail
+
+// Точка переключения: в сессии планировщика уступает поток другим сессиям,
+// если квант времени исчерпан. Вне сессий почти ничего не стоит
+inline void YieldPoint() {
+    if (--detail::yield_countdown <= 0) {
+        detail::CheckTimeSlice();
+    }
+}
+
+struct SchedulerOptions {
+    // Количество рабочих потоков. Ноль - по числу ядер
+    size_t threads = 0;
+    // Время, после которого сессия уступает поток следующей готовой сессии
+    std::chrono::microseconds time_slice{2000};
+    // Размер стека сессии. Физическая память выделяется по мере роста стека
+    size_t stack_size = 1 << 20;
+};
+
+struct SessionStats {
+    // Сколько раз сессия получала поток
+    size_t slices = 0;
+    // Сколько раз сессия была вытеснена по истечении кванта
+    size_t preemptions = 0;
+    // Сколько раз сессия приостанавливалась в ожидании ввода
+    size_t input_waits = 0;
+    std::chrono::nanoseconds run_time{0};
+};
+
+struct SchedulerStats {
+    size_t threads = 0;
+    // Количество запущенных, завершённых и ожидающих ввода сессий
+    size_t sessions = 0;
+    size_t finished = 0;
+    size_t waiting = 0;
+    // Количество переключений рабочих потоков на сессии и вытеснений по кванту
+    size_t switches = 0;
+    size_t preemptions = 0;
+    // Самый долгий непрерывный отрезок выполнения одной сессии
+    std::chrono::nanoseconds max_slice{0};
+};
+
+class Scheduler;
+
+/*
+ * Сессия - программа, выполняемая планировщиком на собственном стеке в куче
+ * со своим контекстом. Вывод print накапливается в сессии, а ввод поступает через PushInput
+ */
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    ~Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // Добавляет строку ввода и будит сессию, если она её ждёт
+    void PushInput(std::string line);
+    // Сообщает сессии о конце ввода
+    void CloseInput();
+
+    // Возвращает вывод, накопленный с предыдущего вызова
+    [[nodiscard]] std::string TakeOutput();
+
+    // Дожидается завершения сессии
+    void Wait();
+    [[nodiscard]] bool IsFinished() const;
+    // Возвращает сообщение об ошибке, завершившей сессию, либо пустую строку
+    [[nodiscard]] std::string GetError() const;
+    [[nodiscard]] SessionStats GetStats() const;
+
+    // Приостанавливает текущую сессию до появления строки ввода. Возвращает строку
+    // либо nullopt в конце ввода. Выбрасывает runtime_error, если вызвана вне сессии
+    static std::optional<std::string> ReadLine();
+
+private:
+    friend class Scheduler;
+    friend void detail::CheckTimeSlice();
+    struct Fiber;
+
+    enum class State { READY, RUNNING, WAITING, FINISHED };
+
+    Session(Scheduler& scheduler, size_t worker, std::function<void(Context&)> body);
+
+    // Выполняется на стеке сессии
+    static void Enter();
+    void Run();
+    // Возвращает управление рабочему потоку
+    void Suspend();
+    void FlushOutput();
+
+    Scheduler& scheduler_;
+    const size_t worker_;
+    std::function<void(Context&)> body_;
+    std::unique_ptr<Fiber> fiber_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable finished_;
+    State state_ = State::READY;
+    std::deque<std::string> input_;
+    bool input_closed_ = false;
+    std::string output_;
+    std::string error_;
+    SessionStats stats_;
+    // Ограничения выполнения сессии. Действуют в рабочем потоке, пока выполняется сессия
+    detail::LimitState limits_;
+};
+
+/*
+ * Кооперативный планировщик M:N: множество сессий выполняется на нескольких рабочих потоках.
+ * Сессия уступает поток в точках переключения (вызовы методов и функций, итерации циклов)
+ * по истечении кванта времени, а также в ожидании ввода, не занимая при этом поток.
+ *
+ * Каждая сессия закреплена за одним рабочим потоком, выбранным при запуске по наименьшей
+ * загрузке: объекты сессии учитываются сборщиком этого потока, и сессия не переходит
+ * в другой поток. Готовые сессии потока выполняются по кругу с равными квантами
+ */
+class Scheduler {
+public:
+    using Body = std::function<void(Context&)>;
+
+    explicit Scheduler(SchedulerOptions options = {});
+    // Закрывает ввод всех сессий, дожидается их завершения и останавливает потоки
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Запускает сессию, выполняющую body с контекстом сессии
+    std::shared_ptr<Session> Start(Body body);
+
+    [[nodiscard]] SchedulerStats GetStats() const;
+
+private:
+    friend class Session;
+
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable ready_cv;
+        std::deque<std::shared_ptr<Session>> ready;
+        // Количество незавершённых сессий, закреплённых за потоком
+        size_t sessions = 0;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    void MakeReady(std::shared_ptr<Session> session);
+    void RunWorker(Worker& worker);
+    void Resume(const std::shared_ptr<Session>& session);
+
+    const SchedulerOptions options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    mutable std::mutex mutex_;
+    std::unordered_set<std::shared_ptr<Session>> live_;
+    SchedulerStats stats_;
+};
+
+// Регистрирует функцию read_line(), которая приостанавливает сессию планировщика
+// до появления строки ввода и возвращает её либо None в конце ввода
+void RegisterSessionFunctions(NativeRegistry& registry);
+
+}  // namespace runtime
@@ -0,0 +1,427 @@
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string_view>
+#include <utility>
+
+using namespace std;
+
+namespace server {
+
+namespace {
+
+const string RELOAD_REQUEST = ":reload "s;
+
+runtime_error SocketError(const string& what) {
+    return runtime_error(what + ": "s + strerror(errno));
+}
+
+sockaddr_un MakeAddress(const string& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Invalid socket path "s + socket_path);
+    }
+    memcpy(address.sun_path, socket_path.data(), socket_path.size());
+    return address;
+}
+
+void SendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        // MSG_NOSIGNAL: закрытое клиентом соединение не должно завершать процесс сигналом SIGPIPE
+        const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SocketError("Cannot send"s);
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+}
+
+// Дочитывает данные из сокета в buffer. Возвращает false в конце потока
+bool Receive(int fd, string& buffer) {
+    char chunk[4096];
+    for (;;) {
+        const ssize_t received = read(fd, chunk, sizeof(chunk));
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SocketError("Cannot receive"s);
+        }
+        buffer.append(chunk, static_cast<size_t>(received));
+        return received > 0;
+    }
+}
+
+// Извлекает из сокета строку без перевода строки. Возвращает false, если поток
+// закончился до перевода строки
+bool ReceiveLine(int fd, string& buffer, string& line) {
+    size_t line_end;
+    while ((line_end = buffer.find('\n')) == string::npos) {
+        if (!Receive(fd, buffer)) {
+            return false;
+        }
+    }
+    line = buffer.substr(0, line_end);
+    buffer.erase(0, line_end + 1);
+    return true;
+}
+
+// Клиент закрыл соединение: выполнять его запрос дальше незачем
+class ClientDisconnectedError : public runtime_error {
+public:
+    ClientDisconnectedError()
+        : runtime_error("Client disconnected"s) {
+    }
+};
+
+/*
+ * Контекст запроса: вывод сценария передаётся клиенту кадрами output по мере накопления.
+ * Остаток вывода отправляется вместе с завершающим кадром одним вызовом send,
+ * поэтому ответ на короткий сценарий занимает одну запись в сокет.
+ * Если клиент закрыл соединение, вывод выбрасывает ClientDisconnectedError и тем прерывает сценарий
+ */
+class ResponseContext : public runtime::Context {
+public:
+    ResponseContext(int fd, size_t capacity)
+        : buffer_(fd, capacity)
+        , output_(&buffer_) {
+        // Иначе поток перехватил бы исключение буфера и только установил badbit
+        output_.exceptions(ios::badbit);
+    }
+
+    ostream& GetOutputStream() override {
+        return output_;
+    }
+
+    // Отправляет завершающий кадр. Возвращает false, если клиент закрыл соединение
+    bool Finish(const string& error) {
+        return buffer_.Finish(error);
+    }
+
+private:
+    class Buffer : public streambuf {
+    public:
+        Buffer(int fd, size_t capacity)
+            : fd_(fd)
+            , capacity_(capacity) {
+        }
+
+        bool Finish(const string& error) {
+            if (error.empty()) {
+                return Send("done\n"sv);
+            }
+            return Send("error "s + to_string(error.size()) + "\n"s + error);
+        }
+
+    protected:
+        int_type overflow(int_type ch) override {
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                data_.push_back(traits_type::to_char_type(ch));
+                MaybeSend();
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        streamsize xsputn(const char* s, streamsize count) override {
+            data_.append(s, static_cast<size_t>(count));
+            MaybeSend();
+            return count;
+        }
+
+        int sync() override {
+            if (!Send({})) {
+                throw ClientDisconnectedError();
+            }
+            return 0;
+        }
+
+    private:
+        void MaybeSend() {
+            if (data_.size() >= capacity_ && !Send({})) {
+                throw ClientDisconnectedError();
+            }
+        }
+
+        // Отправляет накопленный вывод и следом tail
+        bool Send(string_view tail) {
+            string frame;
+            if (!data_.empty()) {
+                frame = "output "s + to_string(data_.size()) + "\n"s + data_;
+                data_.clear();
+            }
+            frame += tail;
+            if (broken_ || frame.empty()) {
+                return !broken_;
+            }
+            try {
+                SendAll(fd_, frame.data(), frame.size());
+            } catch (const runtime_error&) {
+                broken_ = true;
+            }
+            return !broken_;
+        }
+
+        const int fd_;
+        const size_t capacity_;
+        string data_;
+        bool broken_ = false;
+    };
+
+    Buffer buffer_;
+    ostream output_;
+};
+
+}  // namespace
+
+Daemon::Daemon(DaemonOptions options, ParseOptions parse_options)
+: options_(move(options))
+, runner_(move(parse_options)) {
+    const sockaddr_un address = MakeAddress(options_.socket_path);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        throw SocketError("Cannot create socket"s);
+    }
+    // Сокет, оставшийся от прежнего запуска, заменяется. Другие файлы не удаляются
+    struct stat info{};
+    if (lstat(options_.socket_path.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            close(listen_fd_);
+            throw runtime_error("Cannot listen on "s + options_.socket_path + ": the file exists and is not a socket"s);
+        }
+        unlink(options_.socket_path.c_str());
+    }
+    if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listen_fd_, SOMAXCONN) < 0) {
+        const runtime_error error = SocketError("Cannot listen on "s + options_.socket_path);
+        close(listen_fd_);
+        throw error;
+    }
+}
+
+Daemon::~Daemon() {
+    Stop();
+    JoinFinished();
+    close(listen_fd_);
+    unlink(options_.socket_path.c_str());
+}
+
+void Daemon::Serve() {
+    while (!stopping_) {
+        if (options_.max_connections > 0) {
+            unique_lock lock(mutex_);
+            closed_.wait(lock, [this] {
+                return stopping_ || connections_.size() < options_.max_connections;
+            });
+            if (stopping_) {
+                break;
+            }
+        }
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (stopping_) {
+                break;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw SocketError("Cannot accept connection"s);
+        }
+        JoinFinished();
+        lock_guard lock(mutex_);
+        ++stats_.connections;
+        // Поток соединения удаляет себя из connections_ под тем же мьютексом,
+        // поэтому не может сделать это раньше, чем будет добавлен
+        connections_.emplace(fd, thread([this, fd] {
+            HandleConnection(fd);
+        }));
+        // Stop мог не застать это соединение
+        if (stopping_) {
+            shutdown(fd, SHUT_RD);
+        }
+    }
+    {
+        unique_lock lock(mutex_);
+        closed_.wait(lock, [this] {
+            return connections_.empty();
+        });
+    }
+    JoinFinished();
+}
+
+void Daemon::Stop() {
+    if (stopping_.exchange(true)) {
+        return;
+    }
+    // Будит accept. Открытые соединения дочитываются до конца: ожидающий следующего запроса
+    // поток получит конец потока, а выполняемый запрос будет завершён и отправлен
+    shutdown(listen_fd_, SHUT_RDWR);
+    lock_guard lock(mutex_);
+    for (const auto& [fd, connection] : connections_) {
+        shutdown(fd, SHUT_RD);
+    }
+    // Будит Serve, ожидающий закрытия соединения при исчерпании max_connections
+    closed_.notify_all();
+}
+
+void Daemon::Reload(const string& path) {
+    runner_.Reload(path);
+    lock_guard lock(mutex_);
+    ++stats_.reloads;
+}
+
+DaemonStats Daemon::GetStats() const {
+    lock_guard lock(mutex_);
+    return stats_;
+}
+
+void Daemon::HandleConnection(int fd) {
+    string buffer;
+    string line;
+    try {
+        while (!stopping_ && ReceiveLine(fd, buffer, line)) {
+            ResponseContext context(fd, options_.output_buffer);
+            batch::JobResult result;
+            if (line.rfind(RELOAD_REQUEST, 0) == 0) {
+                try {
+                    Reload(batch::ResolvePath(line.substr(RELOAD_REQUEST.size()), options_.base_dir));
+                } catch (const exception& e) {
+                    result.error = e.what();
+                }
+            } else {
+                istringstream request(line);
+                auto jobs = batch::ReadManifest(request, options_.base_dir);
+                if (jobs.empty()) {
+                    result.error = "Empty request"s;
+                } else {
+                    jobs.front().limits = options_.limits;
+                    jobs.front().memory_quota = options_.memory_quota;
+                    result = runner_.RunJob(jobs.front(), context);
+                }
+            }
+            const bool sent = context.Finish(result.error);
+            {
+                lock_guard lock(mutex_);
+                ++stats_.requests;
+                if (!result.error.empty()) {
+                    ++stats_.failed;
+                }
+            }
+            if (!sent) {
+                break;
+            }
+        }
+    } catch (const runtime_error&) {
+        // Ошибка чтения означает, что соединение разорвано
+    }
+
+    {
+        lock_guard lock(mutex_);
+        auto it = connections_.find(fd);
+        finished_.push_back(move(it->second));
+        connections_.erase(it);
+    }
+    closed_.notify_all();
+    // Дескриптор закрывается после удаления из connections_, иначе accept мог бы
+    // вернуть его новому соединению раньше
+    close(fd);
+}
+
+void Daemon::JoinFinished() {
+    vector<thread> finished;
+    {
+        lock_guard lock(mutex_);
+        finished.swap(finished_);
+    }
+    for (thread& t : finished) {
+        t.join();
+    }
+}
+
+Client::Client(const string& socket_path) {
+    const sockaddr_un address = MakeAddress(socket_path);
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        throw SocketError("Cannot create socket"s);
+    }
+    if (connect(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        const runtime_error error = SocketError("Cannot connect to "s + socket_path);
+        close(fd_);
+        throw error;
+    }
+}
+
+Client::~Client() {
+    close(fd_);
+}
+
+string Client::Run(const batch::Job& job, ostream& output) {
+    string request = job.script;
+    if (!job.input.empty()) {
+        request += " "s + job.input;
+    }
+    return Request(request, output);
+}
+
+string Client::Reload(const string& path) {
+    ostringstream output;
+    return Request(RELOAD_REQUEST + path, output);
+}
+
+string Client::Request(const string& request, ostream& output) {
+    const string line = request + "\n"s;
+    SendAll(fd_, line.data(), line.size());
+
+    for (;;) {
+        const string frame = ReadLine();
+        if (frame == "done"sv) {
+            return {};
+        }
+        istringstream header(frame);
+        string kind;
+        size_t size = 0;
+        if (!(header >> kind >> size) || (kind != "output"sv && kind != "error"sv)) {
+            throw runtime_error("Unexpected daemon response: "s + frame);
+        }
+        string data(size, '\0');
+        ReadExactly(data.data(), size);
+        if (kind == "error"sv) {
+            return data;
+        }
+        output << data;
+    }
+}
+
+string Client::ReadLine() {
+    string line;
+    if (!ReceiveLine(fd_, buffer_, line)) {
+        throw runtime_error("Connection to daemon closed"s);
+    }
+    return line;
+}
+
+void Client::ReadExactly(char* data, size_t size) {
+    while (buffer_.size() < size) {
+        if (!Receive(fd_, buffer_)) {
+            throw runtime_error("Connection to daemon closed"s);
+        }
+    }
+    memcpy(data, buffer_.data(), size);
+    buffer_.erase(0, size);
+}
+
+}  // namespace server
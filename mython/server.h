@@ -0,0 +1,135 @@
+#pragma once
+
+#include "batch.h"
+#include "parse.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace server {
+
+/*
+ * Протокол демона. Клиент передаёт запросы строками в формате манифеста пакета:
+ * путь к сценарию и, через пробел, необязательный путь к входным данным.
+ * На каждый запрос демон отвечает последовательностью кадров:
+ *   output <n>\n<n байт вывода>   - очередной фрагмент вывода, по мере выполнения
+ *   done\n                        - сценарий выполнен успешно
+ *   error <n>\n<n байт сообщения> - сценарий завершился ошибкой
+ * Ответ заканчивается кадром done или error, после чего по тому же соединению
+ * можно передать следующий запрос.
+ * Запрос ":reload <путь>" перезагружает файл (см. Daemon::Reload) и получает ответ
+ * done либо error с сообщением об ошибке разбора
+ */
+
+struct DaemonOptions {
+    // Путь к сокету. Оставшийся от прежнего запуска файл сокета удаляется
+    std::string socket_path;
+    // Каталог, от которого отсчитываются относительные пути в запросах
+    std::string base_dir;
+    // Размер, при достижении которого вывод сценария отправляется клиенту
+    size_t output_buffer = 4096;
+    // Ограничения топлива и времени выполнения каждого запроса
+    runtime::ExecutionLimits limits;
+    // Квота памяти объектов каждого запроса в байтах. Ноль - без ограничения
+    size_t memory_quota = 0;
+    // Количество одновременно обслуживаемых соединений. Следующие соединения ждут в очереди
+    // сокета, пока не закроется одно из обслуживаемых. Ноль - без ограничения
+    size_t max_connections = 64;
+};
+
+struct DaemonStats {
+    size_t connections = 0;
+    size_t requests = 0;
+    // Количество запросов, завершившихся ошибкой
+    size_t failed = 0;
+    size_t reloads = 0;
+};
+
+/*
+ * Демон, выполняющий сценарии по запросам через локальный Unix-сокет.
+ * Разобранные программы и модули остаются в памяти между запросами: каждый файл
+ * разбирается один раз за время жизни демона. Каждый запрос выполняется с собственными
+ * глобальными переменными, а его вывод передаётся клиенту по мере выполнения.
+ * Соединения обслуживаются отдельными потоками, запросы одного соединения - по очереди.
+ * Если клиент отключился, его запрос прерывается при следующей отправке вывода
+ */
+class Daemon {
+public:
+    // Создаёт сокет и начинает принимать соединения. Сокет, оставшийся по пути socket_path
+    // от прежнего запуска, заменяется. Выбрасывает runtime_error, если сокет создать не удалось
+    // либо по этому пути находится файл другого типа
+    explicit Daemon(DaemonOptions options, ParseOptions parse_options = {});
+    // Останавливает демона и удаляет файл сокета. Serve к этому моменту должен завершиться
+    ~Daemon();
+
+    Daemon(const Daemon&) = delete;
+    Daemon& operator=(const Daemon&) = delete;
+
+    // Обслуживает соединения, пока не будет вызван Stop. Возвращает управление,
+    // когда все соединения закрыты
+    void Serve();
+    // Прекращает приём соединений и закрывает открытые соединения после текущих запросов.
+    // Может вызываться из любого потока
+    void Stop();
+
+    // Заново разбирает файл path и публикует новую программу, не дожидаясь выполняемых
+    // запросов: они завершаются со старой программой, а следующие выполняют новую.
+    // Выбрасывает ParseError, если файл не удалось разобрать; тогда остаётся прежняя программа
+    void Reload(const std::string& path);
+
+    [[nodiscard]] DaemonStats GetStats() const;
+
+private:
+    void HandleConnection(int fd);
+    // Присоединяет потоки закрытых соединений
+    void JoinFinished();
+
+    const DaemonOptions options_;
+    batch::BatchRunner runner_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stopping_ = false;
+
+    mutable std::mutex mutex_;
+    // Потоки открытых соединений по дескрипторам сокетов
+    std::map<int, std::thread> connections_;
+    std::condition_variable closed_;
+    std::vector<std::thread> finished_;
+    DaemonStats stats_;
+};
+
+// Соединение с демоном
+class Client {
+public:
+    // Выбрасывает runtime_error, если подключиться не удалось
+    explicit Client(const std::string& socket_path);
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    // Выполняет задание в демоне, выводя его вывод в output по мере поступления.
+    // Возвращает сообщение об ошибке сценария либо пустую строку. Выбрасывает runtime_error,
+    // если соединение прервано
+    std::string Run(const batch::Job& job, std::ostream& output);
+    // Перезагружает файл path в демоне. Возвращает сообщение об ошибке разбора либо пустую строку
+    std::string Reload(const std::string& path);
+
+private:
+    // Отправляет запрос и выводит вывод ответа в output. Возвращает сообщение об ошибке
+    std::string Request(const std::string& request, std::ostream& output);
+    // Читает из сокета строку кадра без перевода строки
+    std::string ReadLine();
+    void ReadExactly(char* data, size_t size);
+
+    int fd_ = -1;
+    std::string buffer_;
+};
+
+}  // namespace server
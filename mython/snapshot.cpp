@@ -0,0 +1,475 @@
+#include "snapshot.h"
+
+#include "lexer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+using namespace std;
+using runtime::ObjectHolder;
+
+namespace snapshot {
+
+namespace {
+
+/*
+ * Формат файла снимка. Все числа записаны в порядке байтов машины, создавшей снимок.
+ *   Header
+ *   текст программы
+ *   глобальные переменные: имя и ссылка на объект
+ *   записи объектов: тег и содержимое
+ *   смещения записей объектов относительно начала записей, по одному на объект
+ * Строки записываются как длина и байты, ссылки - как номера объектов
+ */
+constexpr char MAGIC[8] = {'M', 'Y', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t VERSION = 1;
+// Ссылка на None
+constexpr uint32_t NONE_REF = UINT32_MAX;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_count;
+    uint64_t global_count;
+    uint64_t source_offset;
+    uint64_t source_size;
+    uint64_t globals_offset;
+    uint64_t records_offset;
+    uint64_t offsets_offset;
+};
+
+enum class Tag : uint8_t { NUMBER, STRING, BOOL, CLASS, FUNCTION, INSTANCE, LIST, DICT };
+
+class Writer {
+public:
+    template <typename T>
+    void Put(T value) {
+        data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void PutString(string_view text) {
+        Put<uint64_t>(text.size());
+        data_.append(text);
+    }
+
+    [[nodiscard]] size_t GetSize() const {
+        return data_.size();
+    }
+
+    string& Data() {
+        return data_;
+    }
+
+private:
+    string data_;
+};
+
+class Reader {
+public:
+    Reader(const char* data, size_t size, size_t offset)
+        : data_(data)
+        , size_(size)
+        , offset_(offset) {
+    }
+
+    template <typename T>
+    T Get() {
+        T value;
+        memcpy(&value, Take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    string_view GetString() {
+        const auto size = Get<uint64_t>();
+        if (size > size_) {
+            throw runtime_error("Corrupted snapshot"s);
+        }
+        return {Take(size), size};
+    }
+
+private:
+    const char* Take(size_t size) {
+        if (offset_ > size_ || size_ - offset_ < size) {
+            throw runtime_error("Corrupted snapshot"s);
+        }
+        const char* result = data_ + offset_;
+        offset_ += size;
+        return result;
+    }
+
+    const char* data_;
+    size_t size_;
+    size_t offset_;
+};
+
+// Записывает граф объектов, обходя его в ширину, поэтому глубина графа не ограничена стеком
+class Encoder {
+public:
+    uint32_t Ref(const ObjectHolder& value) {
+        if (!value) {
+            return NONE_REF;
+        }
+        auto [it, inserted] = indices_.emplace(value.Get(), static_cast<uint32_t>(objects_.size()));
+        if (inserted) {
+            if (objects_.size() >= NONE_REF) {
+                throw runtime_error("Too many objects for a snapshot"s);
+            }
+            objects_.push_back(value);
+        }
+        return it->second;
+    }
+
+    // Записывает объекты, начиная с уже получивших номера. Записи идут в порядке номеров
+    void EncodeObjects(Writer& records, vector<uint64_t>& offsets) {
+        for (size_t i = 0; i < objects_.size(); ++i) {
+            offsets.push_back(records.GetSize());
+            // Ссылка копируется: Ref может перераспределить objects_
+            const ObjectHolder value = objects_[i];
+            Encode(value, records);
+        }
+    }
+
+    [[nodiscard]] size_t GetObjectCount() const {
+        return objects_.size();
+    }
+
+private:
+    void Encode(const ObjectHolder& value, Writer& out) {
+        using namespace runtime;
+        if (auto number = value.TryAs<Number>()) {
+            out.Put(Tag::NUMBER);
+            out.Put<int32_t>(number->GetValue());
+        } else if (auto str = value.TryAs<String>()) {
+            out.Put(Tag::STRING);
+            out.PutString(str->GetValue());
+        } else if (auto boolean = value.TryAs<Bool>()) {
+            out.Put(Tag::BOOL);
+            out.Put<uint8_t>(boolean->GetValue() ? 1 : 0);
+        } else if (auto cls = value.TryAs<Class>()) {
+            out.Put(Tag::CLASS);
+            out.PutString(cls->GetName());
+        } else if (auto function = value.TryAs<Function>()) {
+            out.Put(Tag::FUNCTION);
+            out.PutString(function->GetMethod().name);
+        } else if (auto instance = value.TryAs<ClassInstance>()) {
+            out.Put(Tag::INSTANCE);
+            // Класс экземпляра принадлежит программе и разделяется всеми ссылками на него
+            out.Put(Ref(ObjectHolder::Share(const_cast<Class&>(instance->GetClass()))));
+            vector<pair<string_view, const ObjectHolder*>> fields;
+            for (const auto& [name, field] : instance->Fields()) {
+                fields.emplace_back(name, &field);
+            }
+            // Поля упорядочиваются, чтобы снимок не зависел от порядка в хеш-таблице
+            sort(fields.begin(), fields.end());
+            out.Put<uint64_t>(fields.size());
+            for (const auto& [name, field] : fields) {
+                out.PutString(name);
+                out.Put(Ref(*field));
+            }
+        } else if (auto list = value.TryAs<List>()) {
+            out.Put(Tag::LIST);
+            out.Put<uint64_t>(list->Items().size());
+            for (const ObjectHolder& item : list->Items()) {
+                out.Put(Ref(item));
+            }
+        } else if (auto dict = value.TryAs<Dict>()) {
+            out.Put(Tag::DICT);
+            out.Put<uint64_t>(dict->GetSize());
+            dict->ForEachItem([this, &out](const ObjectHolder& key, const ObjectHolder& item) {
+                out.Put(Ref(key));
+                out.Put(Ref(item));
+            });
+        } else {
+            throw runtime_error(
+                "Only numbers, strings, bools, lists, dicts, class instances, classes "
+                "and functions can be saved in a snapshot"s);
+        }
+    }
+
+    unordered_map<const runtime::Object*, uint32_t> indices_;
+    vector<ObjectHolder> objects_;
+};
+
+runtime_error FileError(const string& what, const string& path) {
+    return runtime_error(what + path + ": "s + strerror(errno));
+}
+
+// Собирает классы и функции программы и импортированных ею модулей
+void CollectDeclarations(const parse::Module& module, unordered_set<const parse::Module*>& visited,
+                         unordered_map<string, ObjectHolder>& classes,
+                         unordered_map<string, ObjectHolder>& functions) {
+    if (!visited.insert(&module).second) {
+        return;
+    }
+    for (const auto& dependency : module.imports) {
+        CollectDeclarations(*dependency, visited, classes, functions);
+    }
+    for (const auto& [name, cls] : module.classes) {
+        classes.emplace(name, cls);
+    }
+    for (const auto& [name, function] : module.functions) {
+        functions.emplace(name, function);
+    }
+}
+
+}  // namespace
+
+void Save(const string& source, const string& path, runtime::Context& context,
+          const ParseOptions& options) {
+    istringstream input(source);
+    parse::Lexer lexer(input);
+    auto program = ParseProgram(lexer, options);
+    runtime::Closure globals;
+    program->Execute(globals, context);
+
+    Encoder encoder;
+    vector<pair<string, uint32_t>> global_refs;
+    for (const auto& [name, value] : globals) {
+        global_refs.emplace_back(name, encoder.Ref(value));
+    }
+    sort(global_refs.begin(), global_refs.end());
+    Writer records;
+    vector<uint64_t> offsets;
+    encoder.EncodeObjects(records, offsets);
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.object_count = static_cast<uint32_t>(encoder.GetObjectCount());
+    header.global_count = global_refs.size();
+
+    Writer out;
+    out.Put(header);
+    header.source_offset = out.GetSize();
+    header.source_size = source.size();
+    out.Data() += source;
+    header.globals_offset = out.GetSize();
+    for (const auto& [name, ref] : global_refs) {
+        out.PutString(name);
+        out.Put(ref);
+    }
+    header.records_offset = out.GetSize();
+    out.Data() += records.Data();
+    header.offsets_offset = out.GetSize();
+    for (uint64_t offset : offsets) {
+        out.Put(offset);
+    }
+    memcpy(out.Data().data(), &header, sizeof(header));
+
+    // Снимок записывается во временный файл и переименовывается, чтобы загрузка
+    // не увидела наполовину записанный файл
+    const string temp_path = path + ".tmp"s;
+    {
+        ofstream file(temp_path, ios::binary | ios::trunc);
+        file.write(out.Data().data(), static_cast<streamsize>(out.GetSize()));
+        if (!file.flush()) {
+            throw runtime_error("Cannot write snapshot "s + temp_path);
+        }
+    }
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        throw FileError("Cannot write snapshot "s, path);
+    }
+}
+
+Snapshot::Snapshot(const string& path, const ParseOptions& options) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw FileError("Cannot read snapshot "s, path);
+    }
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) != 0) {
+        const runtime_error error = FileError("Cannot read snapshot "s, path);
+        close(fd);
+        throw error;
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    void* memory = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw runtime_error("Cannot map snapshot "s + path);
+    }
+    data_ = static_cast<const char*>(memory);
+
+    try {
+        const auto header = Reader(data_, size_, 0).Get<Header>();
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            throw runtime_error("Not a snapshot file "s + path);
+        }
+        object_count_ = header.object_count;
+        global_count_ = header.global_count;
+        globals_offset_ = header.globals_offset;
+        records_offset_ = header.records_offset;
+        offsets_offset_ = header.offsets_offset;
+
+        // Программа только разбирается: её выполнение заменяет восстановление снимка
+        if (header.source_offset > size_ || size_ - header.source_offset < header.source_size) {
+            throw runtime_error("Corrupted snapshot"s);
+        }
+        istringstream source(string(data_ + header.source_offset, header.source_size));
+        parse::Lexer lexer(source);
+        auto program = make_shared<parse::Module>();
+        program->name = "snapshot"s;
+        program->path = path;
+        parse::ParseModule(lexer, options, *program);
+        program_ = move(program);
+
+        unordered_set<const parse::Module*> visited;
+        unordered_map<string, ObjectHolder> classes;
+        unordered_map<string, ObjectHolder> functions;
+        CollectDeclarations(*program_, visited, classes, functions);
+
+        // Ссылки на классы и функции разрешаются один раз при загрузке
+        declarations_.resize(object_count_);
+        Reader offsets(data_, size_, offsets_offset_);
+        for (size_t i = 0; i < object_count_; ++i) {
+            Reader record(data_, size_, records_offset_ + offsets.Get<uint64_t>());
+            const auto tag = record.Get<Tag>();
+            if (tag != Tag::CLASS && tag != Tag::FUNCTION) {
+                continue;
+            }
+            const string name(record.GetString());
+            auto& declared = tag == Tag::CLASS ? classes : functions;
+            auto it = declared.find(name);
+            if (it == declared.end()) {
+                throw runtime_error("Snapshot refers to unknown "s
+                                    + (tag == Tag::CLASS ? "class "s : "function "s) + name);
+            }
+            declarations_[i] = it->second;
+        }
+    } catch (...) {
+        munmap(const_cast<char*>(data_), size_);
+        throw;
+    }
+}
+
+Snapshot::~Snapshot() {
+    munmap(const_cast<char*>(data_), size_);
+}
+
+void Snapshot::Restore(runtime::Closure& closure, runtime::Context& context) const {
+    using namespace runtime;
+    vector<ObjectHolder> objects(object_count_);
+    vector<size_t> record_offsets(object_count_);
+    {
+        Reader offsets(data_, size_, offsets_offset_);
+        for (size_t& offset : record_offsets) {
+            offset = records_offset_ + offsets.Get<uint64_t>();
+        }
+    }
+    const auto get = [&objects](uint32_t ref) {
+        if (ref == NONE_REF) {
+            return ObjectHolder::None();
+        }
+        if (ref >= objects.size()) {
+            throw runtime_error("Corrupted snapshot"s);
+        }
+        return objects[ref];
+    };
+
+    // Сначала создаются все объекты, затем заполняются ссылки между ними, поэтому
+    // циклы восстанавливаются. Словари заполняются последними: их ключам для хеширования
+    // нужны заполненные поля
+    for (size_t i = 0; i < object_count_; ++i) {
+        Reader record(data_, size_, record_offsets[i]);
+        switch (record.Get<Tag>()) {
+            case Tag::NUMBER:
+                objects[i] = ObjectHolder::Own(Number(record.Get<int32_t>()));
+                break;
+            case Tag::STRING:
+                objects[i] = ObjectHolder::Own(String(string(record.GetString())));
+                break;
+            case Tag::BOOL:
+                objects[i] = ObjectHolder::Own(Bool(record.Get<uint8_t>() != 0));
+                break;
+            case Tag::CLASS:
+            case Tag::FUNCTION:
+                objects[i] = declarations_[i];
+                break;
+            case Tag::INSTANCE: {
+                const auto class_ref = record.Get<uint32_t>();
+                const Class* cls = class_ref < declarations_.size()
+                                       ? declarations_[class_ref].TryAs<Class>()
+                                       : nullptr;
+                if (!cls) {
+                    throw runtime_error("Corrupted snapshot"s);
+                }
+                objects[i] = ObjectHolder::Own(ClassInstance(*cls));
+                break;
+            }
+            case Tag::LIST:
+                objects[i] = ObjectHolder::Own(List());
+                break;
+            case Tag::DICT:
+                objects[i] = ObjectHolder::Own(Dict());
+                break;
+            default:
+                throw runtime_error("Corrupted snapshot"s);
+        }
+    }
+
+    for (size_t i = 0; i < object_count_; ++i) {
+        Reader record(data_, size_, record_offsets[i]);
+        const auto tag = record.Get<Tag>();
+        if (tag == Tag::INSTANCE) {
+            (void)record.Get<uint32_t>();
+            auto* instance = objects[i].TryAs<ClassInstance>();
+            const auto count = record.Get<uint64_t>();
+            for (uint64_t j = 0; j < count; ++j) {
+                string name(record.GetString());
+                instance->Fields()[move(name)] = get(record.Get<uint32_t>());
+            }
+            instance->UpdateMemoryUsage();
+        } else if (tag == Tag::LIST) {
+            auto* list = objects[i].TryAs<List>();
+            const auto count = record.Get<uint64_t>();
+            list->Items().reserve(min<uint64_t>(count, size_));
+            for (uint64_t j = 0; j < count; ++j) {
+                list->Items().push_back(get(record.Get<uint32_t>()));
+            }
+            list->UpdateMemoryUsage();
+        }
+    }
+
+    for (size_t i = 0; i < object_count_; ++i) {
+        Reader record(data_, size_, record_offsets[i]);
+        if (record.Get<Tag>() != Tag::DICT) {
+            continue;
+        }
+        auto* dict = objects[i].TryAs<Dict>();
+        const auto count = record.Get<uint64_t>();
+        for (uint64_t j = 0; j < count; ++j) {
+            const ObjectHolder key = get(record.Get<uint32_t>());
+            dict->Set(key, get(record.Get<uint32_t>()), context);
+        }
+    }
+
+    Reader globals(data_, size_, globals_offset_);
+    for (size_t i = 0; i < global_count_; ++i) {
+        string name(globals.GetString());
+        closure[move(name)] = get(globals.Get<uint32_t>());
+    }
+}
+
+size_t Snapshot::GetObjectCount() const {
+    return object_count_;
+}
+
+const shared_ptr<const parse::Module>& Snapshot::GetProgram() const {
+    return program_;
+}
+
+}  // namespace snapshot
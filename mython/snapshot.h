@@ -0,0 +1,68 @@
+#pragma once
+
+#include "module.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace snapshot {
+
+/*
+ * Выполняет программу инициализации source и сохраняет её глобальные переменные в файл path.
+ * Вместе с ними сохраняется всё достижимое из них: числа, строки, логические значения,
+ * экземпляры классов, списки и словари, а также ссылки на классы и функции по именам.
+ * Снимок перемещаем: объекты ссылаются друг на друга по номерам, а не по адресам.
+ * Текст программы тоже сохраняется в снимке: при загрузке он только разбирается,
+ * чтобы получить классы и функции. Вывод программы выводится в context.
+ * Выбрасывает ParseError при ошибке разбора и runtime_error при ошибке выполнения,
+ * записи файла либо если значение глобальной переменной нельзя сохранить
+ */
+void Save(const std::string& source, const std::string& path, runtime::Context& context,
+          const ParseOptions& options = {});
+
+/*
+ * Снимок глобальных переменных, отображённый в память. Загрузка не выполняет
+ * программу инициализации, а каждое восстановление создаёт объекты заново прямо
+ * из отображённого файла, поэтому восстановленные переменные разных запусков независимы.
+ * После загрузки снимок не изменяется и может использоваться из нескольких потоков
+ */
+class Snapshot {
+public:
+    // Отображает файл path в память и разбирает сохранённую в нём программу с параметрами
+    // options. Выбрасывает runtime_error, если файл не удалось прочитать или он повреждён
+    explicit Snapshot(const std::string& path, const ParseOptions& options = {});
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // Добавляет в closure глобальные переменные снимка. Параметр context задаёт контекст
+    // для методов __hash__ и __eq__ ключей словарей
+    void Restore(runtime::Closure& closure, runtime::Context& context) const;
+
+    // Возвращает количество объектов снимка
+    [[nodiscard]] size_t GetObjectCount() const;
+    // Возвращает программу снимка. Её можно передать в ParseOptions::prelude,
+    // чтобы программа, продолжающая снимок, могла обращаться к его классам и функциям
+    [[nodiscard]] const std::shared_ptr<const parse::Module>& GetProgram() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t object_count_ = 0;
+    // Смещения записей объектов и глобальных переменных в файле
+    size_t offsets_offset_ = 0;
+    size_t records_offset_ = 0;
+    size_t globals_offset_ = 0;
+    size_t global_count_ = 0;
+    // Программа владеет классами и функциями, на которые ссылаются объекты снимка
+    std::shared_ptr<const parse::Module> program_;
+    // Классы и функции программы по номерам объектов снимка, которые на них ссылаются
+    std::vector<runtime::ObjectHolder> declarations_;
+};
+
+}  // namespace snapshot
@@ -0,0 +1,166 @@
+#include "stack.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <new>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define MYTHON_ADDRESS_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define MYTHON_ADDRESS_SANITIZER 1
+#endif
+#endif
+
+#ifdef MYTHON_ADDRESS_SANITIZER
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+// Запас стека для кода между проверками и для раскрутки стека при исключении
+constexpr size_t STACK_RESERVE = 128 * 1024;
+
+thread_local StackBounds current_bounds;
+
+size_t PageSize() {
+    static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+void ApplyBounds(StackBounds bounds) {
+    current_bounds = bounds;
+    detail::stack_limit = bounds.low + min(STACK_RESERVE, bounds.size / 4);
+}
+
+struct RunRequest {
+    const function<void()>* fn;
+    exception_ptr error;
+    // Контекст, в который возвращается управление после выполнения fn
+    ucontext_t caller;
+    // Стек вызывающего, о возврате на который сообщается AddressSanitizer
+    const void* caller_stack = nullptr;
+    size_t caller_stack_size = 0;
+};
+
+// AddressSanitizer должен знать о переключениях стека, иначе исключение на стеке интерпретатора
+// выглядит для него как переполнение. Без него функции ничего не делают
+void StartStackSwitch([[maybe_unused]] void** fake_stack, [[maybe_unused]] const void* bottom,
+                      [[maybe_unused]] size_t size) {
+#ifdef MYTHON_ADDRESS_SANITIZER
+    __sanitizer_start_switch_fiber(fake_stack, bottom, size);
+#endif
+}
+
+void FinishStackSwitch([[maybe_unused]] void* fake_stack, [[maybe_unused]] const void** previous_bottom,
+                       [[maybe_unused]] size_t* previous_size) {
+#ifdef MYTHON_ADDRESS_SANITIZER
+    __sanitizer_finish_switch_fiber(fake_stack, previous_bottom, previous_size);
+#endif
+}
+
+// Запрос, который начинает выполнять RunOnStack. makecontext передаёт функции только
+// аргументы типа int, поэтому указатель передаётся через переменную потока
+thread_local RunRequest* starting_request = nullptr;
+
+void RunOnStack() {
+    RunRequest* request = starting_request;
+    FinishStackSwitch(nullptr, &request->caller_stack, &request->caller_stack_size);
+    // Исключение не может покинуть стек: оно передаётся вызывающему через request
+    try {
+        (*request->fn)();
+    } catch (...) {
+        request->error = current_exception();
+    }
+    // Стек больше не используется: управление возвращается в request->caller
+    StartStackSwitch(nullptr, request->caller_stack, request->caller_stack_size);
+}
+}  // namespace
+
+namespace detail {
+
+thread_local const char* stack_limit = nullptr;
+
+void ThrowStackOverflow() {
+    using namespace std::literals;
+    throw StackOverflowError("Stack overflow: the interpreter stack budget of "s
+                             + to_string(current_bounds.size) + " bytes is exhausted"s);
+}
+
+void InitStackLimit() {
+    pthread_attr_t attr;
+    void* address = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &address, &size);
+        pthread_attr_destroy(&attr);
+    }
+    ApplyBounds({static_cast<const char*>(address), size});
+}
+
+}  // namespace detail
+
+StackBounds SetStackBounds(StackBounds bounds) {
+    if (!detail::stack_limit) {
+        detail::InitStackLimit();
+    }
+    const StackBounds previous = current_bounds;
+    ApplyBounds(bounds);
+    return previous;
+}
+
+ExecutionStack::ExecutionStack(size_t size)
+: size_((max<size_t>(size, PTHREAD_STACK_MIN) + PageSize() - 1) / PageSize() * PageSize()) {
+    // Нижняя страница защищает память за пределами стека
+    memory_ = mmap(nullptr, size_ + PageSize(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (memory_ == MAP_FAILED) {
+        throw bad_alloc();
+    }
+    mprotect(memory_, PageSize(), PROT_NONE);
+}
+
+ExecutionStack::~ExecutionStack() {
+    munmap(memory_, size_ + PageSize());
+}
+
+void ExecutionStack::Run(const function<void()>& fn) {
+    RunRequest request{&fn, nullptr, {}};
+    ucontext_t context;
+    getcontext(&context);
+    context.uc_stack.ss_sp = static_cast<char*>(memory_) + PageSize();
+    context.uc_stack.ss_size = size_;
+    context.uc_link = &request.caller;
+    makecontext(&context, RunOnStack, 0);
+
+    starting_request = &request;
+    const StackBounds previous = SetStackBounds(GetBounds());
+    void* fake_stack = nullptr;
+    StartStackSwitch(&fake_stack, context.uc_stack.ss_sp, size_);
+    swapcontext(&request.caller, &context);
+    FinishStackSwitch(fake_stack, nullptr, nullptr);
+    SetStackBounds(previous);
+
+    if (request.error) {
+        rethrow_exception(request.error);
+    }
+}
+
+size_t ExecutionStack::GetSize() const {
+    return size_;
+}
+
+StackBounds ExecutionStack::GetBounds() const {
+    return {static_cast<const char*>(memory_) + PageSize(), size_};
+}
+
+}  // namespace runtime
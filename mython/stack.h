@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+namespace runtime {
+
+// Ошибка, выбрасываемая при исчерпании стека интерпретатора
+class StackOverflowError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Границы стека: нижний адрес и размер
+struct StackBounds {
+    const char* low = nullptr;
+    size_t size = 0;
+};
+
+/*
+ * Стек исполнения заданного размера, размещённый в куче.
+ * Память резервируется целиком, но физические страницы выделяются по мере роста стека,
+ * поэтому глубина рекурсии ограничена бюджетом памяти, а не размером стека потока.
+ */
+class ExecutionStack {
+public:
+    explicit ExecutionStack(size_t size);
+    ~ExecutionStack();
+
+    ExecutionStack(const ExecutionStack&) = delete;
+    ExecutionStack& operator=(const ExecutionStack&) = delete;
+
+    // Выполняет fn на этом стеке и дожидается её завершения.
+    // Исключение, выброшенное fn, пробрасывается вызывающему.
+    // fn выполняется в текущем потоке, переключением контекста: на неё действуют регион,
+    // учёт памяти, ограничения выполнения, сборщик циклов и пул объектов потока
+    void Run(const std::function<void()>& fn);
+
+    [[nodiscard]] size_t GetSize() const;
+    // Возвращает границы стека без защитной страницы
+    [[nodiscard]] StackBounds GetBounds() const;
+
+private:
+    void* memory_;
+    size_t size_;
+};
+
+// Сообщает о переходе текущего потока на другой стек. Возвращает прежние границы
+StackBounds SetStackBounds(StackBounds bounds);
+
+namespace detail {
+extern thread_local const char* stack_limit;
+[[noreturn]] void ThrowStackOverflow();
+void InitStackLimit();
+}  // namespace detail
+
+// Выбрасывает StackOverflowError, если стек текущего потока почти исчерпан
+inline void CheckStack() {
+    if (!detail::stack_limit) {
+        detail::InitStackLimit();
+    }
+    const char marker = 0;
+    if (reinterpret_cast<uintptr_t>(&marker) < reinterpret_cast<uintptr_t>(detail::stack_limit)) {
+        detail::ThrowStackOverflow();
+    }
+}
+
+}  // namespace runtime
@@ -1,7 +1,20 @@
 #include "statement.h"
 
+#include "collector.h"
+#include "execution_limits.h"
+#include "future.h"
+#include "module.h"
+#include "native.h"
+#include "reclaimer.h"
+#include "region.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <unordered_map>
 #include <cassert>
 
 using namespace std;
@@ -17,15 +30,42 @@ using runtime::ClassInstance;
 using runtime::Number;
 using runtime::String;
 using runtime::Bool;
+using runtime::List;
+using runtime::Dict;
 
 namespace {
 const string ADD_METHOD = "__add__"s;
 const string INIT_METHOD = "__init__"s;
+
+// Возврат, выполненный инструкцией return и ещё не принятый телом метода. Между return и телом
+// метода нет точек переключения сессий и вызовов, поэтому возврат может принадлежать потоку
+struct PendingReturn {
+    bool active = false;
+    bool is_tail_call = false;
+    ObjectHolder value;
+    TailCall call;
+};
+
+thread_local PendingReturn pending_return;
+
+void ReturnValue(ObjectHolder value) {
+    pending_return.value = std::move(value);
+    pending_return.is_tail_call = false;
+    pending_return.active = true;
+}
+
+void ReturnTailCall(TailCall&& call) {
+    pending_return.call = std::move(call);
+    pending_return.is_tail_call = true;
+    pending_return.active = true;
+}
 }  // namespace
 
-ObjectHolder Assignment::Execute(Closure& closure, Context& context) {
-    closure[var_] = rv_->Execute(closure, context);
-    return closure[var_];
+ObjectHolder Assignment::Execute(Closure& closure, Context& context) const {
+    ObjectHolder value = rv_->Execute(closure, context);
+    ObjectHolder& variable = closure[var_];
+    runtime::Retire(std::exchange(variable, value));
+    return variable;
 }
 
 Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv)
@@ -42,8 +82,8 @@ VariableValue::VariableValue(std::vector<std::string> dotted_ids)
     assert(dotted_ids_.size() > 0);
 }
 
-ObjectHolder VariableValue::Execute(Closure& closure, Context& /*context*/) {
-    ObjectHolder result = [this, closure]() {
+ObjectHolder VariableValue::Execute(Closure& closure, Context& /*context*/) const {
+    ObjectHolder result = [this, &closure]() {
         auto it = closure.find(dotted_ids_[0]);
         if (it == closure.end()) {
             throw std::runtime_error("Error in VariableValue::Execute: \""s + dotted_ids_[0] + "\" field was not found"s);
@@ -80,7 +120,7 @@ Print::Print(vector<unique_ptr<Statement>> args)
 : args_(move(args)) {
 }
 
-ObjectHolder Print::Execute(Closure& closure, Context& context) {
+ObjectHolder Print::Execute(Closure& closure, Context& context) const {
     if (name_) {
         auto it = closure.find(*name_);
         if (it == closure.end()) {
@@ -115,16 +155,196 @@ MethodCall::MethodCall(std::unique_ptr<Statement> object, std::string method,
 , args_(move(args)) {
 }
 
-ObjectHolder MethodCall::Execute(Closure& closure, Context& context) {
+namespace {
+// Вычисляет аргументы вызова нативной функции в буфер на стеке
+class NativeArgsBuffer {
+public:
+    NativeArgsBuffer(const vector<unique_ptr<Statement>>& args, Closure& closure, Context& context)
+        : size_(args.size()) {
+        if (size_ > runtime::MAX_NATIVE_ARGS) {
+            throw std::runtime_error("Native functions take at most "s
+                                     + to_string(runtime::MAX_NATIVE_ARGS) + " arguments"s);
+        }
+        for (size_t i = 0; i < size_; ++i) {
+            values_[i] = args[i]->Execute(closure, context);
+        }
+    }
+
+    [[nodiscard]] runtime::NativeArgs Get() const {
+        return {values_.data(), size_};
+    }
+
+    // Перемещает вычисленные аргументы в вектор
+    vector<ObjectHolder> Release() {
+        return {make_move_iterator(values_.begin()), make_move_iterator(values_.begin() + size_)};
+    }
+
+private:
+    std::array<ObjectHolder, runtime::MAX_NATIVE_ARGS> values_;
+    size_t size_;
+};
+}  // namespace
+
+ObjectHolder MethodCall::Execute(Closure& closure, Context& context) const {
+    // Аргументы вызова метода нативного объекта не копируются в вектор
+    if (args_.size() <= runtime::MAX_NATIVE_ARGS) {
+        NativeArgsBuffer buffer(args_, closure, context);
+        ObjectHolder object = object_->Execute(closure, context);
+        if (auto native = object.TryAs<runtime::NativeObject>()) {
+            return native->Call(method_, buffer.Get(), context);
+        }
+        return Call(object, buffer.Release(), context);
+    }
+    vector<ObjectHolder> actual_args;
+    actual_args.reserve(args_.size());
+    for (auto& arg : args_) {
+        actual_args.push_back(arg->Execute(closure, context));
+    }
+    return Call(object_->Execute(closure, context), actual_args, context);
+}
+
+ObjectHolder MethodCall::Call(const ObjectHolder& object, const std::vector<ObjectHolder>& actual_args,
+                              Context& context) const {
+    if (auto cls_ins = object.TryAs<ClassInstance>()) {
+        return cls_ins->Call(method_, actual_args, context);
+    }
+    if (auto list = object.TryAs<List>()) {
+        return list->Call(method_, actual_args);
+    }
+    if (auto dict = object.TryAs<Dict>()) {
+        return dict->Call(method_, actual_args, context);
+    }
+    if (auto native = object.TryAs<runtime::NativeObject>()) {
+        return native->Call(method_, {actual_args.data(), actual_args.size()}, context);
+    }
+    throw std::runtime_error("Error in MethodCall::Execute: \""s + method_ + "\" is called on a non-object"s);
+}
+
+void MethodCall::ExecuteInTailPosition(Closure& closure, Context& context) const {
+    TailCall call;
+    call.args.reserve(args_.size());
+    for (auto& arg : args_) {
+        call.args.push_back(arg->Execute(closure, context));
+    }
+    call.self = object_->Execute(closure, context);
+    auto cls_ins = call.self.TryAs<ClassInstance>();
+    if (!cls_ins) {
+        ReturnValue(Call(call.self, call.args, context));
+        return;
+    }
+    call.method = cls_ins->GetClass().GetMethod(method_);
+    if (!call.method || call.method->formal_params.size() != call.args.size()) {
+        ReturnValue(cls_ins->Call(method_, call.args, context));
+        return;
+    }
+    ReturnTailCall(std::move(call));
+}
+
+FunctionCall::FunctionCall(runtime::Function& function, std::vector<std::unique_ptr<Statement>> args)
+: function_(function)
+, args_(move(args)) {
+}
+
+ObjectHolder FunctionCall::Execute(Closure& closure, Context& context) const {
     vector<ObjectHolder> actual_args;
     actual_args.reserve(args_.size());
     for (auto& arg : args_) {
         actual_args.push_back(arg->Execute(closure, context));
     }
-    return object_->Execute(closure, context).TryAs<ClassInstance>()->Call(method_, actual_args, context);
+    return function_.Call(actual_args, context);
+}
+
+void FunctionCall::ExecuteInTailPosition(Closure& closure, Context& context) const {
+    TailCall call;
+    call.args.reserve(args_.size());
+    for (auto& arg : args_) {
+        call.args.push_back(arg->Execute(closure, context));
+    }
+    call.method = &function_.GetMethod();
+    if (!function_.IsDefined() || call.method->formal_params.size() != call.args.size()) {
+        ReturnValue(function_.Call(call.args, context));
+        return;
+    }
+    ReturnTailCall(std::move(call));
 }
 
-ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
+Spawn::Spawn(std::unique_ptr<Statement> object, std::string method,
+             std::vector<std::unique_ptr<Statement>> args)
+: object_(move(object))
+, method_(move(method))
+, args_(move(args)) {
+}
+
+Spawn::Spawn(runtime::Function& function, std::vector<std::unique_ptr<Statement>> args)
+: function_(&function)
+, args_(move(args)) {
+}
+
+ObjectHolder Spawn::Execute(Closure& closure, Context& context) const {
+    vector<ObjectHolder> actual_args;
+    actual_args.reserve(args_.size());
+    for (auto& arg : args_) {
+        actual_args.push_back(arg->Execute(closure, context));
+    }
+    ObjectHolder object;
+    if (object_) {
+        object = object_->Execute(closure, context);
+        if (!object.TryAs<ClassInstance>()) {
+            throw std::runtime_error("Error in Spawn::Execute: \""s + method_
+                                     + "\" can only be spawned on a class instance"s);
+        }
+    }
+
+    // Копии переживают вызов и освобождаются в потоке задачи, поэтому не размещаются в регионе
+    runtime::Region::Scope no_region(nullptr);
+    unordered_map<const runtime::Object*, ObjectHolder> copies;
+    object = runtime::CopyForTask(object, copies, context);
+    for (auto& arg : actual_args) {
+        arg = runtime::CopyForTask(arg, copies, context);
+    }
+
+    // Задача не ссылается на этот узел: при потоковом выполнении он разрушается
+    // сразу после выполнения инструкции верхнего уровня. Класс или функция, которым
+    // принадлежат тела методов, удерживаются задачей до её завершения
+    ObjectHolder owner = function_
+        ? ObjectHolder::Share(*function_)
+        : ObjectHolder::Share(const_cast<Class&>(object.TryAs<ClassInstance>()->GetClass()));
+    return runtime::Future::Start(
+        [owner = move(owner), function = function_, method = method_, object = move(object),
+         args = move(actual_args)](Context& task_context) {
+            auto& collector = runtime::CycleCollector::Current();
+            collector.Adopt(object);
+            for (const auto& arg : args) {
+                collector.Adopt(arg);
+            }
+            if (function) {
+                return function->Call(args, task_context);
+            }
+            return object.TryAs<ClassInstance>()->Call(method, args, task_context);
+        });
+}
+
+NativeCall::NativeCall(ObjectHolder function, std::vector<std::unique_ptr<Statement>> args)
+: function_(move(function))
+, args_(move(args)) {
+}
+
+ObjectHolder NativeCall::Execute(Closure& closure, Context& context) const {
+    NativeArgsBuffer buffer(args_, closure, context);
+    return function_.TryAs<runtime::NativeFunction>()->Call(nullptr, buffer.Get(), context);
+}
+
+NewNativeInstance::NewNativeInstance(ObjectHolder cls, std::vector<std::unique_ptr<Statement>> args)
+: cls_(move(cls))
+, args_(move(args)) {
+}
+
+ObjectHolder NewNativeInstance::Execute(Closure& closure, Context& context) const {
+    NativeArgsBuffer buffer(args_, closure, context);
+    return cls_.TryAs<runtime::NativeClass>()->Construct(buffer.Get(), context);
+}
+
+ObjectHolder Stringify::Execute(Closure& closure, Context& context) const {
     ostringstream os;
     ObjectHolder obj_h = argument_->Execute(closure, context);
     if (obj_h) {
@@ -135,7 +355,29 @@ ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
     return ObjectHolder::Own(String(os.str()));
 }
 
-ObjectHolder Add::Execute(Closure& closure, Context& context) {
+ObjectHolder Length::Execute(Closure& closure, Context& context) const {
+    ObjectHolder obj_h = argument_->Execute(closure, context);
+    if (auto list = obj_h.TryAs<List>()) {
+        return ObjectHolder::Own(Number(static_cast<int>(list->Items().size())));
+    }
+    if (auto dict = obj_h.TryAs<Dict>()) {
+        return ObjectHolder::Own(Number(static_cast<int>(dict->GetSize())));
+    }
+    if (auto str = obj_h.TryAs<String>()) {
+        return ObjectHolder::Own(Number(static_cast<int>(str->GetValue().size())));
+    }
+    throw std::runtime_error("Error in Length::Execute: len() argument must be a list, a dict or a string"s);
+}
+
+ObjectHolder Join::Execute(Closure& closure, Context& context) const {
+    ObjectHolder obj_h = argument_->Execute(closure, context);
+    if (auto future = obj_h.TryAs<runtime::Future>()) {
+        return future->Join(context);
+    }
+    throw std::runtime_error("Error in Join::Execute: join() argument must be a future"s);
+}
+
+ObjectHolder Add::Execute(Closure& closure, Context& context) const {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
     
@@ -160,7 +402,7 @@ ObjectHolder Add::Execute(Closure& closure, Context& context) {
     throw std::runtime_error("Error in Add::Execute"s);
 }
 
-ObjectHolder Sub::Execute(Closure& closure, Context& context) {
+ObjectHolder Sub::Execute(Closure& closure, Context& context) const {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
     
@@ -173,7 +415,7 @@ ObjectHolder Sub::Execute(Closure& closure, Context& context) {
     throw std::runtime_error("Error in Sub::Execute"s);
 }
 
-ObjectHolder Mult::Execute(Closure& closure, Context& context) {
+ObjectHolder Mult::Execute(Closure& closure, Context& context) const {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
     
@@ -186,7 +428,7 @@ ObjectHolder Mult::Execute(Closure& closure, Context& context) {
     throw std::runtime_error("Error in Mult::Execute"s);
 }
 
-ObjectHolder Div::Execute(Closure& closure, Context& context) {
+ObjectHolder Div::Execute(Closure& closure, Context& context) const {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
     
@@ -199,26 +441,63 @@ ObjectHolder Div::Execute(Closure& closure, Context& context) {
     throw std::runtime_error("Error in Dir::Execute"s);
 }
 
-ObjectHolder Compound::Execute(Closure& closure, Context& context) {
+ObjectHolder Compound::Execute(Closure& closure, Context& context) const {
     for (size_t i = 0; i < args_.size(); ++i) {
         args_[i]->Execute(closure, context);
+        if (pending_return.active) {
+            break;
+        }
     }
     return ObjectHolder::None();
 }
 
 Return::Return(std::unique_ptr<Statement> statement)
-: statement_(move(statement)) {
+: statement_(move(statement))
+, tail_call_(dynamic_cast<MethodCall*>(statement_.get()))
+, tail_function_call_(dynamic_cast<FunctionCall*>(statement_.get())) {
 }
     
-ObjectHolder Return::Execute(Closure& closure, Context& context) {
-    throw ObjectHolder(statement_->Execute(closure, context));
+ObjectHolder Return::Execute(Closure& closure, Context& context) const {
+    if (tail_call_) {
+        tail_call_->ExecuteInTailPosition(closure, context);
+    } else if (tail_function_call_) {
+        tail_function_call_->ExecuteInTailPosition(closure, context);
+    } else {
+        ReturnValue(statement_->Execute(closure, context));
+    }
+    return ObjectHolder::None();
 }
 
 ClassDefinition::ClassDefinition(ObjectHolder cls)
 : cls_(move(cls)) {
 }
 
-ObjectHolder ClassDefinition::Execute(Closure& closure, Context& /*context*/) {
+FunctionDefinition::FunctionDefinition(ObjectHolder function)
+: function_(move(function)) {
+}
+
+ObjectHolder FunctionDefinition::Execute(Closure& closure, Context& /*context*/) const {
+    closure[function_.TryAs<runtime::Function>()->GetMethod().name] = function_;
+    return ObjectHolder::None();
+}
+
+Import::Import(shared_ptr<const parse::Module> module)
+: module_(move(module)) {
+}
+
+ObjectHolder Import::Execute(Closure& closure, Context& context) const {
+    Closure module_closure;
+    module_->body->Execute(module_closure, context);
+    for (const auto& [name, cls] : module_->classes) {
+        closure[name] = cls;
+    }
+    for (const auto& [name, function] : module_->functions) {
+        closure[name] = function;
+    }
+    return ObjectHolder::None();
+}
+
+ObjectHolder ClassDefinition::Execute(Closure& closure, Context& /*context*/) const {
     closure[cls_.TryAs<Class>()->GetName()] = cls_;
     return ObjectHolder::None();
 }
@@ -230,10 +509,15 @@ FieldAssignment::FieldAssignment(VariableValue object, std::string field_name,
 , rv_(move(rv)) {
 }
 
-ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) {
+ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) const {
     if (auto cls_ins = object_.Execute(closure, context).TryAs<ClassInstance>()) {
-        cls_ins->Fields()[field_name_] = rv_->Execute(closure, context);
-        return cls_ins->Fields()[field_name_];
+        ObjectHolder value = rv_->Execute(closure, context);
+        auto [field, inserted] = cls_ins->Fields().try_emplace(field_name_);
+        runtime::Retire(std::exchange(field->second, value));
+        if (inserted) {
+            cls_ins->UpdateMemoryUsage();
+        }
+        return field->second;
     }
     throw std::runtime_error("FieldAssignment::Execute: Error in FieldAssignment::Execute"s);
 }
@@ -245,7 +529,8 @@ IfElse::IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement>
 , else_body_(move(else_body)) {
 }
 
-ObjectHolder IfElse::Execute(Closure& closure, Context& context) {
+ObjectHolder IfElse::Execute(Closure& closure, Context& context) const {
+    runtime::ConsumeFuel();
     return runtime::IsTrue(condition_->Execute(closure, context))
          ? if_body_->Execute(closure, context)
          : else_body_
@@ -253,19 +538,227 @@ ObjectHolder IfElse::Execute(Closure& closure, Context& context) {
              : ObjectHolder::None();
 }
 
-ObjectHolder Or::Execute(Closure& closure, Context& context) {
+While::While(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> body)
+: condition_(move(condition))
+, body_(move(body)) {
+}
+
+ObjectHolder While::Execute(Closure& closure, Context& context) const {
+    while (runtime::IsTrue(condition_->Execute(closure, context))) {
+        body_->Execute(closure, context);
+        if (pending_return.active) {
+            break;
+        }
+        runtime::ConsumeFuel();
+        runtime::YieldPoint();
+    }
+    return ObjectHolder::None();
+}
+
+ForRange::ForRange(std::string var, std::unique_ptr<Statement> start,
+                   std::unique_ptr<Statement> stop, std::unique_ptr<Statement> step,
+                   std::unique_ptr<Statement> body)
+: var_(move(var))
+, start_(move(start))
+, stop_(move(stop))
+, step_(move(step))
+, body_(move(body)) {
+}
+
+ObjectHolder ForRange::Execute(Closure& closure, Context& context) const {
+    auto get_number = [&closure, &context](Statement& statement) {
+        ObjectHolder obj_h = statement.Execute(closure, context);
+        if (auto number = obj_h.TryAs<Number>()) {
+            return number->GetValue();
+        }
+        throw std::runtime_error("Error in ForRange::Execute: range() arguments must be numbers"s);
+    };
+    const int start = get_number(*start_);
+    const int stop = get_number(*stop_);
+    const int step = step_ ? get_number(*step_) : 1;
+    if (step == 0) {
+        throw std::runtime_error("Error in ForRange::Execute: range() step must not be zero"s);
+    }
+
+    // Переменные не удаляются из closure, поэтому ссылка на неё остаётся действительной
+    ObjectHolder& variable = closure[var_];
+    // Число, созданное циклом для счётчика. Пока на него ссылается только переменная цикла,
+    // следующее значение записывается в него же, без размещения нового числа
+    Number* counter = nullptr;
+    for (long long i = start; step > 0 ? i < stop : i > stop; i += step) {
+        if (counter && variable.Get() == counter && variable.IsUnique()) {
+            counter->SetValue(static_cast<int>(i));
+        } else {
+            variable = ObjectHolder::Own(Number(static_cast<int>(i)));
+            counter = variable.TryAs<Number>();
+        }
+        body_->Execute(closure, context);
+        if (pending_return.active) {
+            break;
+        }
+        runtime::ConsumeFuel();
+        runtime::YieldPoint();
+    }
+    return ObjectHolder::None();
+}
+
+ListLiteral::ListLiteral(std::vector<std::unique_ptr<Statement>> items)
+: items_(move(items)) {
+}
+
+ObjectHolder ListLiteral::Execute(Closure& closure, Context& context) const {
+    vector<ObjectHolder> items;
+    items.reserve(items_.size());
+    for (auto& item : items_) {
+        items.push_back(item->Execute(closure, context));
+    }
+    runtime::CycleCollector::Current().MaybeCollect();
+    return ObjectHolder::Own(List(move(items)));
+}
+
+DictLiteral::DictLiteral(std::vector<Item> items)
+: items_(move(items)) {
+}
+
+ObjectHolder DictLiteral::Execute(Closure& closure, Context& context) const {
+    runtime::CycleCollector::Current().MaybeCollect();
+    ObjectHolder result = ObjectHolder::Own(Dict());
+    auto& dict = *result.TryAs<Dict>();
+    for (auto& [key, value] : items_) {
+        ObjectHolder key_h = key->Execute(closure, context);
+        dict.Set(key_h, value->Execute(closure, context), context);
+    }
+    return result;
+}
+
+Index::Index(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index)
+: object_(move(object))
+, index_(move(index)) {
+}
+
+ObjectHolder Index::Execute(Closure& closure, Context& context) const {
+    ObjectHolder obj_h = object_->Execute(closure, context);
+    ObjectHolder index = index_->Execute(closure, context);
+    if (auto list = obj_h.TryAs<List>()) {
+        return list->Items()[runtime::NormalizeIndex(index, list->Items().size())];
+    }
+    if (auto dict = obj_h.TryAs<Dict>()) {
+        if (ObjectHolder* value = dict->Find(index, context)) {
+            return *value;
+        }
+        throw std::runtime_error("Error in Index::Execute: key was not found in dict"s);
+    }
+    if (auto str = obj_h.TryAs<String>()) {
+        const string& value = str->GetValue();
+        return ObjectHolder::Own(String(string(1, value[runtime::NormalizeIndex(index, value.size())])));
+    }
+    throw std::runtime_error("Error in Index::Execute: only lists, dicts and strings can be indexed"s);
+}
+
+Slice::Slice(std::unique_ptr<Statement> object, std::unique_ptr<Statement> start,
+             std::unique_ptr<Statement> stop)
+: object_(move(object))
+, start_(move(start))
+, stop_(move(stop)) {
+}
+
+ObjectHolder Slice::Execute(Closure& closure, Context& context) const {
+    ObjectHolder obj_h = object_->Execute(closure, context);
+    auto list = obj_h.TryAs<List>();
+    auto str = obj_h.TryAs<String>();
+    if (!list && !str) {
+        throw std::runtime_error("Error in Slice::Execute: only lists and strings can be sliced"s);
+    }
+    auto get_bound = [&closure, &context](Statement* bound) -> std::optional<long long> {
+        if (!bound) {
+            return std::nullopt;
+        }
+        auto number = bound->Execute(closure, context).TryAs<Number>();
+        if (!number) {
+            throw std::runtime_error("Error in Slice::Execute: slice indices must be numbers"s);
+        }
+        return number->GetValue();
+    };
+    // Вычисление границ может изменить список, поэтому размер читается после них
+    const std::optional<long long> start_value = get_bound(start_.get());
+    const std::optional<long long> stop_value = get_bound(stop_.get());
+    const auto size = static_cast<long long>(list ? list->Items().size() : str->GetValue().size());
+    auto normalize = [size](long long value) {
+        if (value < 0) {
+            value += size;
+        }
+        return std::clamp(value, 0LL, size);
+    };
+    const long long start = normalize(start_value.value_or(0));
+    const long long stop = std::max(start, normalize(stop_value.value_or(size)));
+    if (list) {
+        const auto& items = list->Items();
+        runtime::CycleCollector::Current().MaybeCollect();
+        return ObjectHolder::Own(List(vector<ObjectHolder>(items.begin() + start, items.begin() + stop)));
+    }
+    return ObjectHolder::Own(String(str->GetValue().substr(start, stop - start)));
+}
+
+IndexAssignment::IndexAssignment(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index,
+                                 std::unique_ptr<Statement> rv)
+: object_(move(object))
+, index_(move(index))
+, rv_(move(rv)) {
+}
+
+ObjectHolder IndexAssignment::Execute(Closure& closure, Context& context) const {
+    ObjectHolder value = rv_->Execute(closure, context);
+    ObjectHolder obj_h = object_->Execute(closure, context);
+    ObjectHolder index = index_->Execute(closure, context);
+    if (auto list = obj_h.TryAs<List>()) {
+        ObjectHolder& item = list->Items()[runtime::NormalizeIndex(index, list->Items().size())];
+        runtime::Retire(std::exchange(item, value));
+        return item;
+    }
+    if (auto dict = obj_h.TryAs<Dict>()) {
+        return dict->Set(index, value, context);
+    }
+    throw std::runtime_error("Error in IndexAssignment::Execute: only list and dict items can be assigned"s);
+}
+
+DeleteItem::DeleteItem(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index)
+: object_(move(object))
+, index_(move(index)) {
+}
+
+ObjectHolder DeleteItem::Execute(Closure& closure, Context& context) const {
+    ObjectHolder obj_h = object_->Execute(closure, context);
+    ObjectHolder index = index_->Execute(closure, context);
+    if (auto list = obj_h.TryAs<List>()) {
+        auto& items = list->Items();
+        const size_t position = runtime::NormalizeIndex(index, items.size());
+        ObjectHolder item = std::move(items[position]);
+        items.erase(items.begin() + position);
+        runtime::Retire(std::move(item));
+        return ObjectHolder::None();
+    }
+    if (auto dict = obj_h.TryAs<Dict>()) {
+        if (!dict->Erase(index, context)) {
+            throw std::runtime_error("Error in DeleteItem::Execute: key was not found in dict"s);
+        }
+        return ObjectHolder::None();
+    }
+    throw std::runtime_error("Error in DeleteItem::Execute: only list and dict items can be deleted"s);
+}
+
+ObjectHolder Or::Execute(Closure& closure, Context& context) const {
     return runtime::IsTrue(lhs_->Execute(closure, context)) ?
            ObjectHolder::Own(Bool(true)) :
            ObjectHolder::Own(Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
 }
 
-ObjectHolder And::Execute(Closure& closure, Context& context) {
+ObjectHolder And::Execute(Closure& closure, Context& context) const {
     return !runtime::IsTrue(lhs_->Execute(closure, context)) ?
            ObjectHolder::Own(Bool(false)) :
            ObjectHolder::Own(Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
 }
 
-ObjectHolder Not::Execute(Closure& closure, Context& context) {
+ObjectHolder Not::Execute(Closure& closure, Context& context) const {
     return ObjectHolder::Own(Bool(!runtime::IsTrue(argument_->Execute(closure, context))));
 }
 
@@ -274,42 +767,85 @@ Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Sta
     , comparator_(std::move(cmp)) {
 }
 
-ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
+ObjectHolder Comparison::Execute(Closure& closure, Context& context) const {
     return ObjectHolder::Own(Bool(comparator_(lhs_->Execute(closure, context), rhs_->Execute(closure, context), context)));
 }
 
 NewInstance::NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args)
-: cls_ins_(class_)
+: class_(class_)
 , args_(move(args)) {
 }
 
 NewInstance::NewInstance(const runtime::Class& class_)
-: cls_ins_(class_) {
+: class_(class_) {
 }
 
-ObjectHolder NewInstance::Execute(Closure& closure, Context& context) {
-    if (cls_ins_.HasMethod(INIT_METHOD, args_.size())) {
+ObjectHolder NewInstance::Execute(Closure& closure, Context& context) const {
+    runtime::CycleCollector::Current().MaybeCollect();
+    ObjectHolder instance = ObjectHolder::Own(ClassInstance(class_));
+    auto cls_ins = instance.TryAs<ClassInstance>();
+    if (cls_ins->HasMethod(INIT_METHOD, args_.size())) {
         std::vector<ObjectHolder> objs;
         objs.reserve(args_.size());
         for (auto& arg : args_) {
             objs.push_back(arg->Execute(closure, context));
         }
-        cls_ins_.Call(INIT_METHOD, objs, context);
+        cls_ins->Call(INIT_METHOD, objs, context);
     }
-    return ObjectHolder::Share(cls_ins_);
+    return instance;
 }
 
 MethodBody::MethodBody(std::unique_ptr<Statement>&& body)
 : body_(move(body)) {
 }
 
-ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
-    try {
-        body_->Execute(closure, context);
-    } catch (ObjectHolder obj_h) {
-        return obj_h;
+MethodBody::MethodBody(Loader loader)
+: loader_(move(loader)) {
+}
+
+const Statement& MethodBody::GetBody() const {
+    if (loader_) {
+        // call_once публикует разобранное тело для всех потоков, выполняющих метод
+        call_once(loaded_, [this] {
+            body_ = loader_();
+        });
+    }
+    return *body_;
+}
+
+ObjectHolder MethodBody::Execute(Closure& closure, Context& context) const {
+    Closure* frame = &closure;
+    Closure tail_frame;
+    const Statement* body = &GetBody();
+    bool returns_value = false;
+    for (;;) {
+        // Каждый вызов, в том числе хвостовой, - точка переключения сессий планировщика
+        runtime::ConsumeFuel();
+        runtime::YieldPoint();
+        ObjectHolder result = body->Execute(*frame, context);
+        if (!pending_return.active) {
+            return returns_value ? result : ObjectHolder::None();
+        }
+        pending_return.active = false;
+        if (!pending_return.is_tail_call) {
+            return std::move(pending_return.value);
+        }
+        TailCall& call = pending_return.call;
+        // Кадр переиспользуется: аргументы и self уже вычислены и хранятся в call
+        tail_frame.clear();
+        // Функции верхнего уровня вызываются без self
+        if (call.self) {
+            tail_frame.emplace("self"s, std::move(call.self));
+        }
+        for (size_t i = 0; i < call.args.size(); ++i) {
+            tail_frame[call.method->formal_params[i]] = std::move(call.args[i]);
+        }
+        frame = &tail_frame;
+        // Тело, не являющееся MethodBody, возвращает результат без инструкции return
+        auto method_body = dynamic_cast<MethodBody*>(call.method->body.get());
+        body = method_body ? &method_body->GetBody() : call.method->body.get();
+        returns_value = method_body == nullptr;
     }
-    return ObjectHolder::None();
 }
 
 }  // namespace ast
\ No newline at end of file
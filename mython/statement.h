@@ -3,8 +3,14 @@
 #include "runtime.h"
 
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <utility>
 
+namespace parse {
+struct Module;
+}
+
 namespace ast {
 
 using Statement = runtime::Executable;
@@ -19,18 +25,39 @@ public:
     }
 
     runtime::ObjectHolder Execute(runtime::Closure& /*closure*/,
-                                  runtime::Context& /*context*/) override {
+                                  runtime::Context& /*context*/) const override {
         return runtime::ObjectHolder::Share(value_);
     }
 
 private:
-    T value_;
+    // Константы не изменяются при выполнении: Share лишь создаёт на них невладеющую ссылку,
+    // не затрагивая сам объект
+    mutable T value_;
 };
 
 using NumericConst = ValueStatement<runtime::Number>;
 using StringConst = ValueStatement<runtime::String>;
 using BoolConst = ValueStatement<runtime::Bool>;
 
+// Константа, значением которой владеет shared_ptr: ссылки, полученные через Share, разделяют
+// владение, и значение переживает саму инструкцию. Нужна, когда инструкция освобождается
+// раньше переменных, ссылающихся на её константы (см. ProgramStream)
+template <typename T>
+class SharedValueStatement : public Statement {
+public:
+    explicit SharedValueStatement(T v)
+        : value_(std::make_shared<T>(std::move(v))) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& /*closure*/,
+                                  runtime::Context& /*context*/) const override {
+        return runtime::ObjectHolder::Share(*value_);
+    }
+
+private:
+    std::shared_ptr<T> value_;
+};
+
 /*
 Вычисляет значение переменной либо цепочки вызовов полей объектов id1.id2.id3.
 Например, выражение circle.center.x - цепочка вызовов полей объектов в инструкции:
@@ -41,7 +68,7 @@ public:
     explicit VariableValue(const std::string& var_name);
     explicit VariableValue(std::vector<std::string> dotted_ids);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
  
 private:
     std::vector<std::string> dotted_ids_;
@@ -52,7 +79,7 @@ class Assignment : public Statement {
 public:
     Assignment(std::string var, std::unique_ptr<Statement> rv);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     std::string var_;
@@ -64,7 +91,7 @@ class FieldAssignment : public Statement {
 public:
     FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     VariableValue object_;
@@ -76,7 +103,7 @@ private:
 class None : public Statement {
 public:
     runtime::ObjectHolder Execute([[maybe_unused]] runtime::Closure& closure,
-                                  [[maybe_unused]] runtime::Context& context) override {
+                                  [[maybe_unused]] runtime::Context& context) const override {
         return {};
     }
 };
@@ -94,7 +121,7 @@ public:
 
     // Во время выполнения команды print вывод должен осуществляться в поток, возвращаемый из
     // context.GetOutputStream()
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     explicit Print(const std::string* name);
@@ -103,17 +130,77 @@ private:
     const std::string* name_ = nullptr;
 };
 
+/*
+ * Вызов метода в хвостовой позиции. Инструкция return передаёт его телу метода вместо вызова
+ * (см. Return), а тело исполняет вызываемый метод в том же кадре. Поэтому хвостовая рекурсия
+ * любой глубины не расходует стек.
+ * При вызове функции верхнего уровня self пуст
+ */
+struct TailCall {
+    runtime::ObjectHolder self;
+    const runtime::Method* method;
+    std::vector<runtime::ObjectHolder> args;
+};
+
 // Вызывает метод object.method со списком параметров args
 class MethodCall : public Statement {
 public:
     MethodCall(std::unique_ptr<Statement> object, std::string method,
                std::vector<std::unique_ptr<Statement>> args);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
-    
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+    // Вычисляет объект и аргументы вызова и передаёт TailCall телу метода, как инструкция return.
+    // Если вызов нельзя выполнить в кадре вызывающего метода, выполняет его и возвращает
+    // из метода результат
+    void ExecuteInTailPosition(runtime::Closure& closure, runtime::Context& context) const;
+
+private:
+    // Вызывает метод у объекта любого типа: экземпляра класса, списка, словаря или нативного объекта
+    runtime::ObjectHolder Call(const runtime::ObjectHolder& object,
+                               const std::vector<runtime::ObjectHolder>& actual_args,
+                               runtime::Context& context) const;
+
+    std::unique_ptr<Statement> object_;
+    std::string method_;
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
+// Вызывает функцию верхнего уровня function со списком параметров args.
+// Функция известна при разборе программы, поэтому вызов не ищет её по имени
+class FunctionCall : public Statement {
+public:
+    FunctionCall(runtime::Function& function, std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+    // Вычисляет аргументы вызова и передаёт TailCall без объекта self телу метода
+    void ExecuteInTailPosition(runtime::Closure& closure, runtime::Context& context) const;
+
+private:
+    runtime::Function& function_;
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
+/*
+ * Запускает вызов метода object.method либо функции верхнего уровня function в пуле потоков
+ * и возвращает runtime::Future. Объект и аргументы вычисляются в вызывающем потоке
+ * и копируются (см. runtime::CopyForTask), поэтому задача и вызывающий не разделяют
+ * изменяемых объектов: изменения полей копии self не видны вызывающему, а результат
+ * передаётся ему через join
+ */
+class Spawn : public Statement {
+public:
+    Spawn(std::unique_ptr<Statement> object, std::string method,
+          std::vector<std::unique_ptr<Statement>> args);
+    Spawn(runtime::Function& function, std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
 private:
     std::unique_ptr<Statement> object_;
     std::string method_;
+    runtime::Function* function_ = nullptr;
     std::vector<std::unique_ptr<Statement>> args_;
 };
 
@@ -135,10 +222,35 @@ public:
     explicit NewInstance(const runtime::Class& class_);
     NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args);
     // Возвращает объект, содержащий значение типа ClassInstance
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
-    runtime::ClassInstance cls_ins_;
+    const runtime::Class& class_;
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
+// Вызывает нативную функцию function со списком параметров args.
+// Аргументы вычисляются в буфер на стеке, поэтому вызов не выделяет память
+class NativeCall : public Statement {
+public:
+    NativeCall(runtime::ObjectHolder function, std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    runtime::ObjectHolder function_;
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
+// Создаёт объект нативного класса cls, передавая его конструктору набор параметров args
+class NewNativeInstance : public Statement {
+public:
+    NewNativeInstance(runtime::ObjectHolder cls, std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    runtime::ObjectHolder cls_;
     std::vector<std::unique_ptr<Statement>> args_;
 };
 
@@ -157,7 +269,21 @@ protected:
 class Stringify : public UnaryOperation {
 public:
     using UnaryOperation::UnaryOperation;
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+};
+
+// Операция len, возвращающая длину списка, словаря или строки
+class Length : public UnaryOperation {
+public:
+    using UnaryOperation::UnaryOperation;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+};
+
+// Операция join, дожидающаяся результата вызова, запущенного командой spawn
+class Join : public UnaryOperation {
+public:
+    using UnaryOperation::UnaryOperation;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Родительский класс Бинарная операция с аргументами lhs и rhs
@@ -183,7 +309,7 @@ public:
     //  строка + строка
     //  объект1 + объект2, если у объект1 - пользовательский класс с методом _add__(rhs)
     // В противном случае при вычислении выбрасывается runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычитания аргументов lhs и rhs
@@ -194,7 +320,7 @@ public:
     // Поддерживается вычитание:
     //  число - число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат умножения аргументов lhs и rhs
@@ -205,7 +331,7 @@ public:
     // Поддерживается умножение:
     //  число * число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат деления lhs и rhs
@@ -217,7 +343,7 @@ public:
     //  число / число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
     // Если rhs равен 0, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции or над lhs и rhs
@@ -226,7 +352,7 @@ public:
     using BinaryOperation::BinaryOperation;
     // Значение аргумента rhs вычисляется, только если значение lhs
     // после приведения к Bool равно False
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции and над lhs и rhs
@@ -235,14 +361,14 @@ public:
     using BinaryOperation::BinaryOperation;
     // Значение аргумента rhs вычисляется, только если значение lhs
     // после приведения к Bool равно True
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции not над единственным аргументом операции
 class Not : public UnaryOperation {
 public:
     using UnaryOperation::UnaryOperation;
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Составная инструкция (например: тело метода, содержимое ветки if, либо else)
@@ -260,7 +386,7 @@ public:
     }
 
     // Последовательно выполняет добавленные инструкции. Возвращает None
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     std::vector<std::unique_ptr<Statement>> args_;
@@ -283,15 +409,28 @@ private:
 // Тело метода. Как правило, содержит составную инструкцию
 class MethodBody : public Statement {
 public:
+    // Функция, разбирающая тело метода
+    using Loader = std::function<std::unique_ptr<Statement>()>;
+
     explicit MethodBody(std::unique_ptr<Statement>&& body);
+    // Тело разбирается функцией loader при первом выполнении. Если loader выбросил
+    // исключение, разбор повторяется при следующем выполнении
+    explicit MethodBody(Loader loader);
 
     // Вычисляет инструкцию, переданную в качестве body.
     // Если внутри body была выполнена инструкция return, возвращает результат return
     // В противном случае возвращает None
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Хвостовые вызовы выполняются в цикле, в одном и том же кадре
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
-    std::unique_ptr<Statement> body_;
+    // Возвращает тело метода, разбирая его при первом обращении
+    const Statement& GetBody() const;
+
+    Loader loader_;
+    // Единственное изменяемое состояние дерева программы: однократно публикуемое тело
+    mutable std::once_flag loaded_;
+    mutable std::unique_ptr<Statement> body_;
 };
 
 // Выполняет инструкцию return с выражением statement
@@ -301,10 +440,15 @@ public:
 
     // Останавливает выполнение текущего метода. После выполнения инструкции return метод,
     // внутри которого она была исполнена, должен вернуть результат вычисления выражения statement.
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Результат передаётся телу метода без исключения: составные инструкции и циклы прекращают
+    // выполнение, пока возврат не дошёл до тела. Если statement - вызов метода или функции,
+    // он выполняется как хвостовой (см. TailCall)
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     std::unique_ptr<Statement> statement_;
+    MethodCall* tail_call_ = nullptr;
+    FunctionCall* tail_function_call_ = nullptr;
 };
 
 // Объявляет класс
@@ -315,12 +459,39 @@ public:
 
     // Создаёт внутри closure новый объект, совпадающий с именем класса и значением, переданным в
     // конструктор
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     runtime::ObjectHolder cls_;
 };
 
+// Объявляет функцию верхнего уровня
+class FunctionDefinition : public Statement {
+public:
+    // Гарантируется, что ObjectHolder содержит объект типа runtime::Function
+    explicit FunctionDefinition(runtime::ObjectHolder function);
+
+    // Связывает в closure имя функции с её объектом
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    runtime::ObjectHolder function_;
+};
+
+// Выполняет инструкции верхнего уровня импортированного модуля и связывает
+// в closure имена его классов и функций
+class Import : public Statement {
+public:
+    explicit Import(std::shared_ptr<const parse::Module> module);
+
+    // Инструкции модуля выполняются в собственном окружении, поэтому его
+    // переменные не видны программе
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::shared_ptr<const parse::Module> module_;
+};
+
 // Инструкция if <condition> <if_body> else <else_body>
 class IfElse : public Statement {
 public:
@@ -328,7 +499,7 @@ public:
     IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> if_body,
            std::unique_ptr<Statement> else_body);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     std::unique_ptr<Statement> condition_;
@@ -336,6 +507,121 @@ private:
     std::unique_ptr<Statement> else_body_;
 };
 
+// Инструкция while <condition>: <body>
+class While : public Statement {
+public:
+    While(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> body);
+
+    // Выполняет body, пока значение condition, приведённое к Bool, равно True. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::unique_ptr<Statement> condition_;
+    std::unique_ptr<Statement> body_;
+};
+
+// Инструкция for <var> in range(<start>, <stop>[, <step>]): <body>
+class ForRange : public Statement {
+public:
+    // Параметр step может быть равен nullptr, в этом случае шаг равен 1
+    ForRange(std::string var, std::unique_ptr<Statement> start, std::unique_ptr<Statement> stop,
+             std::unique_ptr<Statement> step, std::unique_ptr<Statement> body);
+
+    // Границы и шаг вычисляются один раз до начала цикла и должны быть числами,
+    // шаг не может быть нулевым. Счётчик цикла хранится как int и на каждой итерации
+    // присваивается переменной var. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::string var_;
+    std::unique_ptr<Statement> start_;
+    std::unique_ptr<Statement> stop_;
+    std::unique_ptr<Statement> step_;
+    std::unique_ptr<Statement> body_;
+};
+
+// Создаёт список из значений выражений [<item>, <item>, ...]
+class ListLiteral : public Statement {
+public:
+    explicit ListLiteral(std::vector<std::unique_ptr<Statement>> items);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::vector<std::unique_ptr<Statement>> items_;
+};
+
+// Создаёт словарь из пар значений выражений {<key>: <value>, ...}
+class DictLiteral : public Statement {
+public:
+    using Item = std::pair<std::unique_ptr<Statement>, std::unique_ptr<Statement>>;
+
+    explicit DictLiteral(std::vector<Item> items);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::vector<Item> items_;
+};
+
+// Операция <object>[<index>], возвращающая элемент списка, символ строки либо значение
+// из словаря. Отрицательный индекс отсчитывается от конца последовательности
+class Index : public Statement {
+public:
+    Index(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::unique_ptr<Statement> object_;
+    std::unique_ptr<Statement> index_;
+};
+
+// Операция <object>[<start>:<stop>], возвращающая новый список либо подстроку.
+// Границы приводятся к длине последовательности так же, как в Python
+class Slice : public Statement {
+public:
+    // Параметры start и stop могут быть равны nullptr, в этом случае срез
+    // начинается с начала последовательности либо продолжается до её конца
+    Slice(std::unique_ptr<Statement> object, std::unique_ptr<Statement> start,
+          std::unique_ptr<Statement> stop);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::unique_ptr<Statement> object_;
+    std::unique_ptr<Statement> start_;
+    std::unique_ptr<Statement> stop_;
+};
+
+// Инструкция <object>[<index>] = <rv>, заменяющая элемент списка либо значение в словаре.
+// Возвращает присвоенное значение
+class IndexAssignment : public Statement {
+public:
+    IndexAssignment(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index,
+                    std::unique_ptr<Statement> rv);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::unique_ptr<Statement> object_;
+    std::unique_ptr<Statement> index_;
+    std::unique_ptr<Statement> rv_;
+};
+
+// Инструкция del <object>[<index>], удаляющая элемент списка либо ключ словаря
+class DeleteItem : public Statement {
+public:
+    DeleteItem(std::unique_ptr<Statement> object, std::unique_ptr<Statement> index);
+
+    // Если ключа нет в словаре, выбрасывает исключение runtime_error. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+private:
+    std::unique_ptr<Statement> object_;
+    std::unique_ptr<Statement> index_;
+};
+
 // Операция сравнения
 class Comparison : public BinaryOperation {
 public:
@@ -347,7 +633,7 @@ public:
 
     // Вычисляет значение выражений lhs и rhs и возвращает результат работы comparator,
     // приведённый к типу runtime::Bool
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
     
 private:
     Comparator comparator_;
@@ -0,0 +1,181 @@
+#include "thread_pool.h"
+
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+// Пул и номер очереди рабочего потока, выполняющегося в текущем потоке
+thread_local WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<Queue>());
+    }
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this, i] {
+            RunWorker(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        unique_lock lock(mutex_);
+        all_done_.wait(lock, [this] {
+            return unfinished_ == 0;
+        });
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (thread& t : threads_) {
+        t.join();
+    }
+}
+
+void WorkStealingPool::Submit(Task task) {
+    size_t index = current_queue;
+    {
+        // Счётчик меняется под мьютексом, чтобы засыпающий поток не пропустил задачу.
+        // До появления задачи в очереди проснувшийся поток лишь повторит поиск
+        lock_guard lock(mutex_);
+        if (current_pool != this) {
+            index = next_queue_++ % queues_.size();
+        }
+        ++unfinished_;
+        ++queued_;
+    }
+    {
+        lock_guard lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(move(task));
+    }
+    work_available_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    unique_lock lock(mutex_);
+    all_done_.wait(lock, [this] {
+        return unfinished_ == 0;
+    });
+    if (error_) {
+        rethrow_exception(exchange(error_, nullptr));
+    }
+}
+
+bool WorkStealingPool::RunPendingTask() {
+    Task task;
+    if (current_pool == this) {
+        if (!TryPop(current_queue, task) && !TrySteal(current_queue, task)) {
+            return false;
+        }
+    } else {
+        // Поток вне пула забирает задачи из начала очередей, как и рабочие потоки
+        size_t i = 0;
+        while (i < queues_.size() && !TryStealFrom(i, task)) {
+            ++i;
+        }
+        if (i == queues_.size()) {
+            return false;
+        }
+    }
+    RunTask(task);
+    return true;
+}
+
+size_t WorkStealingPool::GetThreadCount() const {
+    return threads_.size();
+}
+
+size_t WorkStealingPool::GetStealCount() const {
+    return steals_.load(memory_order_relaxed);
+}
+
+bool WorkStealingPool::TryPop(size_t index, Task& task) {
+    Queue& queue = *queues_[index];
+    lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::TrySteal(size_t thief, Task& task) {
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        if (TryStealFrom((thief + i) % queues_.size(), task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingPool::TryStealFrom(size_t index, Task& task) {
+    Queue& queue = *queues_[index];
+    lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = move(queue.tasks.front());
+    queue.tasks.pop_front();
+    steals_.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void WorkStealingPool::RunTask(Task& task) {
+    queued_.fetch_sub(1, memory_order_relaxed);
+    exception_ptr error;
+    try {
+        task();
+    } catch (...) {
+        error = current_exception();
+    }
+    // Задача освобождается до уменьшения счётчика: Wait гарантирует, что её
+    // захваченные объекты уже разрушены
+    task = nullptr;
+    Finish(error);
+}
+
+void WorkStealingPool::RunWorker(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    for (;;) {
+        Task task;
+        if (TryPop(index, task) || TrySteal(index, task)) {
+            RunTask(task);
+            continue;
+        }
+        unique_lock lock(mutex_);
+        work_available_.wait(lock, [this] {
+            return stopping_ || queued_.load(memory_order_relaxed) > 0;
+        });
+        if (stopping_ && queued_.load(memory_order_relaxed) == 0) {
+            break;
+        }
+    }
+    current_pool = nullptr;
+}
+
+void WorkStealingPool::Finish(exception_ptr error) {
+    bool done = false;
+    {
+        lock_guard lock(mutex_);
+        if (error && !error_) {
+            error_ = error;
+        }
+        done = --unfinished_ == 0;
+    }
+    if (done) {
+        all_done_.notify_all();
+    }
+}
+
+}  // namespace runtime
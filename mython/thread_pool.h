@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace runtime {
+
+/*
+ * Пул потоков с перехватом работы. У каждого рабочего потока своя очередь задач:
+ * поток берёт задачи с её конца, а опустевший поток забирает задачи из начала очередей
+ * других потоков. Задачи, поставленные извне, распределяются по очередям по кругу,
+ * а задачи, поставленные из рабочего потока, попадают в его собственную очередь.
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(size_t thread_count);
+    // Дожидается выполнения поставленных задач и останавливает потоки
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Ставит задачу в очередь. Может вызываться из любого потока, в том числе из задачи
+    void Submit(Task task);
+
+    // Дожидается выполнения всех поставленных задач. Если задача выбросила исключение,
+    // пробрасывает первое из них
+    void Wait();
+
+    // Выполняет в текущем потоке одну задачу из очередей пула. Возвращает false,
+    // если очереди пусты. Позволяет потоку, ожидающему результат задачи, не простаивать
+    bool RunPendingTask();
+
+    [[nodiscard]] size_t GetThreadCount() const;
+    // Возвращает количество задач, перехваченных у других потоков
+    [[nodiscard]] size_t GetStealCount() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool TryPop(size_t index, Task& task);
+    bool TrySteal(size_t thief, Task& task);
+    bool TryStealFrom(size_t index, Task& task);
+    void RunTask(Task& task);
+    void RunWorker(size_t index);
+    void Finish(std::exception_ptr error);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable all_done_;
+    // Задачи в очередях и поставленные, но ещё не завершённые задачи
+    std::atomic<size_t> queued_ = 0;
+    size_t unfinished_ = 0;
+    size_t next_queue_ = 0;
+    bool stopping_ = false;
+    std::exception_ptr error_;
+    std::atomic<size_t> steals_ = 0;
+};
+
+}  // namespace runtime